@@ -0,0 +1,115 @@
+#include "buffer_pool.h"
+
+#include <bit>
+#include <new>
+
+extern "C" {
+#include <libavutil/buffer.h>
+}
+
+// the smallest size class is 4 KiB
+static const unsigned minimum_size_log2 = 12;
+
+static size_t size_class(size_t size, size_t& class_size) {
+    size = std::max<size_t>(size, size_t(1) << minimum_size_log2);
+    unsigned log2 = std::bit_width(size) - 1;
+    size_t base = size_t(1) << log2, step = base / 4;
+    // round up to the next quarter
+    size_t quarters = (size - base + step - 1) / step;
+    if (quarters == 4) {
+        log2++;
+        base *= 2;
+        quarters = 0;
+    }
+    class_size = base + quarters * (base / 4);
+    return (log2 - minimum_size_log2) * 4 + quarters;
+}
+
+// stored in front of the data, so freeing doesn't need a lookup
+struct buffer_pool::block {
+    std::shared_ptr<buffer_pool::counters> counters;
+    size_t size;
+};
+
+buffer_pool::buffer_pool() :
+    shared_counters(std::make_shared<counters>())
+{}
+
+buffer_pool::~buffer_pool() {
+    // buffers in use keep their AVBufferPool until they're released
+    for (auto& pool : size_classes)
+        av_buffer_pool_uninit(&pool);
+}
+
+unique_av_buffer buffer_pool::allocate(size_t size) {
+    size_t size_class_bytes;
+    size_t size_class = ::size_class(size, size_class_bytes);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (size_class >= size_classes.size())
+        size_classes.resize(size_class + 1, nullptr);
+    AVBufferPool*& pool = size_classes[size_class];
+    if (!pool) {
+        pool = av_buffer_pool_init2(
+            static_cast<int>(size_class_bytes), this, allocate_block, nullptr
+        );
+        if (!pool)
+            throw std::bad_alloc();
+    }
+    // reuses a released buffer and its AVBuffer, or calls allocate_block
+    unique_av_buffer buffer = av_buffer_pool_get(pool);
+    if (!buffer)
+        throw std::bad_alloc();
+    gets++;
+    return buffer;
+}
+
+AVBufferRef* buffer_pool::allocate_block(void* opaque, int size) {
+    static_assert(sizeof(block) <= alignment);
+    auto pool = static_cast<buffer_pool*>(opaque);
+    // exceptions can't pass through FFmpeg
+    auto data = static_cast<uint8_t*>(::operator new(
+        alignment + size, std::align_val_t(alignment), std::nothrow
+    ));
+    if (!data)
+        return nullptr;
+    new (data) block{pool->shared_counters, static_cast<size_t>(size)};
+    pool->shared_counters->allocations++;
+    pool->shared_counters->allocated_bytes += size;
+
+    AVBufferRef* buffer = av_buffer_create(
+        data + alignment, size, free_block, data, 0
+    );
+    if (!buffer)
+        free_block(data, data + alignment);
+    return buffer;
+}
+
+void buffer_pool::free_block(void* opaque, uint8_t*) {
+    auto header = static_cast<block*>(opaque);
+    header->counters->allocated_bytes -= header->size;
+    header->~block();
+    ::operator delete(opaque, std::align_val_t(alignment));
+}
+
+buffer_pool_statistics buffer_pool::statistics() {
+    uint64_t allocations = shared_counters->allocations;
+    uint64_t gets = this->gets;
+    return {
+        .allocations = allocations,
+        .reuses = gets > allocations ? gets - allocations : 0,
+        .allocated_bytes = shared_counters->allocated_bytes,
+    };
+}
+
+void buffer_pool::trim() {
+    std::lock_guard<std::mutex> lock(mutex);
+    // the next allocation of a size class starts a new AVBufferPool
+    for (auto& pool : size_classes)
+        av_buffer_pool_uninit(&pool);
+}
+
+buffer_pool& plane_pool() {
+    static buffer_pool pool;
+    return pool;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "../utility/av_resource.h"
+
+struct buffer_pool_statistics {
+    uint64_t allocations; // buffers allocated from the system
+    uint64_t reuses; // buffers handed out again after being released
+    size_t allocated_bytes; // in use and unused
+};
+
+/**
+ * @brief buffer_pool hands out 64-byte aligned, reference counted buffers.
+ * Sizes are rounded up to size classes, a quarter of a power of two apart.
+ * Every size class is an AVBufferPool, which keeps released buffers together
+ * with their AVBuffer for reuse, until trim. Buffers may outlive the pool,
+ * e.g. frames decoders still hold at exit, they are freed once released.
+ */
+struct buffer_pool {
+    buffer_pool();
+    buffer_pool(const buffer_pool&) = delete;
+    ~buffer_pool();
+
+    buffer_pool& operator=(const buffer_pool&) = delete;
+
+    /**
+     * @brief allocate returns a buffer of at least the given size. The buffer
+     * returns to the pool when its last reference is released.
+     */
+    unique_av_buffer allocate(size_t size);
+
+    buffer_pool_statistics statistics();
+
+    /**
+     * @brief trim frees all unused buffers. Buffers in use are freed once
+     * they are released instead of being kept.
+     */
+    void trim();
+
+    static constexpr size_t alignment = 64;
+
+private:
+    // shared with the buffers, which may be freed after the pool
+    struct counters {
+        std::atomic<uint64_t> allocations{0};
+        std::atomic<size_t> allocated_bytes{0};
+    };
+    // blocks start with a header, the data follows after alignment bytes
+    struct block;
+
+    // alloc of the AVBufferPools, the opaque is the pool
+    static struct AVBufferRef* allocate_block(void* opaque, int size);
+    static void free_block(void* opaque, uint8_t* data);
+
+    std::mutex mutex;
+    // per size class, nullptr until it's first used or after trim
+    std::vector<struct AVBufferPool*> size_classes;
+    std::shared_ptr<counters> shared_counters;
+    std::atomic<uint64_t> gets{0};
+};
+
+/**
+ * @brief plane_pool is the pool for frame planes.
+ */
+buffer_pool& plane_pool();
@@ -1 +1,131 @@
 #include "frame.h"
+
+#include <new>
+
+extern "C" {
+#include <libavutil/buffer.h>
+}
+
+#include "buffer_pool.h"
+#include "scale_down.h"
+
+static uint32_t align(uint32_t size) {
+    return (size + frame_alignment - 1) / frame_alignment * frame_alignment;
+}
+
+size_t frame::size() const {
+    size_t size = 0;
+    for (auto plane = 0u; plane < format.plane_count; plane++) {
+        size +=
+            format.plane_width(plane, width) *
+            format.plane_height(plane, height) * format.sample_size;
+    }
+    return size;
+}
+
+static uint32_t plane_layout(
+    frame& frame, uint32_t offsets[3], uint32_t size
+) {
+    for (auto plane = 0u; plane < frame.format.plane_count; plane++) {
+        frame.planes[plane].stride = align(
+            frame.format.plane_width(plane, frame.width) *
+            frame.format.sample_size
+        );
+        offsets[plane] = size;
+        size += align(
+            frame.planes[plane].stride *
+            frame.format.plane_height(plane, frame.height)
+        );
+    }
+    return size;
+}
+
+frame allocate_frame(
+    pixel_format format, uint16_t width, uint16_t height, uint64_t time,
+    frame_allocator* allocator
+) {
+    frame frame{
+        .format = format,
+        .time = time,
+        .width = width,
+        .height = height,
+    };
+
+    uint32_t offsets[3];
+    uint32_t size = plane_layout(frame, offsets, 0);
+
+    if (allocator)
+        frame.buffers[0] = allocator->allocate(size);
+    if (!frame.buffers[0])
+        frame.buffers[0] = plane_pool().allocate(size);
+    for (auto plane = 0u; plane < format.plane_count; plane++)
+        frame.planes[plane].data = frame.buffers[0]->data + offsets[plane];
+
+    return frame;
+}
+
+static void scale_down(const frame& source, frame& destination) {
+    for (auto plane = 0u; plane < source.format.plane_count; plane++) {
+        uint16_t width = source.format.plane_width(plane, source.width);
+        uint16_t height = source.format.plane_height(plane, source.height);
+        if (source.format.sample_size == 1) {
+            scale_down(
+                source.planes[plane].data, source.planes[plane].stride,
+                destination.planes[plane].data,
+                destination.planes[plane].stride, width, height
+            );
+            continue;
+        }
+        // planes and rows are aligned, so they are for 2 byte samples as well
+        scale_down(
+            reinterpret_cast<const uint16_t*>(source.planes[plane].data),
+            source.planes[plane].stride,
+            reinterpret_cast<uint16_t*>(destination.planes[plane].data),
+            destination.planes[plane].stride, width, height
+        );
+    }
+}
+
+frame scale_down(const frame& source) {
+    // TODO: what to do with 1x1 frames?
+    // odd sizes are rounded up, like the planes
+    frame frame = allocate_frame(
+        source.format, (source.width + 1) / 2, (source.height + 1) / 2,
+        source.time
+    );
+    frame.duration = source.duration;
+    scale_down(source, frame);
+    return frame;
+}
+
+std::vector<frame> build_pyramid(const frame& source, unsigned count) {
+    std::vector<frame> levels(count);
+    std::vector<uint32_t> offsets(count * 3);
+    uint32_t size = 0;
+    for (auto level = 0u; level < count; level++) {
+        const frame& larger = level ? levels[level - 1] : source;
+        levels[level] = {
+            .format = source.format,
+            .time = source.time,
+            .duration = source.duration,
+            .width = static_cast<uint16_t>((larger.width + 1) / 2),
+            .height = static_cast<uint16_t>((larger.height + 1) / 2),
+        };
+        size = plane_layout(levels[level], &offsets[level * 3], size);
+    }
+
+    unique_av_buffer buffer = plane_pool().allocate(size);
+    for (auto level = 0u; level < count; level++) {
+        frame& frame = levels[level];
+        for (auto plane = 0u; plane < frame.format.plane_count; plane++) {
+            frame.planes[plane].data =
+                buffer->data + offsets[level * 3 + plane];
+        }
+        frame.buffers[0] = av_buffer_ref(buffer.get());
+        if (!frame.buffers[0])
+            throw std::bad_alloc();
+
+        scale_down(level ? levels[level - 1] : source, frame);
+    }
+    return levels;
+}
@@ -1,12 +1,125 @@
 #pragma once
 
-#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "../utility/av_resource.h"
+
+/**
+ * @brief pixel_format describes the planes of a frame. The first plane is
+ * luma, the others are chroma and subsampled by the given shifts. Samples of
+ * more than 8 bits take up 2 bytes in native byte order, with the bits in the
+ * low end, like FFmpeg's formats.
+ */
+struct pixel_format {
+    uint8_t plane_count;
+    uint8_t chroma_shift_x, chroma_shift_y;
+    uint8_t sample_size; // in bytes
+    uint8_t bit_depth;
+
+    uint16_t plane_width(unsigned plane, uint16_t width) const;
+    uint16_t plane_height(unsigned plane, uint16_t height) const;
+    // the largest value of a sample
+    uint16_t maximum() const { return (1 << bit_depth) - 1; }
+
+    bool operator==(const pixel_format&) const = default;
+};
+
+/**
+ * @brief planar_yuv describes 3 planes of the given subsampling and depth,
+ * e.g. 4:2:2 at 10 bits is planar_yuv(1, 0, 10).
+ */
+constexpr pixel_format planar_yuv(
+    uint8_t chroma_shift_x, uint8_t chroma_shift_y, uint8_t bit_depth
+) {
+    return {
+        3, chroma_shift_x, chroma_shift_y, uint8_t(bit_depth > 8 ? 2 : 1),
+        bit_depth
+    };
+}
+
+constexpr pixel_format yuv420p = planar_yuv(1, 1, 8);
+
+// alignment of planes and rows of frames allocated by allocate_frame
+constexpr unsigned frame_alignment = 64;
 
 struct frame {
-    struct {
-        std::unique_ptr<uint8_t[]> y, cb, cr;
-    } pixels;
+    struct plane {
+        uint8_t* data;
+        uint32_t stride; // distance between rows in bytes
+    };
+    plane planes[3]; // y, cb, cr
+    pixel_format format;
+    // reference counted memory of the planes, possibly shared with the
+    // decoder, a plane may point into any of them
+    unique_av_buffer buffers[3];
     uint64_t time;
+    uint32_t duration; // in milliseconds, 0 if unknown
     uint16_t width, height;
+
+    /**
+     * @brief size is the number of bytes of visible samples in all planes.
+     */
+    size_t size() const;
+};
+
+/**
+ * @brief frame_allocator provides memory for frames in place of the plane
+ * pool, e.g. memory the GPU reads from directly.
+ */
+struct frame_allocator {
+    virtual ~frame_allocator() = default;
+
+    /**
+     * @brief allocate returns a buffer of at least the given size, aligned
+     * to frame_alignment. It may be called from any thread.
+     * @return the buffer, or nullptr if the allocator is out of memory, the
+     * caller falls back to its own then.
+     */
+    virtual unique_av_buffer allocate(size_t size) = 0;
 };
 
+/**
+ * @brief allocate_frame allocates all planes of a frame in one buffer, with
+ * every plane and row aligned to frame_alignment.
+ * @param allocator provides the buffer, the plane pool does if it's nullptr
+ * or out of memory.
+ */
+frame allocate_frame(
+    pixel_format format, uint16_t width, uint16_t height, uint64_t time = 0,
+    frame_allocator* allocator = nullptr
+);
+
+/**
+ * @brief scale_down halves the size of the frame in both dimensions, rounding
+ * odd sizes up. The format is kept.
+ */
+frame scale_down(const frame& source);
+
+/**
+ * @brief build_pyramid downscales a frame repeatedly, with all levels in one
+ * buffer.
+ * @param source is the frame to start from.
+ * @param count is the number of levels.
+ * @return the levels, the first one is half the size of the source, every
+ * following one half the size of the one before.
+ */
+std::vector<frame> build_pyramid(const frame& source, unsigned count);
+
+inline uint16_t pixel_format::plane_width(
+    unsigned plane, uint16_t width
+) const {
+    if (plane == 0)
+        return width;
+    // round up, like FFmpeg does
+    return (width + (1 << chroma_shift_x) - 1) >> chroma_shift_x;
+}
+
+inline uint16_t pixel_format::plane_height(
+    unsigned plane, uint16_t height
+) const {
+    if (plane == 0)
+        return height;
+    return (height + (1 << chroma_shift_y) - 1) >> chroma_shift_y;
+}
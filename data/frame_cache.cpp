@@ -1,97 +1,706 @@
+#include "frame.h"
 #include "frame_cache.h"
 
-void scale_down(
-    uint8_t* source, uint8_t* destination, uint16_t width, uint16_t height
+#include <algorithm>
+#include <bit>
+#include <functional>
+#include <limits>
+
+#include "../utility/thread_pool.h"
+
+size_t frame_timeline::find(uint64_t time_stamp) const {
+    auto i = std::upper_bound(times.begin(), times.end(), time_stamp);
+    if (i == times.begin())
+        return -1;
+    size_t index = i - times.begin() - 1;
+    // the next frame may be missing from the cache
+    uint32_t duration = entries[index].duration;
+    if (duration && time_stamp >= times[index] + duration)
+        return -1;
+    return index;
+}
+
+// returns the closest of the levels to the given one, preferring larger
+// frames
+static uint32_t closest_level(uint32_t levels, uint32_t level) {
+    // levels up to the given one, wraps around to all levels for the last one
+    uint32_t larger = levels & ((2u << level) - 1);
+    return larger ? std::bit_width(larger) - 1 : std::countr_zero(levels);
+}
+
+const frame_timeline::stored_level& frame_timeline::get(
+    size_t index, uint32_t level
+) const {
+    const entry& entry = entries[index];
+    uint32_t closest = closest_level(entry.levels, level);
+    return (*entry.stored)[
+        std::popcount(entry.levels & ((1u << closest) - 1))
+    ];
+}
+
+const frame_timeline::stored_level* frame_timeline::get_decoded(
+    size_t index, uint32_t level
+) const {
+    const entry& entry = entries[index];
+    uint32_t decoded = 0;
+    size_t position = 0;
+    for (uint32_t levels = entry.levels; levels; levels &= levels - 1) {
+        if ((*entry.stored)[position++].frame)
+            decoded |= 1u << std::countr_zero(levels);
+    }
+    if (!decoded)
+        return nullptr;
+    uint32_t closest = closest_level(decoded, level);
+    return &(*entry.stored)[
+        std::popcount(entry.levels & ((1u << closest) - 1))
+    ];
+}
+
+bool frame_timeline::insert(
+    uint64_t time_stamp, uint32_t level, stored_level stored,
+    const entry& metadata
 ) {
-    for (uint16_t y = 0; y < height / 2; y++) {
-        uint8_t* source_pixel = source;
-        for (uint16_t x = 0; x < width / 2; x++) {
-            uint16_t sum = 0;
-            sum += *source_pixel;
-            sum += *(source_pixel + width);
-            source_pixel++;
-            sum += *source_pixel;
-            sum += *(source_pixel + width);
-            source_pixel++;
-
-            *destination = sum / 4;
-            destination++;
-        }
-        source += width * 2;
+    auto i = std::lower_bound(times.begin(), times.end(), time_stamp);
+    size_t index = i - times.begin();
+    if (i == times.end() || *i != time_stamp) {
+        times.insert(i, time_stamp);
+        entries.insert(entries.begin() + index, metadata);
+        entries[index].levels = 0;
+        entries[index].stored = nullptr;
     }
+
+    entry& entry = entries[index];
+    uint32_t bit = 1u << level;
+    if (entry.levels & bit)
+        return false;
+    size_t position = std::popcount(entry.levels & (bit - 1));
+    // copies of the timeline keep the levels they had
+    auto levels = entry.stored ?
+        std::make_shared<std::vector<stored_level>>(*entry.stored) :
+        std::make_shared<std::vector<stored_level>>();
+    levels->insert(levels->begin() + position, std::move(stored));
+    entry.stored = std::move(levels);
+    entry.levels |= bit;
+    return true;
+}
+
+size_t frame_timeline::index_of(uint64_t time_stamp) const {
+    auto i = std::lower_bound(times.begin(), times.end(), time_stamp);
+    if (i == times.end() || *i != time_stamp)
+        return -1;
+    return i - times.begin();
+}
+
+frame_timeline::stored_level frame_timeline::erase(
+    uint64_t time_stamp, uint32_t level
+) {
+    size_t index = index_of(time_stamp);
+    uint32_t bit = 1u << level;
+    if (index == size_t(-1) || !(entries[index].levels & bit))
+        return {};
+    entry& entry = entries[index];
+    size_t position = std::popcount(entry.levels & (bit - 1));
+    auto levels = std::make_shared<std::vector<stored_level>>(*entry.stored);
+    stored_level stored = std::move((*levels)[position]);
+    levels->erase(levels->begin() + position);
+    entry.stored = std::move(levels);
+    entry.levels &= ~bit;
+
+    if (!entry.levels) {
+        times.erase(times.begin() + index);
+        entries.erase(entries.begin() + index);
+    }
+    return stored;
+}
+
+double playhead_eviction_policy::score(const cached_frame& frame) const {
+    double seconds = frame.playhead_distance / 1000.0;
+    double weighted =
+        (seconds < 0 ? -seconds * per_second_before :
+            seconds * per_second_after) +
+        frame.age / 1000.0 * per_thousand_lookups +
+        frame.frames_since_keyframe * per_frame_from_keyframe;
+    // frames in other files are far enough to stay first within their tier
+    weighted = std::clamp(weighted, -tier / 4, tier / 4);
+
+    int64_t levels_above_display =
+        std::max<int64_t>(int64_t(frame.display_level) - frame.key.level, 0);
+    return (levels_above_display * 2 + !frame.compressed) * tier + weighted;
+}
+
+frame_cache::frame_cache() :
+    compactor(&frame_cache::compact_in_background, this)
+{}
+
+frame_cache::~frame_cache() {
+    {
+        std::lock_guard<std::mutex> lock(compaction_mutex);
+        stopping = true;
+    }
+    work_added.notify_all();
+    compactor.join();
 }
 
 std::shared_ptr<frame> frame_cache::get_frame(frame_key key) {
-    auto i = frames.upper_bound(key);
-    if (
-        i != frames.end() &&
-        i->first.file == key.file // TODO: check time-stamp
-    ) {
-        return i->second;
+    // the frame may have started in an earlier bucket, at most as long ago
+    // as the longest frame lasts, or in the previous one if it's unknown
+    uint64_t reach = std::max<uint64_t>(longest_duration, bucket_length);
+    uint64_t first_bucket =
+        (key.time_stamp - std::min(key.time_stamp, reach)) / bucket_length;
+    std::optional<frame_key> missing_level, compressed_level;
+    std::shared_ptr<::frame> frame;
+    uint64_t bucket = key.time_stamp / bucket_length;
+    while (true) {
+        frame = find(
+            key.file, key.time_stamp, bucket, key.level, missing_level,
+            compressed_level
+        );
+        if (frame || compressed_level || bucket == first_bucket)
+            break;
+        bucket--;
     }
-    return nullptr;
+
+    if (frame)
+        hits++;
+    else
+        misses++;
+
+    bool restorable =
+        !frame && !compressed_level && find_spill_file(key.file);
+    if (missing_level || compressed_level || restorable) {
+        // lookups never block, the next one requests it again
+        std::unique_lock<std::mutex> lock(compaction_mutex, std::try_to_lock);
+        if (lock) {
+            if (missing_level)
+                pyramid_requests.push_back(*missing_level);
+            if (compressed_level)
+                decompress_requests.push_back(*compressed_level);
+            if (restorable)
+                restore_requests.push_back(key);
+            lock.unlock();
+            work_added.notify_one();
+        }
+    }
+    return frame;
 }
 
 void frame_cache::put_frame(frame_key key, frame&& frame) {
-    auto cost = frame.width * frame.height * 3 / 2;
+    put_frame(key, std::make_shared<::frame>(std::move(frame)));
+}
+
+void frame_cache::put_frame(frame_key key, std::shared_ptr<frame> frame) {
+    size_t charge = frame->size();
+    if (!insert(key, {std::move(frame)}, charge))
+        return;
+    if (memory_usage <= memory_limit)
+        return;
+
+    {
+        // the compactor checks memory_usage under this lock
+        std::lock_guard<std::mutex> lock(compaction_mutex);
+    }
+    work_added.notify_one();
+
+    // the compactor is falling behind
+    while (memory_usage > memory_limit + soft_margin)
+        compact();
+}
+
+void frame_cache::set_playhead(file* file, uint64_t milliseconds) {
+    playhead_file = file;
+    playhead = milliseconds;
+}
+
+void frame_cache::set_display_level(uint32_t level) {
+    display_level = level;
+}
+
+void frame_cache::add_spill_file(
+    file* file, std::unique_ptr<spill_file> spill
+) {
+    if (spill)
+        spill_files.emplace_back(file, std::move(spill));
+}
+
+size_t frame_cache::restore(file* file, uint64_t begin, uint64_t end) {
+    spill_file* spill = find_spill_file(file);
+    if (!spill)
+        return 0;
+    size_t count = 0;
+    for (uint64_t time : spill->times(begin, end))
+        count += contains(file, time) || restore_frame({file, time, 0});
+    return count;
+}
+
+frame_cache_statistics frame_cache::statistics() {
+    return {
+        .hits = hits,
+        .misses = misses,
+        .insertions = insertions,
+        .compressions = compressions,
+        .downscales = downscales,
+        .drops = drops,
+        .pyramids = pyramids,
+        .spills = spills,
+        .restores = restores,
+    };
+}
+
+frame_cache::shard& frame_cache::find_shard(file* file, uint64_t time_stamp) {
+    size_t hash =
+        std::hash<::file*>()(file) ^
+        time_stamp / bucket_length * 0x9e3779b97f4a7c15ull;
+    return shards[hash % shard_count];
+}
+
+std::shared_ptr<frame> frame_cache::find(
+    file* file, uint64_t time_stamp, uint64_t bucket, uint32_t level,
+    std::optional<frame_key>& missing_level,
+    std::optional<frame_key>& compressed_level
+) {
+    std::shared_ptr<const snapshot> snapshot =
+        find_shard(file, bucket * bucket_length).snapshot.load();
+    const frame_timeline* timeline =
+        snapshot ? find_timeline(*snapshot, file) : nullptr;
+    if (!timeline)
+        return nullptr;
+
+    size_t index = timeline->find(time_stamp);
+    // other buckets share the shard
     if (
-        frames.emplace(key, std::make_shared<::frame>(std::move(frame))).second
-    ) {
-        eviction_queue.emplace(cost, key);
-        memory_usage += cost;
-
-        while (memory_usage > memory_limit) {
-            auto evicted = frames.find(eviction_queue.top().second);
-            auto evicted_frame = std::move(evicted->second);
-
-            key = {
-                evicted->first.file, evicted->first.time_stamp,
-                evicted->first.level + 1
-            };
-
-            memory_usage -= eviction_queue.top().first;
-            eviction_queue.pop();
-            frames.erase(evicted);
-
-            // TODO: what to do with 1x1 frames?
-            frame = {
-                .pixels = {
-                    .y = std::make_unique<uint8_t[]>(
-                        evicted_frame->height * evicted_frame->width / 4
-                    ),
-                    .cb = std::make_unique<uint8_t[]>(
-                        evicted_frame->height * evicted_frame->width / 4 / 4
-                    ),
-                    .cr = std::make_unique<uint8_t[]>(
-                        evicted_frame->height * evicted_frame->width / 4 / 4
-                    ),
-                },
-                .width = static_cast<uint16_t>(evicted_frame->width / 2),
-                .height = static_cast<uint16_t>(evicted_frame->height / 2),
-            };
-
-            scale_down(
-                evicted_frame->pixels.y.get(), frame.pixels.y.get(),
-                evicted_frame->width, evicted_frame->height
+        index == size_t(-1) ||
+        timeline->times[index] / bucket_length != bucket
+    )
+        return nullptr;
+    const frame_timeline::entry& entry = timeline->entries[index];
+    entry.last_access.store(++clock, std::memory_order_relaxed);
+    bool larger = entry.levels & ((1u << level) - 1);
+    if (!(entry.levels & (1u << level)) && larger)
+        missing_level = frame_key{file, timeline->times[index], level};
+
+    const frame_timeline::stored_level& stored = timeline->get(index, level);
+    if (stored.frame)
+        return stored.frame;
+    auto last = last_decompressed.load();
+    if (last && last->source == stored.compressed)
+        return last->frame;
+    // decompressing takes too long for the caller, another level is shown
+    // until it's done
+    compressed_level = frame_key{file, timeline->times[index], level};
+    const frame_timeline::stored_level* decoded =
+        timeline->get_decoded(index, level);
+    return decoded ? decoded->frame : nullptr;
+}
+
+const frame_timeline* frame_cache::find_timeline(
+    const snapshot& snapshot, file* file
+) {
+    for (auto& [timeline_file, timeline] : snapshot.timelines) {
+        if (timeline_file == file)
+            return timeline.get();
+    }
+    return nullptr;
+}
+
+std::shared_ptr<frame_cache::snapshot> frame_cache::copy_snapshot(
+    shard& shard, file* file, frame_timeline*& timeline
+) {
+    auto current = shard.snapshot.load();
+    // only the timeline which changes is copied
+    auto next = current ?
+        std::make_shared<snapshot>(*current) :
+        std::make_shared<snapshot>();
+    for (auto& [timeline_file, file_timeline] : next->timelines) {
+        if (timeline_file == file) {
+            auto copy = std::make_shared<frame_timeline>(*file_timeline);
+            timeline = copy.get();
+            file_timeline = std::move(copy);
+            return next;
+        }
+    }
+    auto added = std::make_shared<frame_timeline>();
+    timeline = added.get();
+    next->timelines.emplace_back(file, std::move(added));
+    return next;
+}
+
+bool frame_cache::contains(file* file, uint64_t time_stamp) {
+    auto snapshot = find_shard(file, time_stamp).snapshot.load();
+    const frame_timeline* timeline =
+        snapshot ? find_timeline(*snapshot, file) : nullptr;
+    return timeline && timeline->index_of(time_stamp) != size_t(-1);
+}
+
+cached_frame frame_cache::describe(
+    file* file, const frame_timeline& timeline, size_t index
+) const {
+    const frame_timeline::entry& entry = timeline.entries[index];
+    uint64_t time = timeline.times[index];
+    // the largest version of a frame is the first to go
+    uint32_t level = std::countr_zero(entry.levels);
+
+    int64_t playhead_distance = std::numeric_limits<int64_t>::max();
+    if (file == playhead_file)
+        playhead_distance = int64_t(time) - int64_t(playhead.load());
+
+    // readers may have moved the clock on in the meantime
+    uint64_t now = clock, last_access = entry.last_access;
+    return {
+        .key = {file, time, level},
+        .size = entry.stored->front().charge,
+        .playhead_distance = playhead_distance,
+        .age = now > last_access ? now - last_access : 0,
+        .frames_since_keyframe = entry.frames_since_keyframe,
+        .display_level = display_level,
+        .compressed = entry.stored->front().compressed != nullptr,
+    };
+}
+
+bool frame_cache::insert(
+    frame_key key, std::vector<std::shared_ptr<frame>> levels, size_t charge
+) {
+    frame_timeline::entry metadata{
+        .duration = levels.front()->duration,
+        .frames_since_keyframe = static_cast<uint32_t>(
+            key.file ? key.file->frames_since_keyframe(key.time_stamp) : 0
+        ),
+        .last_access = clock.load(),
+    };
+    size_t inserted = 0;
+
+    shard& shard = find_shard(key.file, key.time_stamp);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        frame_timeline* timeline;
+        auto next = copy_snapshot(shard, key.file, timeline);
+
+        // from the smallest level, which is charged for the buffer
+        for (size_t i = levels.size(); i-- > 0;) {
+            bool added = timeline->insert(
+                key.time_stamp, key.level + i,
+                {std::move(levels[i]), nullptr, inserted ? 0 : charge},
+                metadata
             );
-            scale_down(
-                evicted_frame->pixels.cb.get(), frame.pixels.cb.get(),
-                evicted_frame->width / 2, evicted_frame->height / 2
+            inserted += added;
+        }
+        if (!inserted)
+            return false;
+        shard.snapshot.store(std::move(next));
+    }
+
+    insertions += inserted;
+    memory_usage += charge;
+    uint32_t longest = longest_duration;
+    while (
+        metadata.duration > longest &&
+        !longest_duration.compare_exchange_weak(longest, metadata.duration)
+    ) {}
+    return true;
+}
+
+std::vector<frame_cache::victim> frame_cache::select_victims(size_t bytes) {
+    // scores depend on the playhead, so they are computed every time
+    std::vector<std::pair<double, victim>> candidates;
+    uint32_t display_level = this->display_level;
+    for (auto& shard : shards) {
+        auto snapshot = shard.snapshot.load();
+        if (!snapshot)
+            continue;
+        for (auto& [file, timeline] : snapshot->timelines) {
+            spill_file* spill = find_spill_file(file);
+            for (size_t i = 0; i < timeline->times.size(); i++) {
+                cached_frame description = describe(file, *timeline, i);
+                const frame_timeline::entry& entry = timeline->entries[i];
+                const auto& stored = entry.stored->front();
+                uint32_t level = description.key.level;
+                uint16_t width = stored.frame ?
+                    stored.frame->width : stored.compressed->width;
+                uint16_t height = stored.frame ?
+                    stored.frame->height : stored.compressed->height;
+                // frames larger than displayed are downscaled right away,
+                // levels sharing the buffer of a pyramid don't free anything
+                bool compress =
+                    compression && !stored.compressed &&
+                    level >= display_level && description.size;
+                // frames which can't get any smaller are dropped
+                bool downscale =
+                    !(entry.levels & (2u << level)) &&
+                    level + 1 < frame_timeline::level_count &&
+                    (width > 1 || height > 1);
+                // the spill file keeps the largest level it gets
+                candidates.emplace_back(
+                    policy->score(description),
+                    victim{
+                        description, stored, compress, downscale,
+                        level >= display_level ? spill : nullptr
+                    }
+                );
+            }
+        }
+    }
+
+    size_t count = std::min(batch_size, candidates.size());
+    std::partial_sort(
+        candidates.begin(), candidates.begin() + count, candidates.end(),
+        [](const auto& a, const auto& b) {
+            return a.first > b.first;
+        }
+    );
+
+    std::vector<victim> victims;
+    size_t freed = 0;
+    for (size_t i = 0; i < count && freed < bytes; i++) {
+        const victim& victim = candidates[i].second;
+        // a downscaled frame takes up a quarter of the memory, a compressed
+        // one about half
+        size_t size = victim.description.size;
+        freed += victim.compress ? size / 2 : size * 3 / 4;
+        victims.push_back(std::move(candidates[i].second));
+    }
+    return victims;
+}
+
+bool frame_cache::replace(
+    const victim& victim, frame_timeline::stored_level replacement,
+    uint32_t level
+) {
+    const frame_key& key = victim.description.key;
+    size_t replacement_charge = replacement.charge;
+    bool inserted = false;
+    size_t charge;
+
+    shard& shard = find_shard(key.file, key.time_stamp);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        frame_timeline* timeline;
+        auto next = copy_snapshot(shard, key.file, timeline);
+        size_t index = timeline->index_of(key.time_stamp);
+        if (index == size_t(-1))
+            return false;
+
+        // the entry may be gone after erasing, keep its metadata
+        frame_timeline::entry metadata = timeline->entries[index];
+        auto evicted = timeline->erase(key.time_stamp, key.level);
+        // another thread evicted it first
+        if (
+            evicted.frame != victim.stored.frame ||
+            evicted.compressed != victim.stored.compressed
+        )
+            return false;
+        charge = evicted.charge;
+        if (replacement) {
+            inserted = timeline->insert(
+                key.time_stamp, level, std::move(replacement), metadata
             );
-            scale_down(
-                evicted_frame->pixels.cr.get(), frame.pixels.cr.get(),
-                evicted_frame->width / 2, evicted_frame->height / 2
+        }
+        shard.snapshot.store(std::move(next));
+    }
+
+    // readers see either version, so both are accounted for until here
+    if (inserted) {
+        memory_usage += replacement_charge;
+        (level == key.level ? compressions : downscales)++;
+    } else {
+        drops++;
+    }
+    memory_usage -= charge;
+    return true;
+}
+
+void frame_cache::compact() {
+    size_t usage = memory_usage, limit = memory_limit;
+    if (usage <= limit)
+        return;
+
+    auto victims = select_victims(usage - limit);
+    std::vector<frame_timeline::stored_level> replacements(victims.size());
+    std::vector<std::shared_ptr<frame>> decoded(victims.size());
+    shared_thread_pool().parallel_for(victims.size(), [&](size_t i) {
+        victim& victim = victims[i];
+        decoded[i] = victim.stored.frame;
+        if (victim.compress) {
+            auto compressed = std::make_shared<const compressed_frame>(
+                compress_frame(*decoded[i])
+            );
+            // noise barely compresses, it is downscaled right away
+            if (compressed->size() * 4 <= victim.description.size * 3) {
+                replacements[i] = {nullptr, compressed, compressed->size()};
+                return;
+            }
+            victim.compress = false;
+        }
+
+        if (!decoded[i] && (victim.downscale || victim.spill)) {
+            decoded[i] = std::make_shared<frame>(
+                decompress_frame(*victim.stored.compressed)
+            );
+        }
+        if (!victim.downscale)
+            return;
+        auto scaled = std::make_shared<frame>(scale_down(*decoded[i]));
+        replacements[i] = {scaled, nullptr, scaled->size()};
+        // the smaller level is compressed as well, so the frame never takes
+        // up more memory than before
+        if (victim.stored.compressed) {
+            auto compressed = std::make_shared<const compressed_frame>(
+                compress_frame(*scaled)
             );
+            if (compressed->size() < scaled->size())
+                replacements[i] = {nullptr, compressed, compressed->size()};
+        }
+    });
+
+    for (size_t i = 0; i < victims.size(); i++) {
+        uint32_t level = victims[i].description.key.level;
+        if (!replace(
+            victims[i], std::move(replacements[i]),
+            victims[i].compress ? level : level + 1
+        ))
+            continue;
+        // compressed frames didn't leave their level
+        if (victims[i].compress || !victims[i].spill)
+            continue;
+        if (victims[i].spill->put(level, *decoded[i]))
+            spills++;
+    }
+}
+
+void frame_cache::build_pyramid(frame_key key) {
+    shard& shard = find_shard(key.file, key.time_stamp);
+    auto snapshot = shard.snapshot.load();
+    if (!snapshot)
+        return;
+
+    const frame_timeline* timeline = find_timeline(*snapshot, key.file);
+    size_t index =
+        timeline ? timeline->index_of(key.time_stamp) : size_t(-1);
+    if (index == size_t(-1))
+        return;
+    const frame_timeline::entry& entry = timeline->entries[index];
+    uint32_t levels = entry.levels;
+    uint32_t larger_levels = levels & ((1u << key.level) - 1);
+    if ((levels & (1u << key.level)) || !larger_levels)
+        return;
+    // start at the closest larger level
+    uint32_t source_level = std::bit_width(larger_levels) - 1;
+    const frame_timeline::stored_level& stored =
+        timeline->get(index, source_level);
+    std::shared_ptr<frame> source = stored.frame;
+    if (!source)
+        source = std::make_shared<frame>(decompress_frame(*stored.compressed));
+
+    // the levels in between aren't needed
+    frame intermediate;
+    const frame* larger = source.get();
+    for (uint32_t level = source_level + 1; level < key.level; level++) {
+        intermediate = scale_down(*larger);
+        larger = &intermediate;
+    }
 
-            auto cost = frame.width * frame.height * 3 / 2;
-            if (
-                frames.emplace(
-                    key, std::make_shared<::frame>(std::move(frame))
-                ).second
-            ) {
-                eviction_queue.emplace(cost, key);
-                memory_usage += cost;
+    // stop at levels which are already cached
+    unsigned count = 0;
+    while (
+        count < pyramid_levels &&
+        key.level + count < frame_timeline::level_count &&
+        !(levels & (1u << (key.level + count)))
+    )
+        count++;
+
+    std::vector<std::shared_ptr<frame>> pyramid;
+    size_t charge = 0;
+    for (frame& level : ::build_pyramid(*larger, count)) {
+        charge += level.size();
+        pyramid.push_back(std::make_shared<frame>(std::move(level)));
+    }
+    if (insert(key, std::move(pyramid), charge))
+        pyramids++;
+}
+
+void frame_cache::decompress(frame_key key) {
+    auto snapshot = find_shard(key.file, key.time_stamp).snapshot.load();
+    const frame_timeline* timeline =
+        snapshot ? find_timeline(*snapshot, key.file) : nullptr;
+    size_t index =
+        timeline ? timeline->index_of(key.time_stamp) : size_t(-1);
+    // it may have been evicted or replaced in the meantime
+    if (index == size_t(-1))
+        return;
+    const frame_timeline::stored_level& stored =
+        timeline->get(index, key.level);
+    auto last = last_decompressed.load();
+    if (stored.frame || (last && last->source == stored.compressed))
+        return;
+    auto frame =
+        std::make_shared<::frame>(decompress_frame(*stored.compressed));
+    last_decompressed.store(
+        std::make_shared<decompressed>(stored.compressed, std::move(frame))
+    );
+}
+
+spill_file* frame_cache::find_spill_file(file* file) const {
+    for (auto& [spill_file_file, spill] : spill_files) {
+        if (spill_file_file == file)
+            return spill.get();
+    }
+    return nullptr;
+}
+
+bool frame_cache::restore_frame(frame_key key) {
+    spill_file* spill = find_spill_file(key.file);
+    uint32_t level;
+    std::optional<frame> frame =
+        spill ? spill->get(key.time_stamp, level) : std::nullopt;
+    if (!frame)
+        return false;
+    uint64_t time = frame->time;
+    put_frame({key.file, time, level}, std::move(*frame));
+    restores++;
+    return true;
+}
+
+// the same key is requested on every lookup until the request is done
+static void deduplicate(std::vector<frame_key>& requests) {
+    std::sort(requests.begin(), requests.end());
+    requests.erase(
+        std::unique(
+            requests.begin(), requests.end(),
+            [](frame_key a, frame_key b) {
+                return !(a < b) && !(b < a);
             }
+        ),
+        requests.end()
+    );
+}
+
+void frame_cache::compact_in_background() {
+    while (true) {
+        std::vector<frame_key> pyramid_keys, restore_keys, decompress_keys;
+        {
+            std::unique_lock<std::mutex> lock(compaction_mutex);
+            work_added.wait(lock, [this] {
+                return
+                    stopping || memory_usage > memory_limit ||
+                    !pyramid_requests.empty() || !restore_requests.empty() ||
+                    !decompress_requests.empty();
+            });
+            if (stopping)
+                return;
+            std::swap(pyramid_keys, pyramid_requests);
+            std::swap(restore_keys, restore_requests);
+            std::swap(decompress_keys, decompress_requests);
         }
+
+        // the frame shown goes first, only the one looked up last is kept
+        if (!decompress_keys.empty())
+            decompress(decompress_keys.back());
+        // missing frames are worse than missing levels
+        deduplicate(restore_keys);
+        for (frame_key key : restore_keys)
+            restore_frame(key);
+        deduplicate(pyramid_keys);
+        for (frame_key key : pyramid_keys)
+            build_pyramid(key);
+
+        compact();
     }
 }
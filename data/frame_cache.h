@@ -1,11 +1,17 @@
 #pragma once
 
-#include <map>
 #include <tuple>
 #include <memory>
-#include <queue>
+#include <mutex>
+#include <atomic>
+#include <optional>
+#include <condition_variable>
+#include <thread>
+#include <vector>
 
 #include "frame.h"
+#include "frame_codec.h"
+#include "spill_file.h"
 #include "../io/io.h"
 
 struct frame_key {
@@ -16,32 +22,375 @@ struct frame_key {
     bool operator<(frame_key o) const;
 };
 
+/**
+ * @brief copyable_atomic is an atomic which can be copied with the structure
+ * containing it, by copying the current value.
+ */
+template<typename T>
+struct copyable_atomic : std::atomic<T> {
+    using std::atomic<T>::atomic;
+    copyable_atomic(const copyable_atomic& other) :
+        std::atomic<T>(other.load(std::memory_order_relaxed)) {}
+    copyable_atomic& operator=(const copyable_atomic& other) {
+        this->store(other.load(std::memory_order_relaxed));
+        return *this;
+    }
+};
+
+/**
+ * @brief frame_timeline indexes the cached frames of one file. The times are
+ * kept in a sorted array of their own, so lookups are a binary search over
+ * contiguous memory, and every time has a bitmap of the levels it is cached
+ * at. Copies share the levels of their entries, an entry gets a new array of
+ * them when its levels change.
+ */
+struct frame_timeline {
+    // levels beyond this are dropped instead of downscaled
+    static constexpr uint32_t level_count = 32;
+
+    /**
+     * @brief stored_level is one level of a cached frame, either decoded or
+     * compressed.
+     */
+    struct stored_level {
+        std::shared_ptr<frame> frame; // nullptr if compressed
+        std::shared_ptr<const compressed_frame> compressed;
+        // bytes accounted for it, levels of a pyramid share one buffer,
+        // which is charged to the smallest of them
+        size_t charge;
+
+        operator bool() const {
+            return frame || compressed;
+        }
+    };
+
+    struct entry {
+        uint32_t levels; // bit n is set if level n is cached
+        uint32_t duration; // of the frame in milliseconds, 0 if unknown
+        uint32_t frames_since_keyframe; // see file::frames_since_keyframe
+        // frame_cache::clock of the last lookup, updated by readers
+        mutable copyable_atomic<uint64_t> last_access;
+        // one per bit in levels, ordered by level, never modified once set
+        std::shared_ptr<const std::vector<stored_level>> stored;
+    };
+
+    /**
+     * @brief find looks up the entry of the frame displayed at the given time.
+     * @return the index of the entry or -1 if no cached frame covers the time.
+     */
+    size_t find(uint64_t time_stamp) const;
+
+    /**
+     * @brief get returns the given level of an entry or the closest one,
+     * preferring larger frames.
+     */
+    const stored_level& get(size_t index, uint32_t level) const;
+    /**
+     * @brief get_decoded is get limited to the levels which aren't
+     * compressed.
+     * @return the level or nullptr if all levels are compressed.
+     */
+    const stored_level* get_decoded(size_t index, uint32_t level) const;
+
+    bool insert(
+        uint64_t time_stamp, uint32_t level, stored_level stored,
+        const entry& metadata
+    );
+    // returns the index of the entry at exactly the time or -1
+    size_t index_of(uint64_t time_stamp) const;
+
+    // returns an empty level if it is not cached
+    stored_level erase(uint64_t time_stamp, uint32_t level);
+
+    std::vector<uint64_t> times;
+    std::vector<entry> entries;
+};
+
+/**
+ * @brief cached_frame describes a frame in the cache to an eviction_policy.
+ */
+struct cached_frame {
+    frame_key key;
+    size_t size; // in bytes, 0 if it shares the buffer of a smaller level
+    // signed distance from the playhead in milliseconds, positive after it,
+    // the maximum if the playhead is in another file
+    int64_t playhead_distance;
+    uint64_t age; // number of lookups since the frame was last returned
+    uint32_t frames_since_keyframe; // to decode to get it back
+    uint32_t display_level; // see frame_cache::set_display_level
+    bool compressed; // see compressed_frame
+};
+
+/**
+ * @brief eviction_policy decides which frame is downscaled or dropped when
+ * the cache is over its memory limit.
+ */
+struct eviction_policy {
+    virtual ~eviction_policy() = default;
+
+    /**
+     * @brief score rates how expendable a frame is.
+     * @return a score, the frame with the highest one is evicted first.
+     */
+    virtual double score(const cached_frame& frame) const = 0;
+};
+
+/**
+ * @brief playhead_eviction_policy ranks frames in strict tiers. Frames which
+ * are larger than displayed come first, the larger the earlier, then frames
+ * which aren't compressed, so all frames are compressed before any is
+ * downscaled. Within a tier, it evicts frames far from the playhead first,
+ * followed by frames which weren't looked at recently. Frames far from their
+ * keyframe are kept longer, because they take longer to decode again. The
+ * score within a tier is the weighted sum of these.
+ */
+struct playhead_eviction_policy : eviction_policy {
+    double score(const cached_frame& frame) const override;
+
+    double per_second_after = 1;
+    // decode_service prefetches less before the playhead than after it
+    double per_second_before = 4;
+    double per_thousand_lookups = 1;
+    double per_frame_from_keyframe = -0.02;
+
+    // distance between tiers, the weighted sum is clamped to a quarter of it
+    static constexpr double tier = 1e12;
+};
+
+struct frame_cache_statistics {
+    uint64_t hits; // lookups which found a frame
+    uint64_t misses;
+    uint64_t insertions;
+    uint64_t compressions; // evicted frames which were kept compressed
+    uint64_t downscales; // evicted frames which were kept at a lower level
+    uint64_t drops; // evicted frames which were removed
+    uint64_t pyramids; // pyramids built for lookups of missing levels
+    uint64_t spills; // evicted frames copied into a spill_file
+    uint64_t restores; // frames copied back from a spill_file
+};
+
+/**
+ * @brief frame_cache stores decoded frames. It may be used from any number
+ * of threads. The frames are sharded by file and time bucket, every shard
+ * publishes an immutable snapshot of its timelines. Lookups are non-blocking
+ * with respect to decoders, they never wait for the per shard lock inserts
+ * hold. They aren't lock-free, loading a std::atomic<std::shared_ptr> takes
+ * a short internal lock in libstdc++, which is only held while the pointer
+ * is copied.
+ *
+ * Inserts copy the timeline they change, whose entries share their levels
+ * with the previous version, and publish a snapshot with it under the per
+ * shard lock. The copy takes the times and entries of the file in the
+ * shard. Any shard_count consecutive buckets of a file are in different
+ * shards, so the copy grows with the frames of one bucket, times the number
+ * of cached buckets over shard_count. At 60 frames per second and up to 64
+ * cached seconds of a file, that's 60 entries of 40 bytes and 60 times.
+ *
+ * Lookups of a level which isn't cached return a larger one and have the
+ * levels from the requested one down built as a pyramid in the background.
+ * Compressed frames are decompressed in the background as well, until then
+ * lookups return the closest level which isn't compressed.
+ *
+ * Inserts don't downscale frames themselves. Once the cache is over its
+ * memory limit, a background thread compresses or downscales batches of
+ * evicted frames in parallel and swaps them for the smaller versions. Frames
+ * at or below the display level are compressed losslessly first, and only
+ * downscaled when evicted again. Only if that falls behind by more than
+ * soft_margin, inserts compact the cache before returning.
+ *
+ * Files may have a spill_file as a second tier. Evicted frames at or below
+ * the display level are copied into it, and lookups which find nothing have
+ * the frame restored from it in the background.
+ */
 struct frame_cache {
-    frame_cache() = default;
+    frame_cache();
+    frame_cache(const frame_cache&) = delete;
+    ~frame_cache();
+
+    frame_cache& operator=(const frame_cache&) = delete;
 
     /**
-     * @brief get_frame looks up the largest cached version of a frame at least
-     * as large as the given key.
-     * @param key is the file, time and level to look up in the cache.
-     * @return the cached frame or nullptr if the frame is not in the cache.
+     * @brief get_frame looks up the frame displayed at the time of the key.
+     * It never blocks. A compressed frame is decompressed in the background,
+     * and returned by the lookups after that.
+     * @param key is the file, time and level to look up in the cache. If the
+     * level is not cached, the closest larger one is returned, or the closest
+     * smaller one if there is no larger one.
+     * @return the cached frame or nullptr if the frame is not in the cache,
+     * or only compressed and not decompressed yet.
      */
     std::shared_ptr<frame> get_frame(frame_key key);
 
     /**
-     * @brief put_frame inserts the given frame into the cache, potentially
-     * downscaling or removing frames already in the cached to stay within the
+     * @brief put_frame inserts the given frame into the cache, and starts
+     * downscaling or removing frames already in the cache to get back to the
      * memory limit.
      * @param key is the file and time of the frame.
      * @param frame is the frame to store.
      */
     void put_frame(frame_key key, frame&& frame);
+    void put_frame(frame_key key, std::shared_ptr<frame> frame);
+
+    /**
+     * @brief set_playhead tells the eviction policy where the user is.
+     * @param file is the file shown, as used in the frame_key.
+     * @param milliseconds is the time of the playhead.
+     */
+    void set_playhead(file* file, uint64_t milliseconds);
+
+    /**
+     * @brief set_display_level tells the eviction policy which level is
+     * shown, larger levels are downscaled before anything else is evicted.
+     */
+    void set_display_level(uint32_t level);
+
+    /**
+     * @brief add_spill_file gives the frames of a file a second tier.
+     * @param file is the file, as used in the frame_key.
+     * @param spill is the spill file of it, nullptr is ignored.
+     */
+    void add_spill_file(file* file, std::unique_ptr<spill_file> spill);
+
+    /**
+     * @brief restore copies the frames of a file which start in the given
+     * range from its spill file into the cache, unless they are cached.
+     * @param begin is the start of the range in milliseconds.
+     * @param end is the end of the range in milliseconds, exclusive.
+     * @return the number of frames in the range which were cached or
+     * restored.
+     */
+    size_t restore(file* file, uint64_t begin, uint64_t end);
+
+    frame_cache_statistics statistics();
+
+    // set before the cache is shared between threads, like add_spill_file
+    std::unique_ptr<eviction_policy> policy =
+        std::make_unique<playhead_eviction_policy>();
+
+    // one 1080p 4:2:0 frame takes up ~3MB, may be changed while the cache is
+    // used, the compactor catches up with the next insert
+    std::atomic<size_t> memory_limit = 32*1024*1024;
+    std::atomic<size_t> memory_usage = 0;
+    // how far memory_usage may exceed memory_limit while compacting
+    size_t soft_margin = 8*1024*1024;
+    // the maximum number of frames downscaled in parallel
+    size_t batch_size = 8;
+    // levels built at once for lookups of missing levels
+    unsigned pyramid_levels = 4;
+    // compresses frames at or below the display level before downscaling
+    bool compression = true;
+
+    static constexpr size_t shard_count = 64;
+    // in milliseconds, consecutive buckets of a file are in different shards
+    static constexpr uint64_t bucket_length = 1000;
+
+private:
+    struct snapshot {
+        // there are only a few files, so they are searched linearly, the
+        // timelines are shared with the snapshots before and after
+        std::vector<std::pair<file*, std::shared_ptr<const frame_timeline>>>
+            timelines;
+    };
+
+    struct shard {
+        std::mutex mutex; // held by writers while they replace the snapshot
+        std::atomic<std::shared_ptr<const snapshot>> snapshot;
+    };
+
+    shard& find_shard(file* file, uint64_t time_stamp);
+    // looks up the frame covering the time in the given bucket, sets
+    // missing_level if a larger frame was found instead of the level, and
+    // compressed_level if the level found has to be decompressed first
+    std::shared_ptr<frame> find(
+        file* file, uint64_t time_stamp, uint64_t bucket, uint32_t level,
+        std::optional<frame_key>& missing_level,
+        std::optional<frame_key>& compressed_level
+    );
+    // returns true if a frame starts at exactly the time
+    bool contains(file* file, uint64_t time_stamp);
+    cached_frame describe(
+        file* file, const frame_timeline& timeline, size_t index
+    ) const;
+    // inserts consecutive levels starting at key.level, the charge goes to
+    // the smallest one which wasn't cached yet
+    bool insert(
+        frame_key key, std::vector<std::shared_ptr<frame>> levels,
+        size_t charge
+    );
+
+    // looks up the timeline of a file in a snapshot, nullptr if it has none
+    static const frame_timeline* find_timeline(
+        const snapshot& snapshot, file* file
+    );
+    // copies the snapshot of a shard with a copy of the timeline of the
+    // file, which is added if it is missing, expects the shard to be locked
+    static std::shared_ptr<snapshot> copy_snapshot(
+        shard& shard, file* file, frame_timeline*& timeline
+    );
+
+    struct victim {
+        cached_frame description;
+        frame_timeline::stored_level stored;
+        // it is dropped if it is neither compressed nor downscaled
+        bool compress, downscale;
+        spill_file* spill; // receives a copy, unless it is compressed
+    };
+    // picks the frames with the highest scores, until evicting them frees
+    // the given number of bytes or there are batch_size of them
+    std::vector<victim> select_victims(size_t bytes);
+    // swaps the victim for its compressed or downscaled version at the
+    // given level, or drops it if the replacement is empty, returns false if
+    // it was evicted in the meantime
+    bool replace(
+        const victim& victim, frame_timeline::stored_level replacement,
+        uint32_t level
+    );
+    // evicts one batch of victims
+    void compact();
+    // builds the levels of a pyramid request which are still missing
+    void build_pyramid(frame_key key);
+    // decompresses the level of a frame a lookup returned as compressed
+    void decompress(frame_key key);
+    spill_file* find_spill_file(file* file) const;
+    // copies the frame displayed at the time of the key from the spill file
+    bool restore_frame(frame_key key);
+    void compact_in_background();
+
+    shard shards[shard_count];
+
+    std::atomic<file*> playhead_file = nullptr;
+    std::atomic<uint64_t> playhead = 0;
+    std::atomic<uint32_t> display_level = 0;
+    // of all inserted frames in milliseconds, lookups search the buckets it
+    // reaches back
+    std::atomic<uint32_t> longest_duration = 0;
+    // counts lookups, to measure the age of frames
+    std::atomic<uint64_t> clock = 0;
+
+    std::atomic<uint64_t> hits = 0, misses = 0, insertions = 0;
+    std::atomic<uint64_t> compressions = 0, downscales = 0, drops = 0;
+    std::atomic<uint64_t> pyramids = 0;
+    std::atomic<uint64_t> spills = 0, restores = 0;
+
+    // there are only a few files, so they are searched linearly
+    std::vector<std::pair<file*, std::unique_ptr<spill_file>>> spill_files;
 
-    std::map<frame_key, std::shared_ptr<frame>> frames;
-    std::priority_queue<std::pair<uint32_t, frame_key>> eviction_queue;
+    struct decompressed {
+        std::shared_ptr<const compressed_frame> source;
+        std::shared_ptr<frame> frame;
+    };
+    // the same frame is looked up on every redraw while the playhead stands,
+    // written by the compactor, loaded like the snapshots
+    std::atomic<std::shared_ptr<const decompressed>> last_decompressed;
 
-    // one 1080p 4:2:0 frame takes up ~3MB
-    uint32_t memory_limit = 32*1024*1024;
-    uint32_t memory_usage = 0;
+    std::mutex compaction_mutex;
+    // signaled when over budget or when pyramids, restores or
+    // decompressions are requested
+    std::condition_variable work_added;
+    std::vector<frame_key> pyramid_requests, restore_requests;
+    std::vector<frame_key> decompress_requests;
+    bool stopping = false;
+    std::thread compactor;
 };
 
 
@@ -0,0 +1,414 @@
+#include "frame_codec.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "../utility/thread_pool.h"
+
+// SSE2 is part of every x86-64 CPU, so it needs no runtime check
+#if defined(__SSE2__) || defined(_M_X64)
+#define FRAME_CODEC_SSE2
+#include <emmintrin.h>
+#endif
+
+// samples coded with one width
+static constexpr size_t block_size = 32;
+// the width of a block is coded in 2 bits
+static constexpr unsigned widths[4] = {0, 2, 4, 8};
+
+struct strip {
+    unsigned plane;
+    uint32_t first_row, rows;
+};
+
+static std::vector<strip> split(
+    pixel_format format, uint16_t width, uint16_t height
+) {
+    std::vector<strip> strips;
+    for (auto plane = 0u; plane < format.plane_count; plane++) {
+        uint32_t rows = format.plane_height(plane, height);
+        uint32_t strip_height = compressed_frame::strip_height;
+        for (uint32_t row = 0; row < rows; row += strip_height)
+            strips.push_back({plane, row, std::min(strip_height, rows - row)});
+    }
+    return strips;
+}
+
+// the most bytes a strip of the given number of samples takes up
+static size_t bound(size_t samples) {
+    size_t blocks = (samples + block_size - 1) / block_size;
+    return (blocks + 3) / 4 + blocks * block_size;
+}
+
+// maps small differences of either sign to small numbers
+static uint8_t zigzag(uint8_t difference) {
+    return
+        static_cast<uint8_t>(difference << 1) ^
+        static_cast<uint8_t>(int8_t(difference) >> 7);
+}
+
+static uint8_t unzigzag(uint8_t value) {
+    return (value >> 1) ^ static_cast<uint8_t>(-(value & 1));
+}
+
+static uint16_t zigzag_16(uint16_t difference) {
+    return
+        static_cast<uint16_t>(difference << 1) ^
+        static_cast<uint16_t>(int16_t(difference) >> 15);
+}
+
+static uint16_t unzigzag_16(uint16_t value) {
+    return (value >> 1) ^ static_cast<uint16_t>(-(value & 1));
+}
+
+#ifdef FRAME_CODEC_SSE2
+
+static __m128i unzigzag(__m128i values) {
+    const __m128i ones = _mm_set1_epi8(1);
+    // there is no 8 bit shift, the bit shifted in from the next byte is
+    // masked off
+    __m128i half =
+        _mm_and_si128(_mm_srli_epi16(values, 1), _mm_set1_epi8(0x7f));
+    __m128i sign = _mm_cmpeq_epi8(_mm_and_si128(values, ones), ones);
+    return _mm_xor_si128(half, sign);
+}
+
+// unpacks a block of 2 bit values
+static void unpack_2(const uint8_t* packed, uint8_t* differences) {
+    const __m128i mask = _mm_set1_epi8(3);
+    __m128i bytes =
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(packed));
+    // the upper half gets the values 8 further
+    bytes = _mm_unpacklo_epi64(bytes, _mm_srli_epi16(bytes, 2));
+    __m128i low = _mm_and_si128(bytes, mask);
+    __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), mask);
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(differences), unzigzag(low)
+    );
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(differences + 16), unzigzag(high)
+    );
+}
+
+// unpacks a block of 4 bit values
+static void unpack_4(const uint8_t* packed, uint8_t* differences) {
+    const __m128i mask = _mm_set1_epi8(15);
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(packed));
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(differences),
+        unzigzag(_mm_and_si128(bytes, mask))
+    );
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(differences + 16),
+        unzigzag(_mm_and_si128(_mm_srli_epi16(bytes, 4), mask))
+    );
+}
+
+static void unpack_8(const uint8_t* packed, uint8_t* differences) {
+    for (size_t i = 0; i < block_size; i += 16) {
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i*>(differences + i),
+            unzigzag(_mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(packed + i)
+            ))
+        );
+    }
+}
+
+// adds the differences to the row above
+static void add_row(
+    const uint8_t* above, const uint8_t* differences, uint8_t* row,
+    size_t count
+) {
+    size_t x = 0;
+    for (; x + 16 <= count; x += 16) {
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i*>(row + x),
+            _mm_add_epi8(
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + x)),
+                _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(differences + x)
+                )
+            )
+        );
+    }
+    for (; x < count; x++)
+        row[x] = above[x] + differences[x];
+}
+
+#else
+
+static void unpack_2(const uint8_t* packed, uint8_t* differences) {
+    for (size_t i = 0; i < 8; i++) {
+        differences[i] = unzigzag(packed[i] & 3);
+        differences[i + 8] = unzigzag(packed[i] >> 2 & 3);
+        differences[i + 16] = unzigzag(packed[i] >> 4 & 3);
+        differences[i + 24] = unzigzag(packed[i] >> 6);
+    }
+}
+
+static void unpack_4(const uint8_t* packed, uint8_t* differences) {
+    for (size_t i = 0; i < 16; i++) {
+        differences[i] = unzigzag(packed[i] & 15);
+        differences[i + 16] = unzigzag(packed[i] >> 4);
+    }
+}
+
+static void unpack_8(const uint8_t* packed, uint8_t* differences) {
+    for (size_t i = 0; i < block_size; i++)
+        differences[i] = unzigzag(packed[i]);
+}
+
+static void add_row(
+    const uint8_t* above, const uint8_t* differences, uint8_t* row,
+    size_t count
+) {
+    for (size_t x = 0; x < count; x++)
+        row[x] = above[x] + differences[x];
+}
+
+#endif
+
+// 16 bit samples are predicted from their neighbours just like 8 bit ones,
+// the low bytes of all differences come before the high bytes, which are
+// mostly 0 and so take up no space in the blocks
+static void predict_16(
+    const uint8_t* source, uint32_t stride, size_t width, uint32_t rows,
+    uint8_t* values
+) {
+    size_t count = width * rows;
+    uint8_t* low = values;
+    uint8_t* high = values + count;
+    auto put = [&](uint16_t difference) {
+        uint16_t value = zigzag_16(difference);
+        *low++ = uint8_t(value);
+        *high++ = uint8_t(value >> 8);
+    };
+
+    // the depth isn't known here, the first sample is coded as it is
+    auto first = reinterpret_cast<const uint16_t*>(source);
+    uint16_t left = 0;
+    for (size_t x = 0; x < width; x++) {
+        put(first[x] - left);
+        left = first[x];
+    }
+    for (uint32_t y = 1; y < rows; y++) {
+        auto row =
+            reinterpret_cast<const uint16_t*>(source + size_t(y) * stride);
+        auto above = reinterpret_cast<const uint16_t*>(
+            source + size_t(y - 1) * stride
+        );
+        for (size_t x = 0; x < width; x++)
+            put(row[x] - above[x]);
+    }
+}
+
+// reverses predict_16, the values were unzigzagged as 8 bit differences
+static void reconstruct_16(
+    const uint8_t* values, uint8_t* destination, uint32_t stride,
+    size_t width, uint32_t rows
+) {
+    size_t count = width * rows;
+    const uint8_t* low = values;
+    const uint8_t* high = values + count;
+    auto next = [&]() {
+        uint16_t value = zigzag(*low++) | zigzag(*high++) << 8;
+        return unzigzag_16(value);
+    };
+
+    auto first = reinterpret_cast<uint16_t*>(destination);
+    uint16_t left = 0;
+    for (size_t x = 0; x < width; x++) {
+        left += next();
+        first[x] = left;
+    }
+    for (uint32_t y = 1; y < rows; y++) {
+        auto row =
+            reinterpret_cast<uint16_t*>(destination + size_t(y) * stride);
+        auto above = reinterpret_cast<const uint16_t*>(
+            destination + size_t(y - 1) * stride
+        );
+        for (size_t x = 0; x < width; x++)
+            row[x] = above[x] + next();
+    }
+}
+
+static size_t encode_strip(
+    const uint8_t* source, uint32_t stride, size_t row_size, uint32_t rows,
+    uint8_t sample_size, uint8_t* destination
+) {
+    size_t samples = row_size * rows;
+    size_t blocks = (samples + block_size - 1) / block_size;
+    // differences of the whole strip, the last block is padded with zeros
+    thread_local std::vector<uint8_t> values;
+    values.assign(blocks * block_size, 0);
+
+    if (sample_size == 2) {
+        predict_16(source, stride, row_size / 2, rows, values.data());
+    } else {
+        uint8_t* value = values.data();
+        uint8_t left = 128;
+        for (size_t x = 0; x < row_size; x++) {
+            *value++ = zigzag(source[x] - left);
+            left = source[x];
+        }
+        for (uint32_t y = 1; y < rows; y++) {
+            const uint8_t* row = source + size_t(y) * stride;
+            const uint8_t* above = row - stride;
+            for (size_t x = 0; x < row_size; x++)
+                value[x] = zigzag(row[x] - above[x]);
+            value += row_size;
+        }
+    }
+
+    uint8_t* codes = destination;
+    uint8_t* packed = destination + (blocks + 3) / 4;
+    std::memset(codes, 0, (blocks + 3) / 4);
+    for (size_t block = 0; block < blocks; block++) {
+        const uint8_t* z = values.data() + block * block_size;
+        uint8_t largest = *std::max_element(z, z + block_size);
+        unsigned code =
+            largest == 0 ? 0 : largest < 4 ? 1 : largest < 16 ? 2 : 3;
+        codes[block / 4] |= code << block % 4 * 2;
+
+        // samples which are packed into the same byte are 8 or 16 apart
+        switch (widths[code]) {
+        case 2:
+            for (size_t i = 0; i < 8; i++) {
+                packed[i] =
+                    z[i] | z[i + 8] << 2 | z[i + 16] << 4 | z[i + 24] << 6;
+            }
+            break;
+        case 4:
+            for (size_t i = 0; i < 16; i++)
+                packed[i] = z[i] | z[i + 16] << 4;
+            break;
+        case 8:
+            std::memcpy(packed, z, block_size);
+            break;
+        }
+        packed += widths[code] * block_size / 8;
+    }
+    return packed - destination;
+}
+
+static void decode_strip(
+    const uint8_t* source, uint8_t* destination, uint32_t stride,
+    size_t row_size, uint32_t rows, uint8_t sample_size
+) {
+    size_t samples = row_size * rows;
+    size_t blocks = (samples + block_size - 1) / block_size;
+    thread_local std::vector<uint8_t> values;
+    values.resize(blocks * block_size);
+
+    // differences of the whole strip
+    const uint8_t* codes = source;
+    const uint8_t* packed = source + (blocks + 3) / 4;
+    for (size_t block = 0; block < blocks; block++) {
+        uint8_t* differences = values.data() + block * block_size;
+        unsigned code = codes[block / 4] >> block % 4 * 2 & 3;
+        switch (widths[code]) {
+        case 0:
+            std::memset(differences, 0, block_size);
+            break;
+        case 2:
+            unpack_2(packed, differences);
+            break;
+        case 4:
+            unpack_4(packed, differences);
+            break;
+        case 8:
+            unpack_8(packed, differences);
+            break;
+        }
+        packed += widths[code] * block_size / 8;
+    }
+
+    if (sample_size == 2) {
+        reconstruct_16(values.data(), destination, stride, row_size / 2, rows);
+        return;
+    }
+    const uint8_t* differences = values.data();
+    uint8_t left = 128;
+    for (size_t x = 0; x < row_size; x++) {
+        left += differences[x];
+        destination[x] = left;
+    }
+    differences += row_size;
+    for (uint32_t y = 1; y < rows; y++) {
+        uint8_t* row = destination + size_t(y) * stride;
+        add_row(row - stride, differences, row, row_size);
+        differences += row_size;
+    }
+}
+
+size_t compressed_frame::size() const {
+    return data.size() + offsets.size() * sizeof(uint32_t);
+}
+
+compressed_frame compress_frame(const frame& source) {
+    compressed_frame compressed{
+        .format = source.format,
+        .time = source.time,
+        .duration = source.duration,
+        .width = source.width,
+        .height = source.height,
+    };
+
+    // every strip is written at its worst case offset, then moved together
+    std::vector<strip> strips =
+        split(source.format, source.width, source.height);
+    std::vector<size_t> bounds(strips.size() + 1), sizes(strips.size());
+    for (size_t i = 0; i < strips.size(); i++) {
+        size_t row_size =
+            source.format.plane_width(strips[i].plane, source.width) *
+            source.format.sample_size;
+        bounds[i + 1] = bounds[i] + bound(row_size * strips[i].rows);
+    }
+    std::vector<uint8_t> data(bounds.back());
+
+    shared_thread_pool().parallel_for(strips.size(), [&](size_t i) {
+        const strip& strip = strips[i];
+        const frame::plane& plane = source.planes[strip.plane];
+        sizes[i] = encode_strip(
+            plane.data + size_t(strip.first_row) * plane.stride, plane.stride,
+            source.format.plane_width(strip.plane, source.width) *
+            source.format.sample_size,
+            strip.rows, source.format.sample_size, data.data() + bounds[i]
+        );
+    });
+
+    compressed.offsets.resize(strips.size() + 1);
+    for (size_t i = 0; i < strips.size(); i++)
+        compressed.offsets[i + 1] = compressed.offsets[i] + sizes[i];
+    compressed.data.resize(compressed.offsets.back());
+    for (size_t i = 0; i < strips.size(); i++) {
+        std::memcpy(
+            compressed.data.data() + compressed.offsets[i],
+            data.data() + bounds[i], sizes[i]
+        );
+    }
+    return compressed;
+}
+
+frame decompress_frame(const compressed_frame& source) {
+    frame frame = allocate_frame(
+        source.format, source.width, source.height, source.time
+    );
+    frame.duration = source.duration;
+
+    std::vector<strip> strips =
+        split(source.format, source.width, source.height);
+    shared_thread_pool().parallel_for(strips.size(), [&](size_t i) {
+        const strip& strip = strips[i];
+        frame::plane& plane = frame.planes[strip.plane];
+        decode_strip(
+            source.data.data() + source.offsets[i],
+            plane.data + size_t(strip.first_row) * plane.stride, plane.stride,
+            source.format.plane_width(strip.plane, source.width) *
+            source.format.sample_size,
+            strip.rows, source.format.sample_size
+        );
+    });
+    return frame;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "frame.h"
+
+/**
+ * @brief compressed_frame is a frame compressed losslessly by compress_frame.
+ * Every plane is split into strips of rows, which are coded independently,
+ * so they are compressed and decompressed in parallel.
+ *
+ * Every sample is predicted by the one above it, the first row of a strip by
+ * the one to the left. The differences are packed in blocks of 32 with 0, 2,
+ * 4 or 8 bits each, whichever fits the largest of them. The widths are
+ * limited to these, so unpacking a block is a few shifts without branches,
+ * which compilers vectorize.
+ */
+struct compressed_frame {
+    // rows per strip
+    static constexpr uint32_t strip_height = 16;
+
+    pixel_format format;
+    uint64_t time;
+    uint32_t duration; // in milliseconds, 0 if unknown
+    uint16_t width, height;
+    // start of every strip in data, with the end of the last one
+    std::vector<uint32_t> offsets;
+    std::vector<uint8_t> data;
+
+    /**
+     * @brief size is the number of bytes the compressed frame takes up.
+     */
+    size_t size() const;
+};
+
+/**
+ * @brief compress_frame compresses a frame losslessly, see compressed_frame.
+ */
+compressed_frame compress_frame(const frame& source);
+
+/**
+ * @brief decompress_frame restores a frame compressed by compress_frame into
+ * a frame allocated by allocate_frame.
+ */
+frame decompress_frame(const compressed_frame& source);
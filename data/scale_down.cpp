@@ -0,0 +1,302 @@
+#include "scale_down.h"
+
+#include "../utility/instruction_sets.h"
+
+template<typename sample>
+using scale_down_row_function = void (*)(
+    const sample* top, const sample* bottom, sample* destination,
+    uint16_t count
+);
+
+// averages count 2x2 blocks, the scalar version is the reference for the
+// rounding of the others
+template<typename sample>
+static void scale_down_row_scalar(
+    const sample* top, const sample* bottom, sample* destination,
+    uint16_t count
+) {
+    for (uint16_t x = 0; x < count; x++) {
+        uint32_t sum = top[0] + top[1] + bottom[0] + bottom[1];
+        *destination = static_cast<sample>(sum / 4);
+        top += 2;
+        bottom += 2;
+        destination++;
+    }
+}
+
+#ifdef INSTRUCTION_SETS_X86
+
+TARGET("sse2")
+static void scale_down_row_sse2(
+    const uint8_t* top, const uint8_t* bottom, uint8_t* destination,
+    uint16_t count
+) {
+    const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+    uint16_t x = 0;
+    for (; x + 8 <= count; x += 8) {
+        __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i*>(top));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom));
+        // add even and odd samples of both rows as 16 bit
+        __m128i sum = _mm_add_epi16(
+            _mm_add_epi16(_mm_and_si128(t, low_bytes), _mm_srli_epi16(t, 8)),
+            _mm_add_epi16(_mm_and_si128(b, low_bytes), _mm_srli_epi16(b, 8))
+        );
+        sum = _mm_srli_epi16(sum, 2);
+        _mm_storel_epi64(
+            reinterpret_cast<__m128i*>(destination), _mm_packus_epi16(sum, sum)
+        );
+        top += 16;
+        bottom += 16;
+        destination += 8;
+    }
+    scale_down_row_scalar(top, bottom, destination, count - x);
+}
+
+TARGET("avx2")
+static void scale_down_row_avx2(
+    const uint8_t* top, const uint8_t* bottom, uint8_t* destination,
+    uint16_t count
+) {
+    const __m256i ones = _mm256_set1_epi8(1);
+    uint16_t x = 0;
+    for (; x + 32 <= count; x += 32) {
+        __m256i sums[2];
+        for (int half = 0; half < 2; half++) {
+            __m256i t = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(top + half * 32)
+            );
+            __m256i b = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(bottom + half * 32)
+            );
+            // add pairs of samples as 16 bit
+            sums[half] = _mm256_srli_epi16(_mm256_add_epi16(
+                _mm256_maddubs_epi16(t, ones), _mm256_maddubs_epi16(b, ones)
+            ), 2);
+        }
+        // packing works per 128 bit lane, restore the order afterwards
+        __m256i packed = _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(sums[0], sums[1]), 0b11011000
+        );
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination), packed);
+        top += 64;
+        bottom += 64;
+        destination += 32;
+    }
+    scale_down_row_sse2(top, bottom, destination, count - x);
+}
+
+TARGET("avx512f,avx512bw")
+static void scale_down_row_avx512(
+    const uint8_t* top, const uint8_t* bottom, uint8_t* destination,
+    uint16_t count
+) {
+    const __m512i ones = _mm512_set1_epi8(1);
+    uint16_t x = 0;
+    for (; x + 32 <= count; x += 32) {
+        __m512i t = _mm512_loadu_si512(top);
+        __m512i b = _mm512_loadu_si512(bottom);
+        __m512i sum = _mm512_srli_epi16(_mm512_add_epi16(
+            _mm512_maddubs_epi16(t, ones), _mm512_maddubs_epi16(b, ones)
+        ), 2);
+        // narrowing keeps the order, unlike packing
+        _mm512_mask_cvtepi16_storeu_epi8(destination, ~__mmask32(0), sum);
+        top += 64;
+        bottom += 64;
+        destination += 32;
+    }
+    scale_down_row_avx2(top, bottom, destination, count - x);
+}
+
+// madd only multiplies signed 16 bit values, so the samples are biased by
+// -32768 and the sums are corrected afterwards, the same for packing
+
+TARGET("sse2")
+static void scale_down_row_sse2(
+    const uint16_t* top, const uint16_t* bottom, uint16_t* destination,
+    uint16_t count
+) {
+    const __m128i bias = _mm_set1_epi16(-32768);
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i sum_bias = _mm_set1_epi32(4 * 32768);
+    const __m128i pack_bias = _mm_set1_epi32(32768);
+    uint16_t x = 0;
+    for (; x + 8 <= count; x += 8) {
+        __m128i sums[2];
+        for (int half = 0; half < 2; half++) {
+            __m128i t = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(top + half * 8)
+            );
+            __m128i b = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(bottom + half * 8)
+            );
+            // add pairs of samples as 32 bit
+            __m128i sum = _mm_add_epi32(
+                _mm_madd_epi16(_mm_xor_si128(t, bias), ones),
+                _mm_madd_epi16(_mm_xor_si128(b, bias), ones)
+            );
+            sum = _mm_srli_epi32(_mm_add_epi32(sum, sum_bias), 2);
+            sums[half] = _mm_sub_epi32(sum, pack_bias);
+        }
+        __m128i packed =
+            _mm_xor_si128(_mm_packs_epi32(sums[0], sums[1]), bias);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination), packed);
+        top += 16;
+        bottom += 16;
+        destination += 8;
+    }
+    scale_down_row_scalar(top, bottom, destination, count - x);
+}
+
+TARGET("avx2")
+static void scale_down_row_avx2(
+    const uint16_t* top, const uint16_t* bottom, uint16_t* destination,
+    uint16_t count
+) {
+    const __m256i bias = _mm256_set1_epi16(-32768);
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i sum_bias = _mm256_set1_epi32(4 * 32768);
+    const __m256i pack_bias = _mm256_set1_epi32(32768);
+    uint16_t x = 0;
+    for (; x + 16 <= count; x += 16) {
+        __m256i sums[2];
+        for (int half = 0; half < 2; half++) {
+            __m256i t = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(top + half * 16)
+            );
+            __m256i b = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(bottom + half * 16)
+            );
+            __m256i sum = _mm256_add_epi32(
+                _mm256_madd_epi16(_mm256_xor_si256(t, bias), ones),
+                _mm256_madd_epi16(_mm256_xor_si256(b, bias), ones)
+            );
+            sum = _mm256_srli_epi32(_mm256_add_epi32(sum, sum_bias), 2);
+            sums[half] = _mm256_sub_epi32(sum, pack_bias);
+        }
+        // packing works per 128 bit lane, restore the order afterwards
+        __m256i packed = _mm256_permute4x64_epi64(
+            _mm256_xor_si256(_mm256_packs_epi32(sums[0], sums[1]), bias),
+            0b11011000
+        );
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination), packed);
+        top += 32;
+        bottom += 32;
+        destination += 16;
+    }
+    scale_down_row_sse2(top, bottom, destination, count - x);
+}
+
+template<typename sample>
+static scale_down_row_function<sample> select_scale_down_row();
+
+template<>
+scale_down_row_function<uint8_t> select_scale_down_row<uint8_t>() {
+    instruction_sets supported = detect_instruction_sets();
+    if (supported.avx512)
+        return scale_down_row_avx512;
+    if (supported.avx2)
+        return scale_down_row_avx2;
+    if (supported.sse2)
+        return scale_down_row_sse2;
+    return scale_down_row_scalar<uint8_t>;
+}
+
+// 16 bit samples have no AVX-512 version
+template<>
+scale_down_row_function<uint16_t> select_scale_down_row<uint16_t>() {
+    instruction_sets supported = detect_instruction_sets();
+    if (supported.avx2)
+        return scale_down_row_avx2;
+    if (supported.sse2)
+        return scale_down_row_sse2;
+    return scale_down_row_scalar<uint16_t>;
+}
+
+#else
+
+template<typename sample>
+static scale_down_row_function<sample> select_scale_down_row() {
+    return scale_down_row_scalar<sample>;
+}
+
+#endif
+
+// strides are in bytes
+template<typename sample>
+static void scale_down(
+    const sample* source, uint32_t source_stride,
+    sample* destination, uint32_t destination_stride,
+    uint16_t width, uint16_t height,
+    scale_down_row_function<sample> scale_down_row
+) {
+    for (uint16_t y = 0; y < height; y += 2) {
+        const sample* top = reinterpret_cast<const sample*>(
+            reinterpret_cast<const uint8_t*>(source) + size_t(y) * source_stride
+        );
+        // repeat the last row for odd heights
+        const sample* bottom = y + 1 < height ?
+            reinterpret_cast<const sample*>(
+                reinterpret_cast<const uint8_t*>(top) + source_stride
+            ) :
+            top;
+
+        scale_down_row(top, bottom, destination, width / 2);
+        if (width % 2 == 1) {
+            // repeat the last column for odd widths
+            uint32_t sum = 2 * top[width - 1] + 2 * bottom[width - 1];
+            destination[width / 2] = static_cast<sample>(sum / 4);
+        }
+
+        destination = reinterpret_cast<sample*>(
+            reinterpret_cast<uint8_t*>(destination) + destination_stride
+        );
+    }
+}
+
+void scale_down_scalar(
+    const uint8_t* source, uint32_t source_stride,
+    uint8_t* destination, uint32_t destination_stride,
+    uint16_t width, uint16_t height
+) {
+    scale_down(
+        source, source_stride, destination, destination_stride, width, height,
+        scale_down_row_scalar<uint8_t>
+    );
+}
+
+void scale_down_scalar(
+    const uint16_t* source, uint32_t source_stride,
+    uint16_t* destination, uint32_t destination_stride,
+    uint16_t width, uint16_t height
+) {
+    scale_down(
+        source, source_stride, destination, destination_stride, width, height,
+        scale_down_row_scalar<uint16_t>
+    );
+}
+
+void scale_down(
+    const uint8_t* source, uint32_t source_stride,
+    uint8_t* destination, uint32_t destination_stride,
+    uint16_t width, uint16_t height
+) {
+    static const scale_down_row_function<uint8_t> scale_down_row =
+        select_scale_down_row<uint8_t>();
+    scale_down(
+        source, source_stride, destination, destination_stride, width, height,
+        scale_down_row
+    );
+}
+
+void scale_down(
+    const uint16_t* source, uint32_t source_stride,
+    uint16_t* destination, uint32_t destination_stride,
+    uint16_t width, uint16_t height
+) {
+    static const scale_down_row_function<uint16_t> scale_down_row =
+        select_scale_down_row<uint16_t>();
+    scale_down(
+        source, source_stride, destination, destination_stride, width, height,
+        scale_down_row
+    );
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * @brief scale_down averages 2x2 blocks of 8 bit samples. For odd sizes the
+ * last column and row are repeated, so the destination is
+ * (width + 1) / 2 by (height + 1) / 2 samples. The result is the same for
+ * all instruction sets, the best one supported by the CPU is picked at
+ * runtime.
+ * @param width is the width of the source in samples.
+ * @param height is the height of the source in samples.
+ */
+void scale_down(
+    const uint8_t* source, uint32_t source_stride,
+    uint8_t* destination, uint32_t destination_stride,
+    uint16_t width, uint16_t height
+);
+
+/**
+ * @brief scale_down averages 2x2 blocks of samples of up to 16 bits, like the
+ * version for 8 bit samples.
+ * @param source_stride and destination_stride are in bytes, they have to be
+ * even.
+ */
+void scale_down(
+    const uint16_t* source, uint32_t source_stride,
+    uint16_t* destination, uint32_t destination_stride,
+    uint16_t width, uint16_t height
+);
+
+/**
+ * @brief scale_down_scalar is the portable version of scale_down.
+ */
+void scale_down_scalar(
+    const uint8_t* source, uint32_t source_stride,
+    uint8_t* destination, uint32_t destination_stride,
+    uint16_t width, uint16_t height
+);
+
+void scale_down_scalar(
+    const uint16_t* source, uint32_t source_stride,
+    uint16_t* destination, uint32_t destination_stride,
+    uint16_t width, uint16_t height
+);
@@ -0,0 +1,228 @@
+#include "spill_file.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+struct spill_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t slot_header_size;
+    uint64_t content_hash;
+    uint32_t slot_size;
+    uint32_t slot_count;
+};
+
+// the headers of all slots follow the file header, the slots follow them,
+// aligned to pages
+struct spill_file::slot {
+    uint64_t sequence; // of the put, 0 if the slot is free
+    uint64_t time;
+    uint32_t duration;
+    uint32_t level;
+    pixel_format format;
+    uint16_t width, height;
+};
+
+static const char spill_magic[8] = {'v', 'd', 's', 'p', 'i', 'l', 'l', 0};
+static const uint32_t spill_version = 1;
+static const size_t page_size = 4096;
+
+spill_file::spill_file(
+    const char* filename, uint64_t content_hash, uint32_t slot_size,
+    uint32_t slot_count
+) :
+    slot_size(slot_size), slot_count(slot_count)
+{
+    size_t headers_size =
+        sizeof(spill_file_header) + size_t(slot_count) * sizeof(slot);
+    data_offset = (headers_size + page_size - 1) / page_size * page_size;
+    mapping = mapped_file(
+        filename, data_offset + size_t(slot_count) * slot_size
+    );
+
+    spill_file_header header{
+        .version = spill_version,
+        .slot_header_size = sizeof(slot),
+        .content_hash = content_hash,
+        .slot_size = slot_size,
+        .slot_count = slot_count,
+    };
+    std::memcpy(header.magic, spill_magic, sizeof(spill_magic));
+
+    if (std::memcmp(mapping.data, &header, sizeof(header)) != 0) {
+        // slots of another media file or layout are freed
+        std::memset(mapping.data, 0, headers_size);
+        std::memcpy(mapping.data, &header, sizeof(header));
+    }
+
+    for (uint32_t index = 0; index < slot_count; index++) {
+        const slot& slot = slot_at(index);
+        if (!slot.sequence) {
+            free_slots.push_back(index);
+            continue;
+        }
+        slots[slot.time] = index;
+        written[slot.sequence] = index;
+        sequence = std::max(sequence, slot.sequence);
+    }
+    // lower slots are used first
+    std::reverse(free_slots.begin(), free_slots.end());
+}
+
+bool spill_file::put(uint32_t level, const frame& frame) {
+    if (frame.size() > slot_size || !slot_count)
+        return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto existing = slots.find(frame.time);
+    if (existing != slots.end()) {
+        if (slot_at(existing->second).level <= level)
+            return false;
+        release(existing->second);
+    }
+
+    if (free_slots.empty())
+        release(written.begin()->second);
+    uint32_t index = free_slots.back();
+    free_slots.pop_back();
+
+    uint8_t* data = data_at(index);
+    for (auto plane = 0u; plane < frame.format.plane_count; plane++) {
+        size_t row_size =
+            frame.format.plane_width(plane, frame.width) *
+            frame.format.sample_size;
+        uint16_t rows = frame.format.plane_height(plane, frame.height);
+        for (auto row = 0u; row < rows; row++) {
+            std::memcpy(
+                data,
+                frame.planes[plane].data + row * frame.planes[plane].stride,
+                row_size
+            );
+            data += row_size;
+        }
+    }
+
+    // the header goes last, a slot is free until the frame is complete
+    slot& slot = slot_at(index);
+    slot = {
+        .sequence = ++sequence,
+        .time = frame.time,
+        .duration = frame.duration,
+        .level = level,
+        .format = frame.format,
+        .width = frame.width,
+        .height = frame.height,
+    };
+    slots[frame.time] = index;
+    written[slot.sequence] = index;
+    return true;
+}
+
+std::optional<frame> spill_file::get(uint64_t time_stamp, uint32_t& level) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto i = slots.upper_bound(time_stamp);
+    if (i == slots.begin())
+        return std::nullopt;
+    --i;
+    const slot& slot = slot_at(i->second);
+    // the next frame may be missing, like in frame_timeline::find
+    if (slot.duration && time_stamp >= slot.time + slot.duration)
+        return std::nullopt;
+
+    frame frame =
+        allocate_frame(slot.format, slot.width, slot.height, slot.time);
+    frame.duration = slot.duration;
+    const uint8_t* data = data_at(i->second);
+    for (auto plane = 0u; plane < frame.format.plane_count; plane++) {
+        size_t row_size =
+            frame.format.plane_width(plane, frame.width) *
+            frame.format.sample_size;
+        uint16_t rows = frame.format.plane_height(plane, frame.height);
+        for (auto row = 0u; row < rows; row++) {
+            std::memcpy(
+                frame.planes[plane].data + row * frame.planes[plane].stride,
+                data, row_size
+            );
+            data += row_size;
+        }
+    }
+    level = slot.level;
+    return frame;
+}
+
+std::vector<uint64_t> spill_file::times(uint64_t begin, uint64_t end) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<uint64_t> times;
+    for (
+        auto i = slots.lower_bound(begin);
+        i != slots.end() && i->first < end;
+        ++i
+    )
+        times.push_back(i->first);
+    return times;
+}
+
+spill_file::slot& spill_file::slot_at(uint32_t index) {
+    return reinterpret_cast<slot*>(
+        mapping.data + sizeof(spill_file_header)
+    )[index];
+}
+
+uint8_t* spill_file::data_at(uint32_t index) {
+    return mapping.data + data_offset + size_t(index) * slot_size;
+}
+
+void spill_file::release(uint32_t index) {
+    slot& slot = slot_at(index);
+    slots.erase(slot.time);
+    written.erase(slot.sequence);
+    slot.sequence = 0;
+    free_slots.push_back(index);
+}
+
+std::unique_ptr<spill_file> open_spill_file(
+    const char* filename, size_t frame_size, size_t capacity
+) {
+    // slots are whole pages, so frames start at page boundaries
+    size_t slot_size = (frame_size + page_size - 1) / page_size * page_size;
+    if (!slot_size || slot_size > std::numeric_limits<uint32_t>::max())
+        return nullptr;
+    auto slot_count = static_cast<uint32_t>(std::clamp<size_t>(
+        capacity / slot_size, 1, std::numeric_limits<uint32_t>::max()
+    ));
+
+    std::string path = filename;
+    if (path.starts_with("file:"))
+        path = path.substr(5);
+
+    try {
+        uint64_t hash = content_hash(path.c_str());
+
+        std::error_code error;
+        auto directory =
+            std::filesystem::temp_directory_path(error) / "video_decode";
+        if (error)
+            return nullptr;
+        std::filesystem::create_directories(directory, error);
+        if (error)
+            return nullptr;
+
+        char name[32];
+        std::snprintf(
+            name, sizeof(name), "%016llx.spill",
+            static_cast<unsigned long long>(hash)
+        );
+        return std::make_unique<spill_file>(
+            (directory / name).string().c_str(), hash,
+            static_cast<uint32_t>(slot_size), slot_count
+        );
+    } catch (std::runtime_error&) {
+        // URLs and files which can't be mapped
+        return nullptr;
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "frame.h"
+#include "../utility/mapped_file.h"
+
+/**
+ * @brief spill_file is the second tier of the frame_cache. It keeps frames of
+ * one media file in a memory mapped file, which is divided into slots of a
+ * fixed size, usually that of a frame of the media file at level 0. Every
+ * time is stored once, at the largest level written for it.
+ * When all slots are taken, the one written first is reused. The file stays
+ * valid across runs, as long as the content of the media file is the same.
+ * It may be used from any number of threads.
+ */
+struct spill_file {
+    /**
+     * @brief opens or creates the spill file. Its slots are discarded if it
+     * was written for another media file or with another layout.
+     * @param filename is the path of the spill file.
+     * @param content_hash identifies the media file, see content_hash.
+     * @param slot_size is the maximum size of a frame in bytes.
+     * @param slot_count is the maximum number of frames.
+     */
+    spill_file(
+        const char* filename, uint64_t content_hash, uint32_t slot_size,
+        uint32_t slot_count
+    );
+
+    /**
+     * @brief put copies a frame into a slot, unless the same or a larger
+     * level of it is stored already. Smaller levels of it are freed.
+     * @return true if the frame was written, false if it doesn't fit into a
+     * slot or is stored already.
+     */
+    bool put(uint32_t level, const frame& frame);
+
+    /**
+     * @brief get copies out the stored frame displayed at the given time.
+     * @param level is set to the level of the frame.
+     * @return the frame or std::nullopt if it is not stored.
+     */
+    std::optional<frame> get(uint64_t time_stamp, uint32_t& level);
+
+    /**
+     * @brief times lists the stored frames which start in the given range.
+     * @param begin is the start of the range in milliseconds.
+     * @param end is the end of the range in milliseconds, exclusive.
+     */
+    std::vector<uint64_t> times(uint64_t begin, uint64_t end);
+
+    const uint32_t slot_size, slot_count;
+
+private:
+    struct slot;
+    slot& slot_at(uint32_t index);
+    uint8_t* data_at(uint32_t index);
+    void release(uint32_t index);
+
+    std::mutex mutex;
+    mapped_file mapping;
+    size_t data_offset;
+    // start time of the frame to its slot
+    std::map<uint64_t, uint32_t> slots;
+    // used slots ordered by sequence, the front is reused first
+    std::map<uint64_t, uint32_t> written;
+    std::vector<uint32_t> free_slots;
+    uint64_t sequence = 0;
+};
+
+/**
+ * @brief open_spill_file opens the spill file of a media file, in a directory
+ * for temporary files, named after its content hash.
+ * @param filename is the URL of the media file.
+ * @param frame_size is the size of its largest frames, see file::frame_size.
+ * Every slot holds one of them.
+ * @param capacity is the most the slots take up in bytes, at least one slot
+ * is made.
+ * @return the spill file or nullptr if the media file isn't a local file or
+ * the spill file can't be created.
+ */
+std::unique_ptr<spill_file> open_spill_file(
+    const char* filename, size_t frame_size, size_t capacity
+);
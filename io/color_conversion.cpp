@@ -0,0 +1,804 @@
+#include "color_conversion.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+#include "../utility/instruction_sets.h"
+#include "../utility/thread_pool.h"
+
+// the coefficients follow libavfilter's colorspace filter, so the results
+// match it closely
+
+struct luma_coefficients {
+    double red, blue;
+    bool operator==(const luma_coefficients&) const = default;
+};
+
+struct color_primaries {
+    double red_x, red_y, green_x, green_y, blue_x, blue_y, white_x, white_y;
+    bool operator==(const color_primaries&) const = default;
+};
+
+struct transfer_characteristic {
+    double alpha, beta, gamma, delta;
+    bool operator==(const transfer_characteristic&) const = default;
+};
+
+typedef double matrix[3][3];
+
+static bool find_luma_coefficients(
+    AVColorSpace color_space, luma_coefficients& coefficients
+) {
+    switch (color_space) {
+    case AVCOL_SPC_BT709:
+        coefficients = {0.2126, 0.0722};
+        return true;
+    case AVCOL_SPC_BT470BG:
+    case AVCOL_SPC_SMPTE170M:
+        coefficients = {0.299, 0.114};
+        return true;
+    case AVCOL_SPC_SMPTE240M:
+        coefficients = {0.212, 0.087};
+        return true;
+    case AVCOL_SPC_BT2020_NCL:
+        coefficients = {0.2627, 0.0593};
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool find_color_primaries(
+    AVColorPrimaries primaries, color_primaries& coefficients
+) {
+    switch (primaries) {
+    case AVCOL_PRI_BT709:
+        coefficients = {0.64, 0.33, 0.30, 0.60, 0.15, 0.06, 0.3127, 0.3290};
+        return true;
+    case AVCOL_PRI_BT470BG:
+        coefficients = {0.64, 0.33, 0.29, 0.60, 0.15, 0.06, 0.3127, 0.3290};
+        return true;
+    case AVCOL_PRI_SMPTE170M:
+    case AVCOL_PRI_SMPTE240M:
+        coefficients = {
+            0.630, 0.340, 0.310, 0.595, 0.155, 0.070, 0.3127, 0.3290
+        };
+        return true;
+    case AVCOL_PRI_BT2020:
+        coefficients = {
+            0.708, 0.292, 0.170, 0.797, 0.131, 0.046, 0.3127, 0.3290
+        };
+        return true;
+    default:
+        // other white points would need chromatic adaptation
+        return false;
+    }
+}
+
+static bool find_transfer_characteristic(
+    AVColorTransferCharacteristic transfer,
+    transfer_characteristic& coefficients
+) {
+    switch (transfer) {
+    case AVCOL_TRC_BT709:
+    case AVCOL_TRC_SMPTE170M:
+    case AVCOL_TRC_BT2020_10:
+        coefficients = {1.099, 0.018, 0.45, 4.5};
+        return true;
+    case AVCOL_TRC_BT2020_12:
+        coefficients = {1.0993, 0.0181, 0.45, 4.5};
+        return true;
+    case AVCOL_TRC_GAMMA22:
+        coefficients = {1.0, 0.0, 1.0 / 2.2, 0.0};
+        return true;
+    case AVCOL_TRC_GAMMA28:
+        coefficients = {1.0, 0.0, 1.0 / 2.8, 0.0};
+        return true;
+    case AVCOL_TRC_SMPTE240M:
+        coefficients = {1.1115, 0.0228, 0.45, 4.0};
+        return true;
+    case AVCOL_TRC_LINEAR:
+        coefficients = {1.0, 0.0, 1.0, 0.0};
+        return true;
+    case AVCOL_TRC_IEC61966_2_1:
+        coefficients = {1.055, 0.0031308, 1.0 / 2.4, 12.92};
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void multiply(const matrix a, const matrix b, matrix result) {
+    matrix product;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            product[i][j] = 0;
+            for (int k = 0; k < 3; k++)
+                product[i][j] += a[i][k] * b[k][j];
+        }
+    }
+    std::memcpy(result, product, sizeof(product));
+}
+
+static void invert(const matrix m, matrix result) {
+    double determinant =
+        m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+        m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+        m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    matrix inverse;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            // cofactor of the transposed position
+            int r0 = (j + 1) % 3, r1 = (j + 2) % 3;
+            int c0 = (i + 1) % 3, c1 = (i + 2) % 3;
+            inverse[i][j] =
+                (m[r0][c0] * m[r1][c1] - m[r0][c1] * m[r1][c0]) / determinant;
+        }
+    }
+    std::memcpy(result, inverse, sizeof(inverse));
+}
+
+// from Y in [0, 1] and Cb, Cr in [-0.5, 0.5] to R'G'B'
+static void yuv_to_rgb_matrix(luma_coefficients c, matrix result) {
+    double green = 1 - c.red - c.blue;
+    matrix m = {
+        {1, 0, 2 * (1 - c.red)},
+        {
+            1, -2 * c.blue * (1 - c.blue) / green,
+            -2 * c.red * (1 - c.red) / green
+        },
+        {1, 2 * (1 - c.blue), 0},
+    };
+    std::memcpy(result, m, sizeof(m));
+}
+
+static void rgb_to_xyz_matrix(color_primaries p, matrix result) {
+    matrix primaries = {
+        {p.red_x / p.red_y, p.green_x / p.green_y, p.blue_x / p.blue_y},
+        {1, 1, 1},
+        {
+            (1 - p.red_x - p.red_y) / p.red_y,
+            (1 - p.green_x - p.green_y) / p.green_y,
+            (1 - p.blue_x - p.blue_y) / p.blue_y
+        },
+    };
+    double white[3] = {
+        p.white_x / p.white_y, 1, (1 - p.white_x - p.white_y) / p.white_y
+    };
+    matrix inverse;
+    invert(primaries, inverse);
+    for (int j = 0; j < 3; j++) {
+        double scale = 0;
+        for (int k = 0; k < 3; k++)
+            scale += inverse[j][k] * white[k];
+        for (int i = 0; i < 3; i++)
+            result[i][j] = primaries[i][j] * scale;
+    }
+}
+
+static double linearize(double value, transfer_characteristic t) {
+    // the colorspace filter doesn't mirror the curve for negative values, of
+    // the supported ones only sRGB gets there within the range of the tables
+    if (value <= -t.beta * t.delta) {
+        double base = (1 - t.alpha - value) / t.alpha;
+        // the filter rounds the NaN of negative bases to 0
+        return base < 0 ? 0 : -std::pow(base, 1 / t.gamma);
+    }
+    if (value < t.beta * t.delta)
+        return value / t.delta;
+    return std::pow((value + t.alpha - 1) / t.alpha, 1 / t.gamma);
+}
+
+static double delinearize(double value, transfer_characteristic t) {
+    double sign = value < 0 ? -1 : 1;
+    value = std::abs(value);
+    if (value <= t.beta)
+        return sign * value * t.delta;
+    return sign * (t.alpha * std::pow(value, t.gamma) - (t.alpha - 1));
+}
+
+static int32_t fixed_point(double value, int bits) {
+    return static_cast<int32_t>(std::lround(value * (1 << bits)));
+}
+
+// RGB is fixed-point with rgb_one as 1 and lookup tables cover
+// [-rgb_offset, rgb_table_size - rgb_offset), which the colorspace filter
+// clips to as well
+static const int32_t rgb_one = 28672;
+static const int32_t rgb_offset = 2048, rgb_table_size = 32768;
+
+// rgb_to_yuv is scaled to the output samples, the fraction bits shrink as
+// they grow, so its products fit into 32 bits at every depth
+static constexpr int rgb_to_yuv_bits(unsigned bit_depth) {
+    return 29 - bit_depth;
+}
+
+// a pixel format known at compile time
+template<unsigned bits, unsigned shift_x, unsigned shift_y>
+struct format_traits {
+    typedef std::conditional_t<(bits > 8), uint16_t, uint8_t> sample;
+    // products of the matrix with 16 bit samples overflow 32 bits
+    typedef std::conditional_t<(bits > 12), int64_t, int32_t> accumulator;
+    static constexpr int32_t maximum = (1 << bits) - 1;
+    static constexpr int32_t half = 1 << (bits - 1);
+    // luma samples per chroma sample
+    static constexpr unsigned block_width = 1 << shift_x;
+    static constexpr unsigned block_height = 1 << shift_y;
+    static constexpr unsigned block_shift = shift_x + shift_y;
+    static constexpr unsigned output_shift = rgb_to_yuv_bits(bits);
+};
+
+template<typename traits, typename value_type>
+static typename traits::sample clamp(value_type value) {
+    return static_cast<typename traits::sample>(
+        std::clamp<value_type>(value, 0, traits::maximum)
+    );
+}
+
+template<typename sample>
+static sample* row(const frame& frame, unsigned plane, uint32_t y) {
+    return reinterpret_cast<sample*>(
+        frame.planes[plane].data + size_t(y) * frame.planes[plane].stride
+    );
+}
+
+#ifdef INSTRUCTION_SETS_X86
+
+// mode::matrix for 8 bit samples, 8 blocks at a time with the same rounding
+// as the scalar version, returns the number of blocks converted
+template<unsigned shift_x, unsigned shift_y>
+TARGET("sse2")
+static uint32_t convert_matrix_sse2(
+    const int32_t m[3][3], int32_t luma_offset,
+    const uint8_t* const in_luma[], uint8_t* const out_luma[],
+    const uint8_t* in_cb, const uint8_t* in_cr,
+    uint8_t* out_cb, uint8_t* out_cr, uint32_t count
+) {
+    const unsigned block_shift = shift_x + shift_y;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi16(128);
+    const __m128i ones = _mm_set1_epi16(1);
+    // _mm_madd_epi16 multiplies pairs of 16 bit values, the coefficients
+    // are (a, b) pairs for (cb, cr) and (a, 0) for 32 bit luma
+    auto pair = [](int32_t a, int32_t b) {
+        return int32_t(uint32_t(uint16_t(a)) | uint32_t(uint16_t(b)) << 16);
+    };
+    const __m128i luma_scale = _mm_set1_epi32(pair(m[0][0], 0));
+    const __m128i luma_chroma = _mm_set1_epi32(pair(m[0][1], m[0][2]));
+    // the luma offset and rounding of the scalar version
+    const __m128i luma_bias =
+        _mm_set1_epi32((1 << 13) - m[0][0] * luma_offset);
+    __m128i chroma_luma[2], chroma_chroma[2], chroma_bias[2];
+    for (int c = 0; c < 2; c++) {
+        chroma_luma[c] = _mm_set1_epi32(pair(m[c + 1][0], 0));
+        chroma_chroma[c] =
+            _mm_set1_epi32(pair(m[c + 1][1], m[c + 1][2]));
+        chroma_bias[c] = _mm_set1_epi32(
+            (1 << (13 + block_shift)) -
+            (m[c + 1][0] * luma_offset << block_shift)
+        );
+    }
+
+    uint32_t block_x = 0;
+    for (; block_x + 8 <= count; block_x += 8) {
+        __m128i cb = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64(
+            reinterpret_cast<const __m128i*>(in_cb + block_x)
+        ), zero), half);
+        __m128i cr = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64(
+            reinterpret_cast<const __m128i*>(in_cr + block_x)
+        ), zero), half);
+        // (cb, cr) of blocks 0 to 3 and 4 to 7
+        __m128i chroma[2] = {
+            _mm_unpacklo_epi16(cb, cr), _mm_unpackhi_epi16(cb, cr)
+        };
+        // the chroma part of the luma of each block
+        __m128i luma_terms[2];
+        for (int h = 0; h < 2; h++) {
+            luma_terms[h] = _mm_add_epi32(
+                _mm_madd_epi16(chroma[h], luma_chroma), luma_bias
+            );
+        }
+
+        __m128i luma_sums[2] = {zero, zero};
+        for (unsigned i = 0; i < 1u << shift_y; i++) {
+            __m128i luma[2], products[4];
+            if constexpr (shift_x == 1) {
+                __m128i y = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(in_luma[i] + 2 * block_x)
+                );
+                luma[0] = _mm_unpacklo_epi8(y, zero);
+                luma[1] = _mm_unpackhi_epi8(y, zero);
+                for (int h = 0; h < 2; h++) {
+                    // two luma samples per block
+                    luma_sums[h] = _mm_add_epi32(
+                        luma_sums[h], _mm_madd_epi16(luma[h], ones)
+                    );
+                    products[2 * h] = _mm_add_epi32(_mm_madd_epi16(
+                        _mm_unpacklo_epi16(luma[h], zero), luma_scale
+                    ), _mm_shuffle_epi32(luma_terms[h], 0x50));
+                    products[2 * h + 1] = _mm_add_epi32(_mm_madd_epi16(
+                        _mm_unpackhi_epi16(luma[h], zero), luma_scale
+                    ), _mm_shuffle_epi32(luma_terms[h], 0xfa));
+                }
+                for (int k = 0; k < 4; k++)
+                    products[k] = _mm_srai_epi32(products[k], 14);
+                _mm_storeu_si128(
+                    reinterpret_cast<__m128i*>(out_luma[i] + 2 * block_x),
+                    _mm_packus_epi16(
+                        _mm_packs_epi32(products[0], products[1]),
+                        _mm_packs_epi32(products[2], products[3])
+                    )
+                );
+            } else {
+                __m128i y = _mm_unpacklo_epi8(_mm_loadl_epi64(
+                    reinterpret_cast<const __m128i*>(in_luma[i] + block_x)
+                ), zero);
+                luma[0] = _mm_unpacklo_epi16(y, zero);
+                luma[1] = _mm_unpackhi_epi16(y, zero);
+                for (int h = 0; h < 2; h++) {
+                    luma_sums[h] = _mm_add_epi32(luma_sums[h], luma[h]);
+                    products[h] = _mm_srai_epi32(_mm_add_epi32(
+                        _mm_madd_epi16(luma[h], luma_scale), luma_terms[h]
+                    ), 14);
+                }
+                __m128i packed = _mm_packs_epi32(products[0], products[1]);
+                _mm_storel_epi64(
+                    reinterpret_cast<__m128i*>(out_luma[i] + block_x),
+                    _mm_packus_epi16(packed, packed)
+                );
+            }
+        }
+
+        // chroma uses the average luma of the block
+        uint8_t* out[2] = {out_cb, out_cr};
+        for (int c = 0; c < 2; c++) {
+            __m128i results[2];
+            for (int h = 0; h < 2; h++) {
+                results[h] = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(
+                    _mm_madd_epi16(luma_sums[h], chroma_luma[c]),
+                    _mm_slli_epi32(
+                        _mm_madd_epi16(chroma[h], chroma_chroma[c]),
+                        block_shift
+                    )
+                ), chroma_bias[c]), 14 + block_shift);
+            }
+            __m128i packed = _mm_add_epi16(
+                _mm_packs_epi32(results[0], results[1]), half
+            );
+            _mm_storel_epi64(
+                reinterpret_cast<__m128i*>(out[c] + block_x),
+                _mm_packus_epi16(packed, packed)
+            );
+        }
+    }
+    return block_x;
+}
+
+#endif
+
+bool find_pixel_format(AVPixelFormat av_format, pixel_format& format) {
+    switch (av_format) {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+        format = planar_yuv(1, 1, 8);
+        return true;
+    case AV_PIX_FMT_YUV422P:
+    case AV_PIX_FMT_YUVJ422P:
+        format = planar_yuv(1, 0, 8);
+        return true;
+    case AV_PIX_FMT_YUV444P:
+    case AV_PIX_FMT_YUVJ444P:
+        format = planar_yuv(0, 0, 8);
+        return true;
+    // only native byte order, the others would have to be swapped
+    case AV_PIX_FMT_YUV420P10:
+        format = planar_yuv(1, 1, 10);
+        return true;
+    case AV_PIX_FMT_YUV422P10:
+        format = planar_yuv(1, 0, 10);
+        return true;
+    case AV_PIX_FMT_YUV444P10:
+        format = planar_yuv(0, 0, 10);
+        return true;
+    case AV_PIX_FMT_YUV420P12:
+        format = planar_yuv(1, 1, 12);
+        return true;
+    case AV_PIX_FMT_YUV422P12:
+        format = planar_yuv(1, 0, 12);
+        return true;
+    case AV_PIX_FMT_YUV444P12:
+        format = planar_yuv(0, 0, 12);
+        return true;
+    case AV_PIX_FMT_YUV420P16:
+        format = planar_yuv(1, 1, 16);
+        return true;
+    case AV_PIX_FMT_YUV422P16:
+        format = planar_yuv(1, 0, 16);
+        return true;
+    case AV_PIX_FMT_YUV444P16:
+        format = planar_yuv(0, 0, 16);
+        return true;
+    default:
+        return false;
+    }
+}
+
+template<unsigned shift_x, unsigned shift_y>
+color_conversion::slice_function color_conversion::select(
+    unsigned bit_depth
+) {
+    switch (bit_depth) {
+    case 8:
+        return &color_conversion::convert<format_traits<8, shift_x, shift_y>>;
+    case 10:
+        return
+            &color_conversion::convert<format_traits<10, shift_x, shift_y>>;
+    case 12:
+        return
+            &color_conversion::convert<format_traits<12, shift_x, shift_y>>;
+    case 16:
+        return
+            &color_conversion::convert<format_traits<16, shift_x, shift_y>>;
+    default:
+        return nullptr;
+    }
+}
+
+color_conversion::color_conversion(
+    pixel_format format, AVColorSpace color_space,
+    AVColorPrimaries color_primaries,
+    AVColorTransferCharacteristic color_transfer_characteristic,
+    AVColorRange color_range
+) : format(format) {
+    if (format.chroma_shift_x == 1 && format.chroma_shift_y == 1)
+        convert_slice = select<1, 1>(format.bit_depth);
+    else if (format.chroma_shift_x == 1 && format.chroma_shift_y == 0)
+        convert_slice = select<1, 0>(format.bit_depth);
+    else if (format.chroma_shift_x == 0 && format.chroma_shift_y == 0)
+        convert_slice = select<0, 0>(format.bit_depth);
+    if (!convert_slice || format.plane_count != 3)
+        throw std::runtime_error("Unsupported pixel format");
+
+    luma_coefficients input_luma, output_luma;
+    ::color_primaries input_primaries, output_primaries;
+    transfer_characteristic input_transfer, output_transfer;
+    if (
+        !find_luma_coefficients(color_space, input_luma) ||
+        !find_color_primaries(color_primaries, input_primaries) ||
+        !find_transfer_characteristic(
+            color_transfer_characteristic, input_transfer
+        )
+    )
+        throw std::runtime_error("Unsupported color space");
+    find_luma_coefficients(AVCOL_SPC_BT709, output_luma);
+    find_color_primaries(AVCOL_PRI_BT709, output_primaries);
+    find_transfer_characteristic(AVCOL_TRC_BT709, output_transfer);
+
+    // the output is full range, limited range scales with the depth like in
+    // FFmpeg
+    bool full_range = color_range == AVCOL_RANGE_JPEG;
+    double maximum = format.maximum();
+    double scale = 1 << (format.bit_depth - 8);
+    double input_luma_range = full_range ? maximum : 219 * scale;
+    double input_chroma_range = full_range ? maximum : 224 * scale;
+    input_luma_offset = full_range ? 0 : static_cast<int32_t>(16 * scale);
+
+    matrix input_scale = {
+        {1 / input_luma_range, 0, 0},
+        {0, 1 / input_chroma_range, 0},
+        {0, 0, 1 / input_chroma_range},
+    };
+    matrix output_scale = {
+        {maximum, 0, 0},
+        {0, maximum, 0},
+        {0, 0, maximum},
+    };
+
+    matrix input_yuv_to_rgb, output_rgb_to_yuv;
+    yuv_to_rgb_matrix(input_luma, input_yuv_to_rgb);
+    multiply(input_yuv_to_rgb, input_scale, input_yuv_to_rgb);
+    yuv_to_rgb_matrix(output_luma, output_rgb_to_yuv);
+    invert(output_rgb_to_yuv, output_rgb_to_yuv);
+    multiply(output_scale, output_rgb_to_yuv, output_rgb_to_yuv);
+
+    if (
+        input_primaries == output_primaries &&
+        input_transfer == output_transfer
+    ) {
+        matrix m;
+        multiply(output_rgb_to_yuv, input_yuv_to_rgb, m);
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++)
+                yuv_to_yuv[i][j] = fixed_point(m[i][j], 14);
+        }
+
+        bool diagonal =
+            yuv_to_yuv[0][1] == 0 && yuv_to_yuv[0][2] == 0 &&
+            yuv_to_yuv[1][0] == 0 && yuv_to_yuv[1][2] == 0 &&
+            yuv_to_yuv[2][0] == 0 && yuv_to_yuv[2][1] == 0 &&
+            yuv_to_yuv[1][1] == yuv_to_yuv[2][2];
+        if (diagonal && yuv_to_yuv[0][0] == 1 << 14 && full_range) {
+            mode = mode::passthrough;
+        } else if (diagonal) {
+            // same formula as mode::matrix, so the results are identical
+            int64_t half = 1 << (format.bit_depth - 1);
+            size_t size = (format.maximum() + 1) * format.sample_size;
+            luma_table.resize(size);
+            chroma_table.resize(size);
+            for (int64_t value = 0; value <= format.maximum(); value++) {
+                int64_t luma = std::clamp<int64_t>(
+                    (yuv_to_yuv[0][0] * (value - input_luma_offset) +
+                    (1 << 13)) >> 14,
+                    0, format.maximum()
+                );
+                int64_t chroma = std::clamp<int64_t>(
+                    ((yuv_to_yuv[1][1] * (value - half) + (1 << 13)) >> 14) +
+                    half,
+                    0, format.maximum()
+                );
+                if (format.sample_size == 1) {
+                    luma_table[value] = static_cast<uint8_t>(luma);
+                    chroma_table[value] = static_cast<uint8_t>(chroma);
+                } else {
+                    reinterpret_cast<uint16_t*>(luma_table.data())[value] =
+                        static_cast<uint16_t>(luma);
+                    reinterpret_cast<uint16_t*>(chroma_table.data())[value] =
+                        static_cast<uint16_t>(chroma);
+                }
+            }
+            mode = mode::range;
+        } else {
+            mode = mode::matrix;
+            // the SIMD kernel multiplies 16 bit coefficients
+            static const bool sse2 = detect_instruction_sets().sse2;
+            simd = sse2 && format.bit_depth == 8;
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 3; j++) {
+                    simd = simd &&
+                        yuv_to_yuv[i][j] >= INT16_MIN &&
+                        yuv_to_yuv[i][j] <= INT16_MAX;
+                }
+            }
+        }
+        return;
+    }
+
+    mode = mode::primaries;
+
+    matrix input_rgb_to_xyz, output_rgb_to_xyz, m;
+    rgb_to_xyz_matrix(input_primaries, input_rgb_to_xyz);
+    rgb_to_xyz_matrix(output_primaries, output_rgb_to_xyz);
+    invert(output_rgb_to_xyz, m);
+    multiply(m, input_rgb_to_xyz, m);
+
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            yuv_to_rgb[i][j] =
+                fixed_point(input_yuv_to_rgb[i][j] * rgb_one, 14);
+            rgb_to_rgb[i][j] = fixed_point(m[i][j], 14);
+            rgb_to_yuv[i][j] = fixed_point(
+                output_rgb_to_yuv[i][j] / rgb_one,
+                rgb_to_yuv_bits(format.bit_depth)
+            );
+        }
+    }
+
+    // the results are clipped to 16 bits like in the colorspace filter
+    linearize.resize(rgb_table_size);
+    delinearize.resize(rgb_table_size);
+    for (int32_t i = 0; i < rgb_table_size; i++) {
+        double value = double(i - rgb_offset) / rgb_one;
+        linearize[i] = std::clamp<int32_t>(
+            std::lround(::linearize(value, input_transfer) * rgb_one),
+            INT16_MIN, INT16_MAX
+        );
+        delinearize[i] = std::clamp<int32_t>(
+            std::lround(::delinearize(value, output_transfer) * rgb_one),
+            INT16_MIN, INT16_MAX
+        );
+    }
+}
+
+bool color_conversion::supported(
+    AVPixelFormat pixel_format, AVColorSpace color_space,
+    AVColorPrimaries color_primaries,
+    AVColorTransferCharacteristic color_transfer_characteristic
+) {
+    ::pixel_format format;
+    luma_coefficients luma;
+    ::color_primaries primaries;
+    transfer_characteristic transfer;
+    return
+        find_pixel_format(pixel_format, format) &&
+        find_luma_coefficients(color_space, luma) &&
+        find_color_primaries(color_primaries, primaries) &&
+        find_transfer_characteristic(color_transfer_characteristic, transfer);
+}
+
+frame color_conversion::convert(
+    frame&& source, frame_allocator* allocator
+) const {
+    if (mode == mode::passthrough)
+        return std::move(source);
+    if (source.format != format)
+        throw std::runtime_error("Unsupported pixel format");
+
+    frame destination = allocate_frame(
+        format, source.width, source.height, source.time, allocator
+    );
+    destination.duration = source.duration;
+
+    // slices are whole rows of chroma samples
+    const uint16_t slice_height = 32;
+    uint16_t block_rows = format.plane_height(1, source.height);
+    size_t slice_count = (block_rows + slice_height - 1) / slice_height;
+    shared_thread_pool().parallel_for(slice_count, [&](size_t slice) {
+        uint16_t begin = slice * slice_height;
+        uint16_t end = std::min<uint16_t>(begin + slice_height, block_rows);
+        (this->*convert_slice)(source, destination, begin, end);
+    });
+
+    return destination;
+}
+
+template<typename traits>
+void color_conversion::convert(
+    const frame& source, frame& destination, uint16_t begin, uint16_t end
+) const {
+    typedef typename traits::sample sample;
+    typedef typename traits::accumulator accumulator;
+    const unsigned block_width = traits::block_width;
+    const unsigned block_height = traits::block_height;
+    uint32_t width = source.width, height = source.height;
+    uint32_t chroma_width = format.plane_width(1, width);
+
+    if (mode == mode::range) {
+        auto luma_table =
+            reinterpret_cast<const sample*>(this->luma_table.data());
+        auto chroma_table =
+            reinterpret_cast<const sample*>(this->chroma_table.data());
+        // planes are independent, so no blocks are needed
+        uint32_t luma_end =
+            std::min<uint32_t>(uint32_t(end) * block_height, height);
+        for (uint32_t y = begin * block_height; y < luma_end; y++) {
+            const sample* in = row<sample>(source, 0, y);
+            sample* out = row<sample>(destination, 0, y);
+            for (uint32_t x = 0; x < width; x++)
+                out[x] = luma_table[in[x]];
+        }
+        for (auto plane = 1u; plane < 3; plane++) {
+            for (uint32_t y = begin; y < end; y++) {
+                const sample* in = row<sample>(source, plane, y);
+                sample* out = row<sample>(destination, plane, y);
+                for (uint32_t x = 0; x < chroma_width; x++)
+                    out[x] = chroma_table[in[x]];
+            }
+        }
+        return;
+    }
+
+    for (uint32_t block_y = begin; block_y < end; block_y++) {
+        // odd sizes repeat the last row and column
+        const sample* in_luma[block_height];
+        sample* out_luma[block_height];
+        for (unsigned i = 0; i < block_height; i++) {
+            uint32_t y = std::min(block_y * block_height + i, height - 1);
+            in_luma[i] = row<sample>(source, 0, y);
+            out_luma[i] = row<sample>(destination, 0, y);
+        }
+        const sample* in_cb = row<sample>(source, 1, block_y);
+        const sample* in_cr = row<sample>(source, 2, block_y);
+        sample* out_cb = row<sample>(destination, 1, block_y);
+        sample* out_cr = row<sample>(destination, 2, block_y);
+
+        uint32_t first_block = 0;
+#ifdef INSTRUCTION_SETS_X86
+        if constexpr (std::is_same_v<sample, uint8_t>) {
+            // blocks which cover the last column are left to the scalar
+            // version
+            if (mode == mode::matrix && simd) {
+                first_block = convert_matrix_sse2<
+                    traits::block_width / 2, traits::block_height / 2
+                >(
+                    yuv_to_yuv, input_luma_offset, in_luma, out_luma, in_cb,
+                    in_cr, out_cb, out_cr, width / block_width
+                );
+            }
+        }
+#endif
+
+        for (
+            uint32_t block_x = first_block; block_x < chroma_width; block_x++
+        ) {
+            uint32_t columns[block_width];
+            for (unsigned j = 0; j < block_width; j++)
+                columns[j] = std::min(block_x * block_width + j, width - 1);
+            int32_t cb = in_cb[block_x] - traits::half;
+            int32_t cr = in_cr[block_x] - traits::half;
+
+            if (mode == mode::matrix) {
+                accumulator luma_sum = 0;
+                for (unsigned i = 0; i < block_height; i++) {
+                    for (unsigned j = 0; j < block_width; j++) {
+                        accumulator luma =
+                            in_luma[i][columns[j]] - input_luma_offset;
+                        luma_sum += luma;
+                        // repeated samples are written twice
+                        out_luma[i][columns[j]] = clamp<traits>((
+                            yuv_to_yuv[0][0] * luma + yuv_to_yuv[0][1] * cb +
+                            yuv_to_yuv[0][2] * cr + (1 << 13)
+                        ) >> 14);
+                    }
+                }
+                // chroma uses the average luma of the block
+                const unsigned shift = 14 + traits::block_shift;
+                const accumulator count = 1 << traits::block_shift;
+                out_cb[block_x] = clamp<traits>(((
+                    yuv_to_yuv[1][0] * luma_sum +
+                    count * (yuv_to_yuv[1][1] * cb + yuv_to_yuv[1][2] * cr) +
+                    (accumulator(1) << (shift - 1))
+                ) >> shift) + traits::half);
+                out_cr[block_x] = clamp<traits>(((
+                    yuv_to_yuv[2][0] * luma_sum +
+                    count * (yuv_to_yuv[2][1] * cb + yuv_to_yuv[2][2] * cr) +
+                    (accumulator(1) << (shift - 1))
+                ) >> shift) + traits::half);
+                continue;
+            }
+
+            // mode::primaries
+            const unsigned shift = traits::output_shift;
+            int32_t rgb_sum[3] = {0, 0, 0};
+            for (unsigned i = 0; i < block_height; i++) {
+                for (unsigned j = 0; j < block_width; j++) {
+                    int32_t yuv[3] = {
+                        in_luma[i][columns[j]] - input_luma_offset, cb, cr
+                    };
+                    int32_t linear[3], rgb[3];
+                    for (int c = 0; c < 3; c++) {
+                        int32_t nonlinear = (
+                            yuv_to_rgb[c][0] * yuv[0] +
+                            yuv_to_rgb[c][1] * yuv[1] +
+                            yuv_to_rgb[c][2] * yuv[2] + (1 << 13)
+                        ) >> 14;
+                        linear[c] = linearize[std::clamp(
+                            nonlinear + rgb_offset, 0, rgb_table_size - 1
+                        )];
+                    }
+                    for (int c = 0; c < 3; c++) {
+                        int32_t converted = (
+                            rgb_to_rgb[c][0] * linear[0] +
+                            rgb_to_rgb[c][1] * linear[1] +
+                            rgb_to_rgb[c][2] * linear[2] + (1 << 13)
+                        ) >> 14;
+                        rgb[c] = delinearize[std::clamp(
+                            converted + rgb_offset, 0, rgb_table_size - 1
+                        )];
+                        rgb_sum[c] += rgb[c];
+                    }
+                    out_luma[i][columns[j]] = clamp<traits>((
+                        rgb_to_yuv[0][0] * rgb[0] + rgb_to_yuv[0][1] * rgb[1] +
+                        rgb_to_yuv[0][2] * rgb[2] + (1 << (shift - 1))
+                    ) >> shift);
+                }
+            }
+            // chroma of the average color of the block
+            for (int c = 0; c < 3; c++) {
+                rgb_sum[c] =
+                    (rgb_sum[c] + (1 << traits::block_shift >> 1)) >>
+                    traits::block_shift;
+            }
+            out_cb[block_x] = clamp<traits>(((
+                rgb_to_yuv[1][0] * rgb_sum[0] + rgb_to_yuv[1][1] * rgb_sum[1] +
+                rgb_to_yuv[1][2] * rgb_sum[2] + (1 << (shift - 1))
+            ) >> shift) + traits::half);
+            out_cr[block_x] = clamp<traits>(((
+                rgb_to_yuv[2][0] * rgb_sum[0] + rgb_to_yuv[2][1] * rgb_sum[1] +
+                rgb_to_yuv[2][2] * rgb_sum[2] + (1 << (shift - 1))
+            ) >> shift) + traits::half);
+        }
+    }
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "../data/frame.h"
+
+extern "C" {
+#include <libavutil/pixfmt.h>
+}
+
+/**
+ * @brief find_pixel_format looks up the layout of planar YUV formats of 8,
+ * 10, 12 or 16 bits with 4:2:0, 4:2:2 or 4:4:4 subsampling.
+ * @return false for all other formats.
+ */
+bool find_pixel_format(AVPixelFormat av_format, pixel_format& format);
+
+/**
+ * @brief color_conversion converts frames to full range BT.709, the colors
+ * the renderer expects, keeping their pixel format. Sources which already
+ * match are passed through, sources which only differ in range or matrix
+ * are converted with fixed-point lookup tables or a single matrix, others go
+ * through linear light with different primaries. Frames are split into
+ * slices which are converted in parallel.
+ *
+ * The kernels are instantiated for every depth and subsampling of
+ * find_pixel_format, neither is looked up per sample. 8 bit frames in
+ * mode::matrix use SSE2 where available, with results identical to the
+ * scalar version.
+ */
+struct color_conversion {
+    color_conversion() = default;
+    color_conversion(
+        pixel_format format, AVColorSpace color_space,
+        AVColorPrimaries color_primaries,
+        AVColorTransferCharacteristic color_transfer_characteristic,
+        AVColorRange color_range
+    );
+
+    /**
+     * @brief supported checks whether frames in the given pixel format with
+     * the given colors can be converted.
+     */
+    static bool supported(
+        AVPixelFormat pixel_format, AVColorSpace color_space,
+        AVColorPrimaries color_primaries,
+        AVColorTransferCharacteristic color_transfer_characteristic
+    );
+
+    /**
+     * @brief convert converts a frame of the format given to the
+     * constructor, throws std::runtime_error for other formats.
+     * @param allocator provides the memory of converted frames, see
+     * allocate_frame.
+     */
+    frame convert(frame&& source, frame_allocator* allocator = nullptr) const;
+
+    enum struct mode {
+        passthrough,
+        range, // per sample lookup tables
+        matrix, // one matrix from YUV to YUV
+        primaries, // through linear RGB
+    };
+    mode mode = mode::passthrough;
+    pixel_format format = yuv420p;
+
+    // in mode::range, indexed by input samples, which are also the type of
+    // the entries, so 8 bit tables stay small
+    std::vector<uint8_t> luma_table, chroma_table;
+
+    // in mode::matrix, Q14, from input YUV minus offsets to output YUV
+    int32_t yuv_to_yuv[3][3];
+    // in mode::matrix with 8 bit samples, whether the SSE2 kernel is used,
+    // it can be cleared to compare with the scalar one
+    bool simd = false;
+    // in mode::primaries, RGB is fixed-point with 28672 as 1 like in the
+    // colorspace filter, Q14 from input YUV minus offsets to RGB, Q14
+    // between linear RGB, Q(29 - bit depth) from RGB to output YUV
+    int32_t yuv_to_rgb[3][3], rgb_to_rgb[3][3], rgb_to_yuv[3][3];
+    // from non-linear RGB plus 2048 to linear RGB and from linear RGB plus
+    // 2048 back, out of range values are clipped
+    std::vector<int32_t> linearize, delinearize;
+
+    int32_t input_luma_offset;
+
+private:
+    // converts the rows of chroma samples in [begin, end) and the luma
+    // samples they cover
+    typedef void (color_conversion::*slice_function)(
+        const frame& source, frame& destination, uint16_t begin, uint16_t end
+    ) const;
+
+    template<typename traits>
+    void convert(
+        const frame& source, frame& destination, uint16_t begin, uint16_t end
+    ) const;
+
+    template<unsigned shift_x, unsigned shift_y>
+    static slice_function select(unsigned bit_depth);
+
+    slice_function convert_slice = nullptr;
+};
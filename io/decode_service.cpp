@@ -0,0 +1,387 @@
+#include "decode_service.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+decode_service::decode_service(
+    const char* filename, file* key, frame_cache& cache, unsigned thread_count,
+    unsigned preview_level, proxy_generator* proxy
+) :
+    filename(filename), key(key), cache(cache), duration(key->duration),
+    preview_level(preview_level), proxy(proxy),
+    keyframes(key->keyframes())
+{
+    // files without keyframes can only be decoded from the start
+    if (keyframes.empty() || keyframes.front() != 0)
+        keyframes.insert(keyframes.begin(), 0);
+
+    // hardware_concurrency may return 0 if unknown
+    thread_count = std::max(thread_count, 1u);
+    videos.resize(thread_count);
+    open_workers = thread_count;
+    for (auto i = 0u; i < thread_count; i++)
+        workers.emplace_back(&decode_service::work, this, i);
+    prefetch_worker = std::thread(&decode_service::prefetch, this);
+    if (preview_level > 0 || proxy)
+        preview_worker = std::thread(&decode_service::preview, this);
+}
+
+decode_service::~decode_service() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    playhead_changed.notify_all();
+    gop_decoded.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+    prefetch_worker.join();
+    if (preview_worker.joinable())
+        preview_worker.join();
+}
+
+void decode_service::set_playhead(uint64_t milliseconds) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (playhead == milliseconds)
+            return;
+
+        // the packets of the next GOPs in the direction of playback or
+        // scrubbing, submitting the reads may block the render loop
+        size_t gop = gop_at(milliseconds);
+        if (milliseconds > playhead) {
+            prefetch_begin = milliseconds;
+            prefetch_end = gop_end(
+                std::min(gop + readahead_gops, keyframes.size() - 1)
+            );
+        } else {
+            prefetch_begin = keyframes[gop - std::min(gop, readahead_gops)];
+            prefetch_end = milliseconds;
+        }
+        prefetch_requested = true;
+
+        playhead = milliseconds;
+        playhead_moved = std::chrono::steady_clock::now();
+
+        // frames outside of the range may get evicted, so decode them again
+        // next time
+        std::erase_if(gops, [this](size_t gop) {
+            return !in_range(gop);
+        });
+    }
+    cache.set_playhead(key, milliseconds);
+    packets->set_playhead(key->timestamp(milliseconds));
+    playhead_changed.notify_all();
+}
+
+void decode_service::decode_range(uint64_t begin, uint64_t end) {
+    auto first = std::upper_bound(keyframes.begin(), keyframes.end(), begin);
+    auto last = std::lower_bound(keyframes.begin(), keyframes.end(), end);
+    size_t first_gop = first - keyframes.begin() - 1;
+    size_t last_gop = last - keyframes.begin();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    for (size_t gop = first_gop; gop < last_gop; gop++)
+        requested_gops.insert(gop);
+    playhead_changed.notify_all();
+
+    gop_decoded.wait(lock, [&]() {
+        // nobody is left to decode them
+        if (stopping || open_workers == 0)
+            return true;
+        for (size_t gop = first_gop; gop < last_gop; gop++) {
+            if (
+                requested_gops.contains(gop) ||
+                requested_decoding.contains(gop)
+            )
+                return false;
+        }
+        return true;
+    });
+    lock.unlock();
+    rethrow_error();
+}
+
+void decode_service::rethrow_error() {
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::swap(error, this->error);
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void decode_service::report_error() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!error)
+        error = std::current_exception();
+}
+
+uint64_t decode_service::gop_end(size_t gop) const {
+    return gop + 1 < keyframes.size() ? keyframes[gop + 1] : duration;
+}
+
+size_t decode_service::gop_at(uint64_t milliseconds) const {
+    return std::upper_bound(
+        keyframes.begin(), keyframes.end(), milliseconds
+    ) - keyframes.begin() - 1;
+}
+
+bool decode_service::in_range(size_t gop) const {
+    uint64_t begin =
+        playhead > prefetch_before ? playhead - prefetch_before : 0;
+    return
+        gop < keyframes.size() &&
+        gop_end(gop) > begin &&
+        keyframes[gop] < playhead + prefetch_after;
+}
+
+uint64_t decode_service::until_settled() const {
+    if (!proxy_shown)
+        return 0;
+    auto settled =
+        playhead_moved + std::chrono::milliseconds(settle_time);
+    auto now = std::chrono::steady_clock::now();
+    if (now >= settled)
+        return 0;
+    // rounded up, so waiting for it is enough
+    return std::chrono::ceil<std::chrono::milliseconds>(settled - now).count();
+}
+
+bool decode_service::next_gop(size_t& gop, bool& requested) {
+    if (!requested_gops.empty()) {
+        gop = *requested_gops.begin();
+        requested_gops.erase(requested_gops.begin());
+        requested_decoding.insert(gop);
+        requested = true;
+        return true;
+    }
+    requested = false;
+
+    size_t center = gop_at(playhead);
+
+    // alternate between GOPs after and before the playhead, nearest first
+    for (size_t distance = 0; ; distance++) {
+        size_t after = center + distance;
+        bool after_in_range = in_range(after);
+        if (after_in_range && !gops.contains(after)) {
+            gop = after;
+            gops.insert(gop);
+            return true;
+        }
+
+        bool before_in_range = distance > 0 && distance <= center;
+        if (before_in_range) {
+            size_t before = center - distance;
+            before_in_range = in_range(before);
+            if (before_in_range && !gops.contains(before)) {
+                gop = before;
+                gops.insert(gop);
+                return true;
+            }
+        }
+
+        if (!after_in_range && !before_in_range && distance > 0)
+            return false;
+    }
+}
+
+void decode_service::work(size_t worker) {
+    // exceptions must not leave the thread
+    std::unique_ptr<file> opened;
+    try {
+        opened = std::make_unique<file>(filename.c_str());
+        opened->packets = packets;
+    } catch (...) {
+        report_error();
+        std::lock_guard<std::mutex> lock(mutex);
+        open_workers--;
+        // decode_range may be waiting for this worker
+        gop_decoded.notify_all();
+        return;
+    }
+    file* video = opened.get();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    videos[worker] = std::move(opened);
+    while (!stopping) {
+        // while scrubbing the proxy is shown, requested GOPs are decoded
+        // anyway
+        uint64_t unsettled = until_settled();
+        if (unsettled && requested_gops.empty()) {
+            playhead_changed.wait_for(
+                lock, std::chrono::milliseconds(unsettled)
+            );
+            continue;
+        }
+
+        size_t gop;
+        bool requested;
+        if (!next_gop(gop, requested)) {
+            playhead_changed.wait(lock);
+            continue;
+        }
+        lock.unlock();
+
+        try {
+            if (!restore(*video, gop))
+                decode(*video, gop, requested);
+        } catch (...) {
+            report_error();
+        }
+
+        lock.lock();
+        if (requested) {
+            requested_decoding.erase(gop);
+            gop_decoded.notify_all();
+        }
+    }
+}
+
+void decode_service::prefetch() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        playhead_changed.wait(lock, [this]() {
+            return stopping || prefetch_requested;
+        });
+        if (stopping)
+            break;
+        // only the latest range, the playhead may have moved on meanwhile
+        prefetch_requested = false;
+        uint64_t begin = prefetch_begin, end = prefetch_end;
+        file* video = nullptr;
+        for (auto& opened : videos) {
+            if (opened) {
+                video = opened.get();
+                break;
+            }
+        }
+        lock.unlock();
+
+        // prefetch may be called while the worker uses the file
+        try {
+            if (video)
+                video->prefetch(begin, end);
+        } catch (...) {
+            report_error();
+        }
+        lock.lock();
+    }
+}
+
+bool decode_service::restore(file& video, size_t gop) {
+    uint64_t begin = keyframes[gop], end = gop_end(gop);
+    size_t first = video.frame_number(begin);
+    size_t last = video.frame_number(end - 1);
+    if (first == size_t(-1) || last == size_t(-1))
+        return false;
+    return cache.restore(key, begin, end) >= last - first + 1;
+}
+
+void decode_service::decode(file& video, size_t gop, bool requested) {
+    uint64_t begin = keyframes[gop], end = gop_end(gop);
+    try {
+        video.prefetch(begin, end);
+        video.seek(begin);
+        while (true) {
+            frame frame = video.get_next_frame();
+            uint64_t time = frame.time;
+            cache.put_frame({key, time, 0}, std::move(frame));
+
+            // the first frame of the next GOP is output last
+            if (time >= end)
+                break;
+
+            // give up on GOPs that are no longer needed
+            std::lock_guard<std::mutex> guard(mutex);
+            if (stopping || (!requested && !in_range(gop)))
+                break;
+        }
+    } catch (end_of_file&) {
+        // reached the end of the file
+    } catch (...) {
+        // the GOP counts as decoded, so it isn't tried over and over
+        report_error();
+    }
+}
+
+void decode_service::preview() {
+    // keyframes are shown until the proxy is complete
+    std::unique_ptr<file> video;
+    if (preview_level > 0) {
+        try {
+            video = std::make_unique<file>(filename.c_str(), preview_level);
+            video->packets = packets;
+        } catch (...) {
+            // only the proxy is shown, once it's complete
+            report_error();
+        }
+    }
+    std::unique_ptr<file> proxy_video;
+    bool open_proxy = proxy != nullptr;
+    size_t previewed_gop = -1;
+    uint64_t previewed_position = ~0ull;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        uint64_t position = playhead;
+        size_t gop = std::upper_bound(
+            keyframes.begin(), keyframes.end(), position
+        ) - keyframes.begin() - 1;
+        // the proxy has every frame, otherwise the keyframe is shown
+        bool previewed = proxy_video ?
+            position == previewed_position : gop == previewed_gop;
+        bool proxy_ready = open_proxy && proxy->ready();
+        if (previewed && !proxy_ready) {
+            // the proxy generator doesn't notify, so it's polled until
+            // it's complete
+            if (open_proxy)
+                playhead_changed.wait_for(lock, proxy_poll_interval);
+            else
+                playhead_changed.wait(lock);
+            continue;
+        }
+        previewed_gop = gop;
+        previewed_position = position;
+        lock.unlock();
+
+        if (proxy_ready) {
+            open_proxy = false;
+            try {
+                proxy_video = std::make_unique<file>(proxy->path.c_str());
+            } catch (std::runtime_error&) {
+                // keep showing keyframes
+            } catch (...) {
+                report_error();
+            }
+        }
+
+        try {
+            if (proxy_video) {
+                // every frame of the proxy is a keyframe
+                frame frame = proxy_video->get_keyframe(position);
+                uint64_t time = frame.time;
+                cache.put_frame({key, time, proxy->level}, std::move(frame));
+            } else if (video) {
+                // only the keyframe is decoded, it's available the fastest
+                frame frame = video->get_keyframe(keyframes[gop]);
+                uint64_t time = frame.time;
+                cache.put_frame(
+                    {key, time, preview_level}, std::move(frame)
+                );
+            }
+        } catch (end_of_file&) {
+            // reached the end of the file
+        } catch (...) {
+            report_error();
+        }
+
+        lock.lock();
+        if (proxy_video && !proxy_shown) {
+            proxy_shown = true;
+            // workers wait for the playhead to settle from now on
+            playhead_changed.notify_all();
+        }
+    }
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <string>
+#include <set>
+#include <vector>
+#include <thread>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+#include "io.h"
+#include "proxy.h"
+#include "../data/frame_cache.h"
+
+/**
+ * @brief decode_service keeps the frame cache filled on both sides of the
+ * playhead. Every worker thread opens its own file, and with it its own
+ * decoder context, so GOPs are decoded in parallel and neither opening nor
+ * decoding blocks the render loop. GOPs which are complete in the spill file
+ * of the cache are copied from there instead. The demuxed packets are cached
+ * as well.
+ *
+ * Once a proxy of the file is complete, previews show its frames instead of
+ * only keyframes, and the full frames are only decoded when the playhead
+ * settles.
+ */
+struct decode_service {
+    /**
+     * @param filename is the file to open in every worker.
+     * @param key is the file used in the frame_key of decoded frames. Its
+     * keyframes are read once to split the file into GOPs.
+     * @param cache receives the decoded frames.
+     * @param thread_count is the number of worker threads.
+     * @param preview_level is the level of the preview frames, which are
+     * decoded at low quality from the keyframe at the playhead, so there is
+     * something to show while scrubbing fast. 0 disables previews.
+     * @param proxy generates the proxy of the file, may be nullptr. Its
+     * frames are put into the cache at its level.
+     */
+    decode_service(
+        const char* filename, file* key, frame_cache& cache,
+        unsigned thread_count = std::thread::hardware_concurrency(),
+        unsigned preview_level = 2, proxy_generator* proxy = nullptr
+    );
+    ~decode_service();
+
+    decode_service(const decode_service&) = delete;
+    decode_service& operator=(const decode_service&) = delete;
+
+    /**
+     * @brief set_playhead moves the center of the prefetched range. GOPs
+     * which left the range are forgotten and get decoded again when the
+     * playhead returns to them.
+     * @param milliseconds is the new position of the playhead.
+     */
+    void set_playhead(uint64_t milliseconds);
+
+    /**
+     * @brief decode_range decodes all GOPs overlapping the given range, one
+     * GOP per worker, ahead of the prefetching around the playhead. Returns
+     * once all of them are in the cache.
+     * @param begin is the start of the range in milliseconds.
+     * @param end is the end of the range in milliseconds.
+     * @throws the first error of the workers, see rethrow_error.
+     */
+    void decode_range(uint64_t begin, uint64_t end);
+
+    /**
+     * @brief rethrow_error throws the first error the workers ran into since
+     * the last call, other than the file ending. Workers which can't open
+     * the file stop, GOPs which fail to decode aren't tried again until the
+     * playhead leaves them.
+     */
+    void rethrow_error();
+
+    // in milliseconds
+    uint64_t prefetch_before = 2000, prefetch_after = 8000;
+    // with a complete proxy, how long the playhead has to stay before full
+    // frames are decoded around it, in milliseconds
+    uint64_t settle_time = 250;
+    // GOPs after the one under the playhead, in the direction it moves,
+    // whose packets are read from the file ahead of the demuxers
+    size_t readahead_gops = 3;
+    // how often previews check whether the proxy is complete
+    std::chrono::milliseconds proxy_poll_interval{100};
+
+    // shared by all workers, so GOPs decoded again aren't read again
+    std::shared_ptr<packet_cache> packets = std::make_shared<packet_cache>();
+
+private:
+    void work(size_t worker);
+    // copies the GOP from the spill file of the cache, returns false if not
+    // all of its frames are in there
+    bool restore(file& video, size_t gop);
+    void decode(file& video, size_t gop, bool requested);
+    void preview();
+    // keeps the exception which is being handled, unless there is one
+    void report_error();
+    // reads the range set_playhead asks for, which may block
+    void prefetch();
+    // expect mutex to be locked
+    bool next_gop(size_t& gop, bool& requested);
+    bool in_range(size_t gop) const;
+    // expects mutex to be locked, returns the milliseconds until the
+    // playhead settles, 0 if it has or the proxy isn't shown
+    uint64_t until_settled() const;
+    uint64_t gop_end(size_t gop) const;
+    // the GOP the given time is in
+    size_t gop_at(uint64_t milliseconds) const;
+
+    std::string filename;
+    file* key;
+    frame_cache& cache;
+    uint64_t duration;
+    unsigned preview_level;
+    proxy_generator* proxy;
+    // start time of every GOP
+    std::vector<uint64_t> keyframes;
+
+    std::mutex mutex;
+    std::condition_variable playhead_changed, gop_decoded;
+    uint64_t playhead = 0;
+    std::chrono::steady_clock::time_point playhead_moved;
+    // whether previews come from the proxy
+    bool proxy_shown = false;
+    bool stopping = false;
+    // GOPs that are decoded or being decoded around the playhead
+    std::set<size_t> gops;
+    // GOPs requested by decode_range and the ones currently worked on
+    std::set<size_t> requested_gops, requested_decoding;
+    // the first error of the workers since rethrow_error
+    std::exception_ptr error;
+    // workers which opened their file or are still opening it
+    size_t open_workers = 0;
+    // the range to read ahead of the demuxers, through the file of the
+    // first worker because the key may have no demuxer open
+    uint64_t prefetch_begin = 0, prefetch_end = 0;
+    bool prefetch_requested = false;
+
+    // one per worker, nullptr until it opened it, kept until all threads
+    // are joined because the prefetch worker reads through them
+    std::vector<std::unique_ptr<file>> videos;
+
+    std::vector<std::thread> workers;
+    std::thread preview_worker, prefetch_worker;
+};
@@ -0,0 +1,161 @@
+#include "decoder_pool.h"
+
+#include <algorithm>
+#include <cstring>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include "io.h"
+
+void decoder::close_demuxer() {
+    cached_gop = nullptr;
+    cached_packet = 0;
+    recording = nullptr;
+    packet = nullptr;
+    format_context = nullptr;
+    io = nullptr;
+    if (codec_context)
+        avcodec_flush_buffers(codec_context.get());
+}
+
+void decoder::close_decoder() {
+    close_demuxer();
+    av_frame = nullptr;
+    source_context = nullptr;
+    sink_context = nullptr;
+    input = nullptr;
+    output = nullptr;
+    graph = nullptr;
+    conversion = color_conversion();
+    parameters = nullptr;
+    codec_context = nullptr;
+    allocator = nullptr;
+    codec = nullptr;
+}
+
+// whether the codec context of the decoder can decode the stream of the
+// file after flushing it, the extradata holds e.g. H.264 parameter sets
+static bool compatible(const decoder& decoder, const file& file) {
+    if (!decoder.codec_context || !file.parameters)
+        return false;
+    const AVCodecParameters* a = decoder.parameters.get();
+    const AVCodecParameters* b = file.parameters.get();
+    return
+        decoder.preview_level == file.preview_level &&
+        // the filter graph is configured with the time base
+        decoder.time_base.num == file.time_base.num &&
+        decoder.time_base.den == file.time_base.den &&
+        a->codec_id == b->codec_id &&
+        a->format == b->format &&
+        a->width == b->width &&
+        a->height == b->height &&
+        a->color_range == b->color_range &&
+        a->color_primaries == b->color_primaries &&
+        a->color_trc == b->color_trc &&
+        a->color_space == b->color_space &&
+        a->extradata_size == b->extradata_size &&
+        (
+            a->extradata_size == 0 ||
+            std::memcmp(a->extradata, b->extradata, a->extradata_size) == 0
+        );
+}
+
+decoder_pool::decoder_pool(size_t capacity) :
+    capacity(std::max<size_t>(capacity, 1))
+{}
+
+decoder_pool_statistics decoder_pool::statistics() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return {
+        .opens = opens,
+        .reuses = reuses,
+        .evictions = evictions,
+        .decoders = decoders.size(),
+    };
+}
+
+decoder& decoder_pool::lease(file* owner) {
+    std::lock_guard<std::mutex> lock(mutex);
+    decoder* leased = owner->live;
+    if (!leased) {
+        // unused decoders first, then ones which can be kept, least
+        // recently used first
+        auto better = [owner](const decoder* a, const decoder* b) {
+            if (!b)
+                return true;
+            if (!a->owner != !b->owner)
+                return !a->owner;
+            bool a_compatible = compatible(*a, *owner);
+            bool b_compatible = compatible(*b, *owner);
+            if (a_compatible != b_compatible)
+                return a_compatible;
+            return a->last_used < b->last_used;
+        };
+        for (auto& candidate : decoders) {
+            if (!candidate->users && better(candidate.get(), leased))
+                leased = candidate.get();
+        }
+
+        // other files keep their decoders until the pool is full
+        if (leased && (!leased->owner || decoders.size() >= capacity)) {
+            if (leased->owner) {
+                detach(*leased);
+                evictions++;
+            }
+            if (compatible(*leased, *owner))
+                reuses++;
+            else
+                leased->close_decoder();
+        } else {
+            decoders.push_back(std::make_unique<decoder>());
+            leased = decoders.back().get();
+        }
+        leased->owner = owner;
+        owner->live = leased;
+    }
+    leased->users++;
+    leased->last_used = ++clock;
+    return *leased;
+}
+
+void decoder_pool::release(file* owner) {
+    std::lock_guard<std::mutex> lock(mutex);
+    owner->live->users--;
+    shrink();
+}
+
+void decoder_pool::remove(file* owner) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (owner->live)
+        detach(*owner->live);
+    shrink();
+}
+
+void decoder_pool::detach(decoder& decoder) {
+    decoder.owner->live = nullptr;
+    decoder.owner = nullptr;
+    decoder.close_demuxer();
+}
+
+void decoder_pool::shrink() {
+    while (decoders.size() > capacity) {
+        auto oldest = decoders.end();
+        for (auto i = decoders.begin(); i != decoders.end(); i++) {
+            if ((*i)->users)
+                continue;
+            if (
+                oldest == decoders.end() ||
+                (*i)->last_used < (*oldest)->last_used
+            )
+                oldest = i;
+        }
+        // all of them are in use
+        if (oldest == decoders.end())
+            return;
+        if ((*oldest)->owner)
+            detach(**oldest);
+        decoders.erase(oldest);
+    }
+}
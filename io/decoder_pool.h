@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
+
+#include "../utility/av_resource.h"
+#include "color_conversion.h"
+#include "packet_cache.h"
+#include "file_io.h"
+
+struct file;
+
+/**
+ * @brief decoder holds the contexts a file needs to demux and decode. Files
+ * only have one while they are used, see decoder_pool.
+ */
+struct decoder {
+    // closes the demuxer and drops the frames of the previous file, the
+    // codec context is kept
+    void close_demuxer();
+    // closes the codec context and the conversion as well
+    void close_decoder();
+
+    // the demuxer of the file it belongs to
+    // reads local files, nullptr for other URLs, outlives format_context
+    std::unique_ptr<file_io> io;
+    unique_av_format_context format_context;
+    unique_av_packet packet;
+    // the GOP read from the cache, nullptr while reading from the demuxer
+    std::shared_ptr<const packet_cache::gop> cached_gop;
+    size_t cached_packet = 0;
+    // the GOP being read from the demuxer, from its keyframe on
+    std::shared_ptr<packet_cache::gop> recording;
+
+    // the decoder, kept for files with compatible streams
+    struct AVCodec* codec = nullptr;
+    // provides the frames of the codec context, outlives it
+    std::shared_ptr<frame_allocator> allocator;
+    unique_av_codec_context codec_context;
+    // the stream the codec context was opened for
+    unique_av_codec_parameters parameters;
+    AVRational time_base = {0, 1};
+    unsigned preview_level = 0;
+    // converts to full range BT.709 when supported, otherwise the filter
+    // graph is used
+    color_conversion conversion;
+    unique_av_filter_in_out input;
+    unique_av_filter_in_out output;
+    unique_av_filter_graph graph;
+    struct AVFilterContext* source_context = nullptr;
+    struct AVFilterContext* sink_context = nullptr;
+    unique_av_frame av_frame;
+
+    // the file it belongs to, nullptr if it's unused
+    file* owner = nullptr;
+    // leases of the owner, it's not recycled while there are any
+    unsigned users = 0;
+    uint64_t last_used = 0;
+};
+
+struct decoder_pool_statistics {
+    uint64_t opens; // codec contexts opened
+    uint64_t reuses; // codec contexts kept for another file
+    uint64_t evictions; // decoders taken from another file
+    size_t decoders; // open right now
+};
+
+/**
+ * @brief decoder_pool bounds the number of decoders of the files sharing
+ * it, so memory stays flat no matter how many files are open. A file gets a
+ * decoder when it's used and keeps it until the pool recycles it for
+ * another file, least recently used first. The codec context is kept if the
+ * streams of both files are compatible, only the demuxer is opened again.
+ *
+ * Decoders aren't recycled while they are used. If all of them are, more
+ * are opened, and the pool shrinks back once they are released. It may be
+ * used from any number of threads.
+ */
+struct decoder_pool {
+    /**
+     * @param capacity is the number of decoders kept open.
+     */
+    decoder_pool(size_t capacity = 8);
+
+    decoder_pool(const decoder_pool&) = delete;
+    decoder_pool& operator=(const decoder_pool&) = delete;
+
+    decoder_pool_statistics statistics();
+
+    const size_t capacity;
+
+private:
+    friend struct file;
+
+    // gives the file a decoder unless it has one, which isn't recycled
+    // until it's released as often
+    decoder& lease(file* owner);
+    void release(file* owner);
+    // returns the decoder of a file which is destroyed
+    void remove(file* owner);
+
+    // expect mutex to be locked
+    // takes the decoder away from its owner, which opens another one the
+    // next time it's used
+    void detach(decoder& decoder);
+    // frees unused decoders beyond the capacity
+    void shrink();
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<decoder>> decoders;
+    // incremented on every lease
+    uint64_t clock = 0;
+    std::atomic<uint64_t> opens{0}, reuses{0}, evictions{0};
+};
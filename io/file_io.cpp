@@ -0,0 +1,51 @@
+#include "file_io.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+extern "C" {
+#include <libavformat/avio.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+
+#include "mapped_io.h"
+#include "uring_io.h"
+
+void free_io_context(AVIOContext** context) {
+    // FFmpeg may have replaced the buffer
+    av_freep(&(*context)->buffer);
+    avio_context_free(context);
+}
+
+int64_t seek_position(
+    uint64_t position, uint64_t size, int64_t offset, int whence
+) {
+    int64_t result;
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+        return size;
+    case SEEK_SET:
+        result = offset;
+        break;
+    case SEEK_CUR:
+        result = position + offset;
+        break;
+    case SEEK_END:
+        result = size + offset;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+    // reading past the end returns EOF
+    return result < 0 ? AVERROR(EINVAL) : result;
+}
+
+std::unique_ptr<file_io> open_file_io(const char* filename) {
+    try {
+        return std::make_unique<uring_io>(filename);
+    } catch (std::runtime_error&) {
+        // no io_uring support in the kernel or the build
+    }
+    return std::make_unique<mapped_io>(filename);
+}
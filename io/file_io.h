@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "../utility/resource.h"
+
+void free_io_context(struct AVIOContext** context);
+
+using unique_av_io_context =
+    unique_resource<struct AVIOContext*, free_io_context>;
+
+/**
+ * @brief file_io reads a local file as the AVIOContext of a demuxer, in
+ * place of FFmpeg's file protocol, so ranges of it can be read ahead of the
+ * demuxer.
+ */
+struct file_io {
+    virtual ~file_io() = default;
+
+    /**
+     * @brief context is the AVIOContext to set as pb of the format context,
+     * together with AVFMT_FLAG_CUSTOM_IO. It stays owned by this.
+     */
+    virtual struct AVIOContext* context() const = 0;
+
+    /**
+     * @brief prefetch starts reading a range of the file in the background,
+     * so the demuxer doesn't wait for it once it gets there. It may be
+     * called from any thread.
+     * @param offset is the start of the range in bytes.
+     * @param length is the size of the range in bytes.
+     */
+    virtual void prefetch(uint64_t offset, uint64_t length) = 0;
+};
+
+/**
+ * @brief seek_position implements the seek callback of an AVIOContext.
+ * @param position is the current position in bytes.
+ * @param size is the size of the file in bytes.
+ * @param offset and whence are the arguments of the callback.
+ * @return the new position, the size for AVSEEK_SIZE, or a negative error
+ * code.
+ */
+int64_t seek_position(
+    uint64_t position, uint64_t size, int64_t offset, int whence
+);
+
+/**
+ * @brief open_file_io opens a local file with io_uring where the system
+ * supports it and through a memory mapping otherwise.
+ * @param filename is the file name of a local file.
+ * @return the file_io, throws std::runtime_error if the file can't be
+ * opened.
+ */
+std::unique_ptr<file_io> open_file_io(const char* filename);
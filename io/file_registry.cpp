@@ -0,0 +1,33 @@
+#include "file_registry.h"
+
+file_registry::file_registry(size_t decoder_count) :
+    pool(std::make_shared<decoder_pool>(decoder_count))
+{}
+
+file* file_registry::open(const char* filename, unsigned preview_level) {
+    auto key = std::make_pair(std::string(filename), preview_level);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto opened = files.find(key);
+        if (opened != files.end())
+            return opened->second.get();
+    }
+
+    // other files are looked up while the index is built
+    auto opened = std::make_unique<file>(filename, preview_level, pool);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    // another thread may have opened it meanwhile
+    auto inserted = files.emplace(std::move(key), std::move(opened));
+    return inserted.first->second.get();
+}
+
+void file_registry::close(file* file) {
+    std::lock_guard<std::mutex> lock(mutex);
+    files.erase(std::make_pair(file->filename, file->preview_level));
+}
+
+size_t file_registry::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return files.size();
+}
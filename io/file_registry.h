@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "io.h"
+
+/**
+ * @brief file_registry keeps the files of a project open, each once, so
+ * their pointers identify them in frame_key. Only their metadata stays in
+ * memory, the decoders are shared through a bounded decoder_pool, so a
+ * project may reference any number of files. It may be used from any number
+ * of threads, each file from one at a time.
+ */
+struct file_registry {
+    /**
+     * @param decoder_count is the capacity of the pool.
+     */
+    file_registry(size_t decoder_count = 8);
+
+    file_registry(const file_registry&) = delete;
+    file_registry& operator=(const file_registry&) = delete;
+
+    /**
+     * @brief open looks up a file, or opens it and reads its metadata if it
+     * wasn't opened yet.
+     * @param filename is the URL of the file.
+     * @param preview_level is the level the file decodes at, see file.
+     * @return the file, which stays valid until it's closed.
+     */
+    file* open(const char* filename, unsigned preview_level = 0);
+
+    /**
+     * @brief close forgets a file and returns its decoder to the pool.
+     */
+    void close(file* file);
+
+    size_t size();
+
+    const std::shared_ptr<decoder_pool> pool;
+
+private:
+    std::mutex mutex;
+    std::map<std::pair<std::string, unsigned>, std::unique_ptr<file>> files;
+};
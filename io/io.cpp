@@ -2,96 +2,389 @@
 
 #include <iostream>
 #include <algorithm>
+#include <string>
+#include <filesystem>
+#include <mutex>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavutil/frame.h>
 #include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
 #include <libavfilter/avfilter.h>
 #include <libavfilter/buffersrc.h>
 #include <libavfilter/buffersink.h>
 }
 
 #include "../utility/out_ptr.h"
+#include "../data/frame_cache.h"
+#include "../data/spill_file.h"
 
 frame to_frame(AVFrame* av_frame, AVRational time_base) {
     uint16_t width = av_frame->width, height = av_frame->height;
     uint64_t milliseconds =
         av_frame->pts * time_base.num * 1000 / time_base.den;
+    // the end is rounded like the time, so the frame covers the time until
+    // the next one
+    uint64_t end =
+        (av_frame->pts + av_frame->pkt_duration) * time_base.num * 1000 /
+        time_base.den;
 
-    auto
-        y = std::make_unique<uint8_t[]>(width * height),
-        cb = std::make_unique<uint8_t[]>(width / 2 * height / 2),
-        cr = std::make_unique<uint8_t[]>(width / 2 * height / 2);
-
-    uint8_t* av_row = av_frame->data[0];
-    uint8_t* frame_row = y.get();
-    for (auto row = 0u; row < height; row++) {
-        std::move(av_row, av_row + width, frame_row);
-        av_row += av_frame->linesize[0];
-        frame_row += width;
-    }
-    av_row = av_frame->data[1];
-    frame_row = cb.get();
-    for (auto row = 0u; row < height / 2; row++) {
-        std::move(av_row, av_row + width / 2, frame_row);
-        av_row += av_frame->linesize[1];
-        frame_row += width / 2;
-    }
-    av_row = av_frame->data[2];
-    frame_row = cr.get();
-    for (auto row = 0u; row < height / 2; row++) {
-        std::move(av_row, av_row + width / 2, frame_row);
-        av_row += av_frame->linesize[1];
-        frame_row += width / 2;
-    }
-
-    return frame{
-        .pixels = {
-            .y = std::move(y),
-            .cb = std::move(cb),
-            .cr = std::move(cr),
-        },
+    // output of the decoder or the filter graph
+    pixel_format format;
+    if (!find_pixel_format(AVPixelFormat(av_frame->format), format))
+        throw std::runtime_error("Unsupported pixel format");
+
+    // the planes are not copied, the frame keeps references to the buffers
+    frame frame{
+        .format = format,
         .time = milliseconds,
+        .duration = static_cast<uint32_t>(end - milliseconds),
         .width = width,
         .height = height,
     };
+    for (auto plane = 0u; plane < frame.format.plane_count; plane++) {
+        frame.planes[plane] = {
+            av_frame->data[plane],
+            static_cast<uint32_t>(av_frame->linesize[plane])
+        };
+    }
+    // planar formats have at most one buffer per plane
+    for (auto i = 0u; i < std::size(frame.buffers) && av_frame->buf[i]; i++) {
+        frame.buffers[i] = av_buffer_ref(av_frame->buf[i]);
+        if (!frame.buffers[i])
+            throw std::bad_alloc();
+    }
+
+    return frame;
 }
 
-file::file(const char *filename) {
-    // demuxer
-    check(avformat_open_input(
-        out_ptr(format_context), filename, nullptr, nullptr
+static std::mutex frame_allocator_mutex;
+static std::shared_ptr<frame_allocator> current_frame_allocator;
+
+void set_frame_allocator(std::shared_ptr<frame_allocator> allocator) {
+    std::lock_guard<std::mutex> lock(frame_allocator_mutex);
+    current_frame_allocator = std::move(allocator);
+}
+
+// get_buffer2 of codec contexts with a frame allocator, which is their
+// opaque. Frames are laid out like avcodec_default_get_buffer2 does, but
+// with all planes in one buffer.
+static int get_buffer(AVCodecContext* context, AVFrame* av_frame, int flags) {
+    auto allocator = static_cast<frame_allocator*>(context->opaque);
+    pixel_format format;
+    if (
+        !(context->codec->capabilities & AV_CODEC_CAP_DR1) ||
+        !find_pixel_format(AVPixelFormat(av_frame->format), format)
+    )
+        return avcodec_default_get_buffer2(context, av_frame, flags);
+
+    // decoders write whole macroblocks, and read beyond them
+    int width = av_frame->width, height = av_frame->height;
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    avcodec_align_dimensions2(context, &width, &height, linesize_align);
+
+    // the width is padded until all rows are aligned, so the strides keep
+    // the ratio of the plane widths
+    uint32_t strides[3];
+    while (true) {
+        bool aligned = true;
+        for (auto plane = 0u; plane < format.plane_count; plane++) {
+            uint32_t alignment = std::max<uint32_t>(
+                frame_alignment, linesize_align[plane]
+            );
+            strides[plane] =
+                format.plane_width(plane, width) * format.sample_size;
+            if (strides[plane] % alignment)
+                aligned = false;
+        }
+        if (aligned)
+            break;
+        width += width & ~(width - 1);
+    }
+
+    size_t offsets[3], size = 0;
+    for (auto plane = 0u; plane < format.plane_count; plane++) {
+        offsets[plane] = size;
+        size += size_t(strides[plane]) * format.plane_height(plane, height);
+        size = (size + frame_alignment - 1) / frame_alignment *
+            frame_alignment;
+    }
+    // SIMD code may read a little past the last row
+    size += 16 + frame_alignment;
+
+    unique_av_buffer buffer;
+    try {
+        buffer = allocator->allocate(size);
+    } catch (std::exception&) {
+        // exceptions can't pass through the decoder
+    }
+    if (!buffer)
+        return avcodec_default_get_buffer2(context, av_frame, flags);
+
+    av_frame->buf[0] = av_buffer_ref(buffer.get());
+    if (!av_frame->buf[0])
+        return AVERROR(ENOMEM);
+    for (auto plane = 0u; plane < format.plane_count; plane++) {
+        av_frame->data[plane] = buffer->data + offsets[plane];
+        av_frame->linesize[plane] = strides[plane];
+    }
+    av_frame->extended_data = av_frame->data;
+    return 0;
+}
+
+// packets without a presentation time stamp are ordered by their decoding
+// time stamp
+static int64_t presentation_time(const AVPacket* packet) {
+    return packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+}
+
+// the format closest to the given one which the colorspace filter writes,
+// with the same subsampling and at least as many bits where possible
+static const char* graph_format(AVPixelFormat pixel_format) {
+    static const char* const formats[3][3] = {
+        {"yuv420p", "yuv420p10", "yuv420p12"},
+        {"yuv422p", "yuv422p10", "yuv422p12"},
+        {"yuv444p", "yuv444p10", "yuv444p12"},
+    };
+    const AVPixFmtDescriptor* descriptor = av_pix_fmt_desc_get(pixel_format);
+    if (!descriptor)
+        return formats[0][0];
+    // e.g. 4:1:1 is 4:2:2, RGB is 4:4:4
+    unsigned subsampling =
+        descriptor->log2_chroma_w == 0 ? 2 :
+        descriptor->log2_chroma_h == 0 ? 1 : 0;
+    int depth = descriptor->comp[0].depth;
+    unsigned precision = depth <= 8 ? 0 : depth <= 10 ? 1 : 2;
+    return formats[subsampling][precision];
+}
+
+// complete is false if demuxing failed before the end of the file
+packet_index build_index(
+    AVFormatContext* format_context, int stream_index, bool& complete
+) {
+    std::vector<packet_entry> entries;
+    unique_av_packet packet = av_packet_alloc();
+
+    // only demux, packets are not decoded
+    int result;
+    while ((result = av_read_frame(format_context, packet.get())) >= 0) {
+        if (packet->stream_index == stream_index) {
+            int64_t pts = presentation_time(packet.get());
+            if (pts != AV_NOPTS_VALUE) {
+                entries.push_back({
+                    .pts = pts,
+                    .dts = packet->dts,
+                    .position = packet->pos,
+                    .size = static_cast<uint32_t>(packet->size),
+                    .flags = static_cast<uint32_t>(packet->flags),
+                });
+            }
+        }
+        av_packet_unref(packet.get());
+    }
+    complete = result == AVERROR_EOF;
+
+    // e.g. MPEG-TS streams start at an arbitrary time stamp, not 0
+    int64_t start = format_context->streams[stream_index]->start_time;
+    if (start == AV_NOPTS_VALUE) {
+        start = entries.empty() ? 0 : entries.front().pts;
+        for (auto& entry : entries)
+            start = std::min(start, entry.pts);
+    }
+    // back to the first keyframe at or before the start
+    check(avformat_seek_file(
+        format_context, stream_index, INT64_MIN, start, start, 0
     ));
-    check(avformat_find_stream_info(format_context.get(), nullptr));
+    return packet_index(std::move(entries));
+}
+
+file::file(
+    const char* filename, unsigned preview_level,
+    std::shared_ptr<decoder_pool> pool
+) :
+    filename(filename), preview_level(preview_level),
+    pool(pool ? std::move(pool) : std::make_shared<decoder_pool>(1))
+{
+    try {
+        // reads the metadata, the codec context is opened when decoding
+        lease lease(*this, false);
+        if (!avcodec_find_decoder(parameters->codec_id))
+            throw std::runtime_error("No codec found");
+    } catch (...) {
+        // the destructor isn't called
+        this->pool->remove(this);
+        throw;
+    }
+}
+
+file::~file() {
+    pool->remove(this);
+}
+
+file::lease::lease(file& owner, bool decoding) : owner(owner) {
+    decoder& decoder = owner.pool->lease(&owner);
+    try {
+        if (!decoder.format_context) {
+            // continues where the recycled decoder was
+            if (owner.position != ~0ull || owner.seek_time != ~0ull)
+                owner.resume = true;
+            owner.open_demuxer(decoder);
+        }
+        if (decoding && !decoder.codec_context)
+            owner.open_decoder(decoder);
+    } catch (...) {
+        owner.pool->release(&owner);
+        throw;
+    }
+}
+
+file::lease::~lease() {
+    owner.pool->release(&owner);
+}
+
+void file::open_demuxer(decoder& decoder) {
+    std::string path = filename;
+    if (path.starts_with("file:"))
+        path = path.substr(5);
+
+    // local files are read ahead through io_uring or a mapping instead of
+    // FFmpeg's file protocol
+    decoder.io = nullptr;
+    AVFormatContext* context = nullptr;
+    try {
+        decoder.io = open_file_io(path.c_str());
+        context = avformat_alloc_context();
+        if (!context)
+            throw std::bad_alloc();
+        context->pb = decoder.io->context();
+        context->flags |= AVFMT_FLAG_CUSTOM_IO;
+    } catch (std::runtime_error&) {
+        // URLs and files which can't be opened
+        decoder.io = nullptr;
+    }
+
+    // demuxer, the context is freed on failure
+    check(avformat_open_input(&context, filename.c_str(), nullptr, nullptr));
+    decoder.format_context = context;
+    decoder.packet = av_packet_alloc();
+    if (!decoder.packet)
+        throw std::bad_alloc();
+
+    // the metadata is kept from the first time, some demuxers only find
+    // streams while reading
+    if (parameters) {
+        if (
+            stream_index >=
+            static_cast<int>(decoder.format_context->nb_streams)
+        )
+            check(avformat_find_stream_info(
+                decoder.format_context.get(), nullptr
+            ));
+        return;
+    }
+    check(avformat_find_stream_info(decoder.format_context.get(), nullptr));
 
     // find streams
     stream_index = check(av_find_best_stream(
-        format_context.get(), AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0
+        decoder.format_context.get(), AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0
     ));
+    AVStream* stream = decoder.format_context->streams[stream_index];
+    time_base = stream->time_base;
+    parameters = avcodec_parameters_alloc();
+    if (!parameters)
+        throw std::bad_alloc();
+    check(avcodec_parameters_copy(parameters.get(), stream->codecpar));
+    width = parameters->width;
+    height = parameters->height;
 
-    codec = avcodec_find_decoder(
-        format_context->streams[stream_index]->codecpar->codec_id
-    );
-    if (!codec) {
+    // duration is not known for all containers
+    if (decoder.format_context->duration == AV_NOPTS_VALUE)
+        duration = ~0ull;
+    else
+        duration = decoder.format_context->duration * 1000 / AV_TIME_BASE;
+
+    // the index is stored next to local files, edits in place keep the size
+    std::error_code error;
+    auto time = std::filesystem::last_write_time(path, error);
+    uint64_t hash = 0;
+    if (!error) {
+        try {
+            hash = content_hash(path.c_str());
+        } catch (std::runtime_error&) {
+            error = std::make_error_code(std::errc::io_error);
+        }
+    }
+    bool complete;
+    if (error) {
+        index = build_index(
+            decoder.format_context.get(), stream_index, complete
+        );
+    } else {
+        std::string index_path = path + ".index";
+        int64_t source_time = time.time_since_epoch().count();
+        if (!index.load(index_path.c_str(), hash, source_time)) {
+            index = build_index(
+                decoder.format_context.get(), stream_index, complete
+            );
+            // a truncated index is used this time, but built again next time
+            if (complete)
+                index.save(index_path.c_str(), hash, source_time);
+        }
+    }
+}
+
+void file::open_decoder(decoder& decoder) {
+    decoder.codec = avcodec_find_decoder(parameters->codec_id);
+    if (!decoder.codec) {
         throw std::runtime_error("No codec found");
     }
 
-    codec_context = avcodec_alloc_context3(codec);
-    if (!codec_context) {
+    decoder.codec_context = avcodec_alloc_context3(decoder.codec);
+    if (!decoder.codec_context) {
         throw std::bad_alloc();
     }
+    AVCodecContext* codec_context = decoder.codec_context.get();
 
-    check(avcodec_parameters_to_context(
-        codec_context.get(), format_context->streams[stream_index]->codecpar
-    ));
+    check(avcodec_parameters_to_context(codec_context, parameters.get()));
 
-    check(avcodec_open2(codec_context.get(), codec, nullptr));
+    {
+        std::lock_guard<std::mutex> lock(frame_allocator_mutex);
+        decoder.allocator = current_frame_allocator;
+    }
+    if (decoder.allocator) {
+        codec_context->opaque = decoder.allocator.get();
+        codec_context->get_buffer2 = get_buffer;
+    }
 
-    graph = avfilter_graph_alloc();
-    source_context = nullptr;
-    sink_context = nullptr;
+    if (preview_level > 0) {
+        // every step of lowres halves both dimensions, like frame_key::level
+        codec_context->lowres =
+            std::min<int>(preview_level, decoder.codec->max_lowres);
+        codec_context->skip_loop_filter = AVDISCARD_ALL;
+        codec_context->skip_frame = AVDISCARD_NONREF;
+        codec_context->flags2 |= AV_CODEC_FLAG2_FAST;
+    }
+
+    // avcodec_open2 applies lowres to width and height
+    check(avcodec_open2(codec_context, decoder.codec, nullptr));
+    pool->opens++;
+
+    decoder.av_frame = av_frame_alloc();
+    if (!decoder.av_frame)
+        throw std::bad_alloc();
+
+    // files with the same parameters may reuse the decoder
+    decoder.parameters = avcodec_parameters_alloc();
+    if (!decoder.parameters)
+        throw std::bad_alloc();
+    check(avcodec_parameters_copy(decoder.parameters.get(), parameters.get()));
+    decoder.time_base = time_base;
+    decoder.preview_level = preview_level;
+
+    decoder.source_context = nullptr;
+    decoder.sink_context = nullptr;
 
     auto color_space = codec_context->colorspace;
     if (color_space == AVCOL_SPC_UNSPECIFIED)
@@ -105,7 +398,22 @@ file::file(const char *filename) {
     auto color_range = codec_context->color_range;
     if (color_range == AVCOL_RANGE_UNSPECIFIED)
         color_range = AVCOL_RANGE_MPEG;
-    AVRational time_base = format_context->streams[stream_index]->time_base;
+
+    // frames keep the depth and subsampling of the stream
+    if (color_conversion::supported(
+        codec_context->pix_fmt, color_space, color_primaries,
+        color_transfer_characteristic
+    )) {
+        pixel_format format;
+        find_pixel_format(codec_context->pix_fmt, format);
+        decoder.conversion = color_conversion(
+            format, color_space, color_primaries,
+            color_transfer_characteristic, color_range
+        );
+        return;
+    }
+
+    decoder.graph = avfilter_graph_alloc();
     // filter parameters are stringly typed
     // TODO: use codec_context->sample_aspect_ratio
     // TODO: figure out what to do if sample_aspect_ratio is unknown (0)
@@ -113,58 +421,334 @@ file::file(const char *filename) {
     std::snprintf(
         filter, sizeof(filter),
         "buffer=video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=1/1,"
-        "colorspace=all=bt709:trc=bt709:format=yuv420p:range=jpeg:"
+        "colorspace=all=bt709:trc=bt709:format=%s:range=jpeg:"
         "ispace=%d:iprimaries=%d:itrc=%d:irange=%d,"
         "buffersink",
         codec_context->width, codec_context->height, codec_context->pix_fmt,
-        time_base.num, time_base.den,
+        time_base.num, time_base.den, graph_format(codec_context->pix_fmt),
         color_space, color_primaries, color_transfer_characteristic, color_range
     );
 
     check(avfilter_graph_parse2(
-        graph.get(), filter,
-        out_ptr(input), out_ptr(output)
+        decoder.graph.get(), filter,
+        out_ptr(decoder.input), out_ptr(decoder.output)
     ));
-    check(avfilter_graph_config(graph.get(), nullptr));
+    check(avfilter_graph_config(decoder.graph.get(), nullptr));
 
-    source_context = avfilter_graph_get_filter(graph.get(), "Parsed_buffer_0");
-    sink_context =
-        avfilter_graph_get_filter(graph.get(), "Parsed_buffersink_2");
+    decoder.source_context =
+        avfilter_graph_get_filter(decoder.graph.get(), "Parsed_buffer_0");
+    decoder.sink_context =
+        avfilter_graph_get_filter(decoder.graph.get(), "Parsed_buffersink_2");
 
-    char* dump = avfilter_graph_dump(graph.get(), "");
+    char* dump = avfilter_graph_dump(decoder.graph.get(), "");
     std::cout << dump << std::endl;
     av_free(dump);
-
-    av_frame = av_frame_alloc();
-    packet = av_packet_alloc();
 }
 
 void file::seek(uint64_t milliseconds) {
-    AVRational time_base = format_context->streams[stream_index]->time_base;
-    int64_t timestamp = milliseconds * time_base.den / 1000 / time_base.num;
+    lease lease(*this);
+    int64_t timestamp = this->timestamp(milliseconds);
+    // seek to the exact keyframe, so the demuxer doesn't have to search for it
+    size_t keyframe = index.keyframe_before(timestamp);
+    if (keyframe != size_t(-1))
+        timestamp = index[keyframe].pts;
+    // drop frames from before the seek
+    avcodec_flush_buffers(live->codec_context.get());
+    position = ~0ull;
+    seek_time = milliseconds;
+    resume = false;
+    live->recording = nullptr;
+
+    // the demuxer is seeked once the cached GOPs run out
+    live->cached_gop = keyframe != size_t(-1) && packets ?
+        packets->find(timestamp) : nullptr;
+    live->cached_packet = 0;
+    if (live->cached_gop)
+        return;
     check(av_seek_frame(
-        format_context.get(), stream_index, timestamp, AVSEEK_FLAG_BACKWARD
+        live->format_context.get(), stream_index, timestamp,
+        AVSEEK_FLAG_BACKWARD
     ));
 }
 
+std::shared_ptr<frame> file::seek_exact(
+    uint64_t milliseconds, frame_cache& cache, file* key
+) {
+    lease lease(*this);
+    if (!key)
+        key = this;
+
+    size_t keyframe = index.keyframe_before(timestamp(milliseconds));
+    // a recycled decoder starts over
+    bool ahead =
+        !resume && position != ~0ull && position < milliseconds &&
+        index.keyframe_before(timestamp(position)) == keyframe;
+    // decoding continues after the frame at the position, which is shown
+    // until the next one, unless the cache kept only another level of it
+    std::shared_ptr<frame> target;
+    if (ahead) {
+        target = cache.get_frame({key, position, preview_level});
+        uint16_t level_width =
+            (width + (1u << preview_level) - 1) >> preview_level;
+        ahead = target && target->time == position &&
+            target->width == level_width;
+    }
+    if (!ahead) {
+        target = nullptr;
+        seek(milliseconds);
+    }
+
+    while (true) {
+        std::shared_ptr<frame> decoded;
+        try {
+            decoded = std::make_shared<frame>(get_next_frame());
+        } catch (end_of_file&) {
+            // the file ended, the last frame stays on screen
+            return target;
+        }
+        cache.put_frame({key, decoded->time, preview_level}, decoded);
+
+        if (decoded->time == milliseconds)
+            return decoded;
+        if (decoded->time > milliseconds)
+            // frames before the first one show the first one
+            return target ? target : decoded;
+        target = std::move(decoded);
+    }
+}
+
+std::vector<uint64_t> file::keyframes() {
+    std::vector<uint64_t> times;
+    times.reserve(index.keyframes.size());
+    for (auto keyframe : index.keyframes)
+        times.push_back(milliseconds(index[keyframe].pts));
+    return times;
+}
+
+size_t file::frame_number(uint64_t milliseconds) {
+    return index.find(timestamp(milliseconds));
+}
+
+void file::prefetch(uint64_t begin, uint64_t end) {
+    if (index.size() == 0)
+        return;
+    // decoding starts at the keyframe
+    size_t first = index.keyframe_before(timestamp(begin));
+    // the last GOP ends with the duration, which may be unknown
+    size_t last =
+        end >= duration ? index.size() - 1 : index.find(timestamp(end));
+    if (first == size_t(-1))
+        first = 0;
+    if (last == size_t(-1))
+        return;
+
+    // packets are sorted by presentation time, not by position
+    int64_t begin_position = INT64_MAX, end_position = 0;
+    for (size_t i = first; i <= last; i++) {
+        // not all demuxers know the position
+        if (index[i].position < 0)
+            continue;
+        begin_position = std::min(begin_position, index[i].position);
+        end_position =
+            std::max<int64_t>(end_position, index[i].position + index[i].size);
+    }
+    if (begin_position >= end_position)
+        return;
+
+    // the pool may recycle the decoder meanwhile
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    if (live && live->io)
+        live->io->prefetch(begin_position, end_position - begin_position);
+}
+
+size_t file::frames_since_keyframe(uint64_t milliseconds) {
+    int64_t timestamp = this->timestamp(milliseconds);
+    size_t keyframe = index.keyframe_before(timestamp);
+    size_t frame = index.find(timestamp);
+    if (keyframe == size_t(-1) || frame == size_t(-1) || frame < keyframe)
+        return 0;
+    return frame - keyframe;
+}
+
+size_t file::frame_size() const {
+    auto source = AVPixelFormat(parameters->format);
+    pixel_format format = yuv420p;
+    // other formats are converted, see graph_format
+    if (!find_pixel_format(source, format))
+        find_pixel_format(av_get_pix_fmt(graph_format(source)), format);
+    return ::frame{.format = format, .width = width, .height = height}.size();
+}
+
+void file::read_packet() {
+    av_packet_unref(live->packet.get());
+    while (live->cached_gop) {
+        if (live->cached_packet < live->cached_gop->size()) {
+            auto& cached = (*live->cached_gop)[live->cached_packet++];
+            check(av_packet_ref(live->packet.get(), cached.get()));
+            return;
+        }
+
+        // continue with the next GOP, from the cache if possible
+        int64_t keyframe =
+            presentation_time(live->cached_gop->front().get());
+        auto next = std::upper_bound(
+            index.keyframes.begin(), index.keyframes.end(), keyframe,
+            [this](int64_t pts, uint32_t entry) {
+                return pts < index[entry].pts;
+            }
+        );
+        if (next == index.keyframes.end())
+            check(AVERROR_EOF);
+        int64_t next_keyframe = index[*next].pts;
+        live->cached_gop = packets->find(next_keyframe);
+        live->cached_packet = 0;
+        if (!live->cached_gop) {
+            check(av_seek_frame(
+                live->format_context.get(), stream_index, next_keyframe,
+                AVSEEK_FLAG_BACKWARD
+            ));
+        }
+    }
+
+    while (true) {
+        int result =
+            av_read_frame(live->format_context.get(), live->packet.get());
+        // the last GOP ends with the file
+        if (result == AVERROR_EOF && live->recording)
+            finish_recording();
+        check(result);
+        if (live->packet->stream_index == stream_index)
+            break;
+        av_packet_unref(live->packet.get());
+    }
+    if (!packets)
+        return;
+
+    if (live->packet->flags & AV_PKT_FLAG_KEY) {
+        if (live->recording)
+            finish_recording();
+        // the rest of the GOP may be cached already, the packet just read is
+        // the same as its first one
+        live->cached_gop = packets->find(
+            presentation_time(live->packet.get())
+        );
+        if (live->cached_gop) {
+            live->cached_packet = 1;
+            return;
+        }
+        live->recording = std::make_shared<packet_cache::gop>();
+    }
+    if (live->recording)
+        record(live->packet.get());
+}
+
+void file::record(const AVPacket* packet) {
+    unique_av_packet copy = av_packet_alloc();
+    if (!copy)
+        throw std::bad_alloc();
+    // shares the buffer with the demuxer
+    check(av_packet_ref(copy.get(), packet));
+    live->recording->push_back(std::move(copy));
+}
+
+void file::finish_recording() {
+    // the key is taken before the recording is moved out
+    int64_t keyframe = presentation_time(live->recording->front().get());
+    packets->insert(keyframe, std::move(live->recording));
+}
+
+int64_t file::timestamp(uint64_t milliseconds) {
+    // the last time stamp within the millisecond, so frames which are
+    // rounded down to this millisecond are not missed
+    return
+        ((milliseconds + 1) * time_base.den - 1) / 1000 / time_base.num;
+}
+
+uint64_t file::milliseconds(int64_t timestamp) {
+    return timestamp * time_base.num * 1000 / time_base.den;
+}
+
 frame file::get_next_frame() {
+    lease lease(*this);
+    if (!resume)
+        return decode_frame();
+
+    // the decoder was recycled, decode up to where it was again
+    uint64_t last = position, target = seek_time;
+    if (last == ~0ull) {
+        seek(target);
+        return decode_frame();
+    }
+    seek(last);
     while (true) {
-        int result = avcodec_receive_frame(codec_context.get(), av_frame.get());
+        frame frame = decode_frame();
+        if (frame.time > last)
+            return frame;
+    }
+}
+
+frame file::decode_frame() {
+    AVCodecContext* codec_context = live->codec_context.get();
+    while (true) {
+        int result = avcodec_receive_frame(codec_context, live->av_frame.get());
         if (result == 0)
             break;
+        // throws end_of_file once the drained decoder has no more frames
         if (result != AVERROR(EAGAIN))
             check(result);
 
-        do {
-            check(av_read_frame(format_context.get(), packet.get()));
-        } while (packet->stream_index != stream_index);
+        try {
+            read_packet();
+        } catch (end_of_file&) {
+            // the decoder holds back frames, e.g. because of B-frames or
+            // frame threading, they are only output after draining it
+            check(avcodec_send_packet(codec_context, nullptr));
+            continue;
+        }
+        check(avcodec_send_packet(codec_context, live->packet.get()));
+    }
+    return output_frame();
+}
+
+frame file::get_keyframe(uint64_t milliseconds) {
+    lease lease(*this);
+    seek(milliseconds);
+    // demuxers may start before the keyframe
+    do {
+        read_packet();
+    } while (!(live->packet->flags & AV_PKT_FLAG_KEY));
+    AVCodecContext* codec_context = live->codec_context.get();
+    check(avcodec_send_packet(codec_context, live->packet.get()));
+    // drain the decoder, instead of sending the packets after the keyframe
+    // until it outputs it
+    check(avcodec_send_packet(codec_context, nullptr));
+    check(avcodec_receive_frame(codec_context, live->av_frame.get()));
+
+    frame frame = output_frame();
+    // the drained decoder only continues after seeking
+    position = ~0ull;
+    return frame;
+}
 
-        check(avcodec_send_packet(codec_context.get(), packet.get()));
+frame file::output_frame() {
+    AVFrame* av_frame = live->av_frame.get();
+    frame frame;
+    if (live->graph) {
+        check(av_buffersrc_add_frame(live->source_context, av_frame));
+        check(av_buffersink_get_frame(live->sink_context, av_frame));
+        frame = to_frame(av_frame, time_base);
+    } else {
+        frame = live->conversion.convert(
+            to_frame(av_frame, time_base), live->allocator.get()
+        );
     }
+    position = frame.time;
+    seek_time = ~0ull;
 
-    check(av_buffersrc_add_frame(source_context, av_frame.get()));
-    check(av_buffersink_get_frame(sink_context, av_frame.get()));
+    // not all codecs support lowres
+    unsigned lowres = live->codec_context->lowres;
+    for (unsigned level = lowres; level < preview_level; level++)
+        frame = scale_down(frame);
 
-    AVRational time_base = format_context->streams[stream_index]->time_base;
-    return to_frame(av_frame.get(), time_base);
+    return frame;
 }
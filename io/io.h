@@ -1,28 +1,181 @@
 #pragma once
 
 #include <vector>
+#include <memory>
+#include <string>
 
 #include "../utility/av_resource.h"
 #include "../data/frame.h"
+#include "packet_index.h"
+#include "color_conversion.h"
+#include "packet_cache.h"
+#include "decoder_pool.h"
 
+struct frame_cache;
+
+/**
+ * @brief set_frame_allocator sets the memory decoders opened from then on
+ * decode into, and convert their frames into. nullptr, the default, leaves
+ * frames in FFmpeg's buffers and the plane pool, as does an allocator which
+ * is out of memory. Decoders keep the allocator they were opened with until
+ * they are closed. It may be called from any thread.
+ */
+void set_frame_allocator(std::shared_ptr<frame_allocator> allocator);
+
+/**
+ * @brief file decodes the video stream of a file. The stream info and the
+ * packet index are read once and kept, the demuxer and the decoder are
+ * leased from a decoder_pool while the file is used. The pool may recycle
+ * them for other files in between, they are opened again when needed and
+ * get_next_frame continues where it was.
+ *
+ * A file may only be used from one thread at a time, except for the
+ * functions which only look up the metadata, and prefetch.
+ */
 struct file {
-    file(const char* filename);
+    /**
+     * @param filename is the URL of the file to open.
+     * @param preview_level is 0 to decode at full quality. Otherwise the
+     * decoder trades quality for speed, and frames are returned at that level
+     * of frame_key.
+     * @param pool provides the decoder, nullptr gives the file a decoder of
+     * its own which is never recycled.
+     */
+    file(
+        const char* filename, unsigned preview_level = 0,
+        std::shared_ptr<decoder_pool> pool = nullptr
+    );
+    ~file();
+
+    file(const file&) = delete;
+    file& operator=(const file&) = delete;
 
+    /**
+     * @brief seek moves to the keyframe before the given time. If its GOP is
+     * in the packet cache, the demuxer isn't touched.
+     */
     void seek(uint64_t milliseconds);
+    // throws end_of_file after the last frame
     frame get_next_frame();
 
-    unique_av_format_context format_context;
-    struct AVCodec* codec;
-    unique_av_codec_context codec_context;
+    /**
+     * @brief get_keyframe decodes only the keyframe before the given time.
+     * None of the packets after it are read, so this is the fastest way to
+     * get a frame of a part of the file which wasn't decoded yet. Decoding
+     * continues after the next seek.
+     * @param milliseconds is the time to look up the keyframe for.
+     * @return the keyframe.
+     */
+    frame get_keyframe(uint64_t milliseconds);
 
-    unique_av_filter_in_out input;
-    unique_av_filter_in_out output;
-    unique_av_filter_graph graph;
-    struct AVFilterContext* source_context;
-    struct AVFilterContext* sink_context;
-    int stream_index;
+    /**
+     * @brief seek_exact decodes the frame displayed at the given time. It
+     * starts at the previous keyframe, unless the decoder is already between
+     * that keyframe and the frame. Every frame decoded on the way is put into
+     * the cache, including the returned one and possibly the one after it.
+     * @param milliseconds is the time of the frame.
+     * @param cache receives all decoded frames.
+     * @param key is the file used in the frame_key, defaults to this.
+     * @return the frame, the last one if the time is after the end of the
+     * file, or nullptr if the file has no frames.
+     * @throws std::runtime_error if decoding fails before the file ends.
+     */
+    std::shared_ptr<frame> seek_exact(
+        uint64_t milliseconds, frame_cache& cache, file* key = nullptr
+    );
 
-    unique_av_frame av_frame;
-    unique_av_packet packet;
-};
+    /**
+     * @brief keyframes looks up the keyframes in the packet index.
+     * @return the sorted times of all keyframes in milliseconds.
+     */
+    std::vector<uint64_t> keyframes();
+
+    /**
+     * @brief frame_number looks up the frame displayed at the given time in
+     * the packet index.
+     * @return the number of the frame or -1 if it is before the first frame.
+     */
+    size_t frame_number(uint64_t milliseconds);
+
+    /**
+     * @brief frames_since_keyframe looks up how many frames have to be
+     * decoded after the keyframe to get to the frame at the given time.
+     * @return the number of frames or 0 if there is no keyframe before it.
+     */
+    size_t frames_since_keyframe(uint64_t milliseconds);
+
+    /**
+     * @brief frame_size works out the size of the frames returned at level 0,
+     * see frame::size, from the format of the stream.
+     * @return the size in bytes.
+     */
+    size_t frame_size() const;
+
+    /**
+     * @brief prefetch asks the OS to read the packets needed to decode the
+     * frames in the given range into memory, looked up in the packet index.
+     * Only local files with an open demuxer are prefetched. It may be called
+     * from any thread.
+     * @param begin is the time of the first frame in milliseconds.
+     * @param end is the time of the last frame in milliseconds.
+     */
+    void prefetch(uint64_t begin, uint64_t end);
+
+    // conversion between milliseconds and the time base of the stream
+    int64_t timestamp(uint64_t milliseconds);
+    uint64_t milliseconds(int64_t timestamp);
 
+    const std::string filename;
+    const unsigned preview_level;
+    int stream_index = -1;
+    AVRational time_base;
+    // the parameters of the stream, for opening decoders
+    unique_av_codec_parameters parameters;
+    uint16_t width, height;
+    uint64_t duration; // in milliseconds
+    packet_index index;
+    // time of the last decoded frame, ~0 after seeking
+    uint64_t position = ~0ull;
+
+    // shared by the files decoding the same stream, may be nullptr
+    std::shared_ptr<packet_cache> packets;
+
+private:
+    friend struct decoder_pool;
+
+    // keeps the decoder of the file while in scope, opens it again if the
+    // pool recycled it, may be nested
+    struct lease {
+        // the codec context is only opened when decoding
+        lease(file& owner, bool decoding = true);
+        ~lease();
+
+        lease(const lease&) = delete;
+        lease& operator=(const lease&) = delete;
+
+        file& owner;
+    };
+
+    // opens the demuxer, and reads the metadata the first time
+    void open_demuxer(decoder& decoder);
+    void open_decoder(decoder& decoder);
+    // throws end_of_file once the decoder has no more frames
+    frame decode_frame();
+    // reads the next packet of the stream into packet, from the cache or
+    // the demuxer
+    void read_packet();
+    void record(const struct AVPacket* packet);
+    // moves the complete recording into the packet cache
+    void finish_recording();
+    // converts av_frame, which was just received from the decoder
+    frame output_frame();
+
+    std::shared_ptr<decoder_pool> pool;
+    // nullptr while the file has no decoder, only changed by the pool
+    decoder* live = nullptr;
+    // the time passed to the last seek, ~0 once a frame was decoded after it
+    uint64_t seek_time = ~0ull;
+    // whether the decoder was recycled since the last frame, so the next
+    // one is decoded from position or seek_time again
+    bool resume = false;
+};
@@ -0,0 +1,130 @@
+#include "mapped_io.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+extern "C" {
+#include <libavformat/avio.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
+
+// of all mapped files
+static std::atomic<uint64_t>
+    bytes_read{0}, reads{0}, seeks{0}, advices{0}, minor_faults{0},
+    major_faults{0};
+
+// page faults of the calling thread so far
+static void count_faults(uint64_t& minor, uint64_t& major) {
+#ifdef __linux__
+    rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    minor = usage.ru_minflt;
+    major = usage.ru_majflt;
+#else
+    minor = major = 0;
+#endif
+}
+
+mapped_io::mapped_io(const char* filename) : mapping(filename) {
+    // small reads are copied through this buffer, larger ones are copied
+    // directly
+    const int buffer_size = 64*1024;
+    auto buffer = static_cast<unsigned char*>(av_malloc(buffer_size));
+    if (!buffer)
+        throw std::bad_alloc();
+    io_context = avio_alloc_context(
+        buffer, buffer_size, 0, this, &mapped_io::read, nullptr,
+        &mapped_io::seek
+    );
+    if (!io_context) {
+        av_free(buffer);
+        throw std::bad_alloc();
+    }
+}
+
+void mapped_io::prefetch(uint64_t offset, uint64_t length) {
+    // it's only a hint, races between threads don't matter
+    if (prefetched_offset == offset && prefetched_length == length)
+        return;
+    prefetched_offset = offset;
+    prefetched_length = length;
+    mapping.advise(offset, length, mapped_file::advice::will_need);
+    advices++;
+}
+
+void mapped_io::sample_faults() {
+    uint64_t minor, major;
+    count_faults(minor, major);
+    // the counters are per thread, the pool may hand the file to another one
+    if (sampled_thread == std::this_thread::get_id()) {
+        minor_faults += minor - sampled_minor;
+        major_faults += major - sampled_major;
+    }
+    sampled_thread = std::this_thread::get_id();
+    sampled_minor = minor;
+    sampled_major = major;
+}
+
+io_statistics mapped_io::statistics() {
+    return {
+        .bytes_read = bytes_read,
+        .reads = reads,
+        .seeks = seeks,
+        .advices = advices,
+        .minor_faults = minor_faults,
+        .major_faults = major_faults,
+    };
+}
+
+int mapped_io::read(void* opaque, uint8_t* buffer, int size) {
+    auto& io = *static_cast<mapped_io*>(opaque);
+    if (io.position >= io.mapping.size) {
+        io.sample_faults();
+        return AVERROR_EOF;
+    }
+
+    // read ahead once the demuxer gets close to the end of the advised
+    // range, or left it. Page faults are sampled per range, two system calls
+    // per read would cost more than small copies.
+    if (
+        io.position < io.advised_begin ||
+        io.position + readahead / 2 > io.advised_end
+    ) {
+        io.sample_faults();
+        io.advised_begin = io.position;
+        io.advised_end = io.position + readahead;
+        io.mapping.advise(
+            io.position, readahead, mapped_file::advice::sequential
+        );
+        io.mapping.advise(
+            io.position, readahead, mapped_file::advice::will_need
+        );
+        advices += 2;
+    }
+
+    size_t count =
+        std::min<uint64_t>(size, io.mapping.size - io.position);
+    std::memcpy(buffer, io.mapping.data + io.position, count);
+    io.position += count;
+
+    bytes_read += count;
+    reads++;
+    return static_cast<int>(count);
+}
+
+int64_t mapped_io::seek(void* opaque, int64_t offset, int whence) {
+    auto& io = *static_cast<mapped_io*>(opaque);
+    int64_t position =
+        seek_position(io.position, io.mapping.size, offset, whence);
+    if (position >= 0 && !(whence & AVSEEK_SIZE)) {
+        io.position = position;
+        seeks++;
+    }
+    return position;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <thread>
+
+#include "file_io.h"
+#include "../utility/mapped_file.h"
+
+struct io_statistics {
+    uint64_t bytes_read;
+    uint64_t reads; // calls from the demuxer
+    uint64_t seeks;
+    uint64_t advices; // hints given to the OS
+    // page faults of the demuxing threads, sampled per readahead window,
+    // only counted on Linux
+    uint64_t minor_faults; // pages which were in memory already
+    uint64_t major_faults; // pages read from disk
+};
+
+/**
+ * @brief mapped_io reads a local file through a memory mapping, as the
+ * AVIOContext of a demuxer. Reads are copies from the mapping instead of
+ * system calls, large packets are copied straight into the packet.
+ *
+ * While the demuxer reads sequentially, the next readahead bytes are
+ * advised as sequential and needed, so the OS reads them in before they are
+ * demuxed. Other ranges, e.g. the GOPs around the playhead, are prefetched
+ * explicitly. The OS reads prefetched pages asynchronously, but the
+ * demuxer still stalls on pages which weren't read in yet.
+ */
+struct mapped_io : file_io {
+    /**
+     * @param filename is the file name of a local file.
+     */
+    mapped_io(const char* filename);
+
+    mapped_io(const mapped_io&) = delete;
+    mapped_io& operator=(const mapped_io&) = delete;
+
+    struct AVIOContext* context() const override {
+        return io_context.get();
+    }
+
+    // asks the OS to read the range into memory, unless it was the last
+    // range prefetched
+    void prefetch(uint64_t offset, uint64_t length) override;
+
+    /**
+     * @brief statistics sums up all mapped files opened so far.
+     */
+    static io_statistics statistics();
+
+    // bytes advised ahead of sequential reads
+    static constexpr size_t readahead = 16*1024*1024;
+
+private:
+    static int read(void* opaque, uint8_t* buffer, int size);
+    static int64_t seek(void* opaque, int64_t offset, int whence);
+
+    // adds the page faults since the last sample
+    void sample_faults();
+
+    mapped_file mapping;
+    uint64_t position = 0;
+    // the range advised ahead of sequential reads
+    uint64_t advised_begin = 0, advised_end = 0;
+    // page faults of the demuxing thread at the start of the advised range
+    std::thread::id sampled_thread;
+    uint64_t sampled_minor = 0, sampled_major = 0;
+    // the last range prefetched
+    std::atomic<uint64_t> prefetched_offset{~0ull}, prefetched_length{0};
+    unique_av_io_context io_context;
+};
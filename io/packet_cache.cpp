@@ -0,0 +1,82 @@
+#include "packet_cache.h"
+
+#include <algorithm>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+std::shared_ptr<const packet_cache::gop> packet_cache::find(int64_t keyframe) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto i = gops.find(keyframe);
+    if (i == gops.end()) {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    i->second.last_use = ++clock;
+    return i->second.packets;
+}
+
+void packet_cache::insert(
+    int64_t keyframe, std::shared_ptr<const gop> packets
+) {
+    size_t size = 0;
+    for (auto& packet : *packets)
+        size += packet->size;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    // decoders working on the same GOP both record it
+    if (gops.contains(keyframe))
+        return;
+    gops[keyframe] = {std::move(packets), size, ++clock};
+    memory_usage += size;
+    evict();
+}
+
+void packet_cache::set_playhead(int64_t pts) {
+    std::lock_guard<std::mutex> lock(mutex);
+    playhead = pts;
+}
+
+packet_cache_statistics packet_cache::statistics() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return {
+        .hits = hits,
+        .misses = misses,
+        .evictions = evictions,
+        .memory_usage = memory_usage,
+    };
+}
+
+void packet_cache::evict() {
+    while (memory_usage > memory_limit && gops.size() > 1) {
+        // the GOPs around the playhead
+        auto near_begin = gops.upper_bound(playhead);
+        auto near_end = near_begin;
+        for (size_t i = 0; i <= keep_around && near_begin != gops.begin(); i++)
+            --near_begin;
+        for (size_t i = 0; i < keep_around && near_end != gops.end(); i++)
+            ++near_end;
+
+        auto victim = gops.end();
+        auto least_recently_used = [&](auto begin, auto end) {
+            for (auto i = begin; i != end; ++i) {
+                if (
+                    victim == gops.end() ||
+                    i->second.last_use < victim->second.last_use
+                )
+                    victim = i;
+            }
+        };
+        least_recently_used(gops.begin(), near_begin);
+        least_recently_used(near_end, gops.end());
+        // only GOPs around the playhead are left
+        if (victim == gops.end())
+            least_recently_used(near_begin, near_end);
+
+        memory_usage -= victim->second.size;
+        gops.erase(victim);
+        evictions++;
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "../utility/av_resource.h"
+
+struct packet_cache_statistics {
+    uint64_t hits; // GOPs read from the cache
+    uint64_t misses; // GOPs read from the file
+    uint64_t evictions;
+    size_t memory_usage; // in bytes
+};
+
+/**
+ * @brief packet_cache keeps the demuxed packets of whole GOPs of one stream,
+ * so decoding them again doesn't read the file. Packets are reference
+ * counted, the cache shares them with the demuxer. The GOPs closest to the
+ * playhead are kept, the others are evicted least recently used first.
+ * It may be shared by the files of all decoders of one stream and used from
+ * any number of threads.
+ */
+struct packet_cache {
+    // packets in demuxing order, starting with the keyframe
+    using gop = std::vector<unique_av_packet>;
+
+    /**
+     * @brief find looks up a GOP and marks it as recently used.
+     * @param keyframe is the presentation time stamp of its keyframe.
+     * @return the packets or nullptr if the GOP is not cached.
+     */
+    std::shared_ptr<const gop> find(int64_t keyframe);
+
+    /**
+     * @brief insert adds a complete GOP and evicts others if the cache is
+     * over its memory limit.
+     * @param keyframe is the presentation time stamp of its keyframe.
+     */
+    void insert(int64_t keyframe, std::shared_ptr<const gop> packets);
+
+    /**
+     * @brief set_playhead moves the range of GOPs which are kept.
+     * @param pts is the presentation time stamp at the playhead.
+     */
+    void set_playhead(int64_t pts);
+
+    packet_cache_statistics statistics();
+
+    // compressed packets are small, this is minutes of most footage
+    size_t memory_limit = 256*1024*1024;
+    // the GOPs on either side of the playhead which are evicted last
+    size_t keep_around = 4;
+
+private:
+    struct entry {
+        std::shared_ptr<const gop> packets;
+        size_t size; // in bytes
+        uint64_t last_use;
+    };
+
+    void evict();
+
+    std::mutex mutex;
+    std::map<int64_t, entry> gops;
+    int64_t playhead = 0;
+    uint64_t clock = 0;
+    size_t memory_usage = 0;
+    uint64_t hits = 0, misses = 0, evictions = 0;
+};
@@ -0,0 +1,119 @@
+#include "packet_index.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+struct packet_index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t source_hash;
+    int64_t source_time;
+    uint64_t count;
+};
+
+static const char index_magic[8] = {'v', 'd', 'i', 'n', 'd', 'e', 'x', 0};
+static const uint32_t index_version = 1;
+
+packet_index::packet_index(std::vector<packet_entry>&& entries) :
+    built(std::move(entries))
+{
+    std::sort(
+        built.begin(), built.end(),
+        [](const packet_entry& a, const packet_entry& b) {
+            return a.pts < b.pts;
+        }
+    );
+    this->entries = built.data();
+    count = built.size();
+    find_keyframes();
+}
+
+bool packet_index::load(
+    const char* filename, uint64_t source_hash, int64_t source_time
+) {
+    try {
+        mapping = mapped_file(filename);
+    } catch (std::runtime_error&) {
+        return false;
+    }
+
+    packet_index_header header;
+    if (mapping.size < sizeof(header))
+        return false;
+    std::memcpy(&header, mapping.data, sizeof(header));
+    if (
+        std::memcmp(header.magic, index_magic, sizeof(index_magic)) != 0 ||
+        header.version != index_version ||
+        header.entry_size != sizeof(packet_entry) ||
+        header.source_hash != source_hash ||
+        header.source_time != source_time ||
+        mapping.size != sizeof(header) + header.count * sizeof(packet_entry)
+    ) {
+        mapping = {};
+        return false;
+    }
+
+    built.clear();
+    entries =
+        reinterpret_cast<const packet_entry*>(mapping.data + sizeof(header));
+    count = header.count;
+    find_keyframes();
+    return true;
+}
+
+bool packet_index::save(
+    const char* filename, uint64_t source_hash, int64_t source_time
+) const {
+    packet_index_header header{
+        .version = index_version,
+        .entry_size = sizeof(packet_entry),
+        .source_hash = source_hash,
+        .source_time = source_time,
+        .count = count,
+    };
+    std::memcpy(header.magic, index_magic, sizeof(index_magic));
+
+    FILE* file = std::fopen(filename, "wb");
+    if (!file)
+        return false;
+    bool written =
+        std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+        std::fwrite(entries, sizeof(packet_entry), count, file) == count;
+    written = std::fclose(file) == 0 && written;
+    if (!written)
+        std::remove(filename);
+    return written;
+}
+
+void packet_index::find_keyframes() {
+    keyframes.clear();
+    for (auto i = 0u; i < count; i++) {
+        if (entries[i].keyframe())
+            keyframes.push_back(i);
+    }
+}
+
+size_t packet_index::find(int64_t pts) const {
+    auto i = std::upper_bound(
+        begin(), end(), pts,
+        [](int64_t pts, const packet_entry& entry) {
+            return pts < entry.pts;
+        }
+    );
+    return (i - begin()) - 1;
+}
+
+size_t packet_index::keyframe_before(int64_t pts) const {
+    size_t packet = find(pts);
+    if (packet == size_t(-1))
+        return -1;
+    auto i = std::upper_bound(
+        keyframes.begin(), keyframes.end(), static_cast<uint32_t>(packet)
+    );
+    if (i == keyframes.begin())
+        return -1;
+    return *(i - 1);
+}
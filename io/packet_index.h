@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "../utility/mapped_file.h"
+
+struct packet_entry {
+    int64_t pts, dts, position; // time stamps in stream time base
+    uint32_t size;
+    uint32_t flags; // AV_PKT_FLAG_*
+
+    bool keyframe() const;
+};
+
+/**
+ * @brief packet_index has one entry per packet of a stream, sorted by
+ * presentation time stamp. The entries are a flat array, which is stored
+ * next to the media file and memory-mapped on the next open.
+ */
+struct packet_index {
+    packet_index() = default;
+    packet_index(std::vector<packet_entry>&& entries);
+
+    /**
+     * @brief load maps a previously saved index.
+     * @param filename is the name of the index file.
+     * @param source_hash is the content_hash of the media file and
+     * source_time its modification time, to detect stale indices.
+     * @return whether the index was loaded.
+     */
+    bool load(const char* filename, uint64_t source_hash, int64_t source_time);
+
+    /**
+     * @brief save writes the index to the given file.
+     * @return whether the index was written.
+     */
+    bool save(
+        const char* filename, uint64_t source_hash, int64_t source_time
+    ) const;
+
+    /**
+     * @brief find looks up the packet displayed at the given time stamp.
+     * @return the index of the last packet with a presentation time stamp not
+     * after pts, which is also the frame number, or -1 if there is none.
+     */
+    size_t find(int64_t pts) const;
+
+    /**
+     * @brief keyframe_before looks up the keyframe to start decoding at, to
+     * get the frame displayed at the given time stamp.
+     * @return the index of the keyframe or -1 if there is none.
+     */
+    size_t keyframe_before(int64_t pts) const;
+
+    const packet_entry* begin() const { return entries; }
+    const packet_entry* end() const { return entries + count; }
+    size_t size() const { return count; }
+    const packet_entry& operator[](size_t i) const { return entries[i]; }
+
+    // indices of all keyframes, ascending
+    std::vector<uint32_t> keyframes;
+
+private:
+    void find_keyframes();
+
+    // either points into mapping or built
+    const packet_entry* entries = nullptr;
+    size_t count = 0;
+    mapped_file mapping;
+    std::vector<packet_entry> built;
+};
+
+inline bool packet_entry::keyframe() const {
+    return flags & 1; // AV_PKT_FLAG_KEY
+}
@@ -0,0 +1,301 @@
+#include "proxy.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <stdexcept>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/dict.h>
+}
+
+#include "io.h"
+#include "../data/frame.h"
+#include "../utility/av_resource.h"
+#include "../utility/mapped_file.h"
+#include "../utility/out_ptr.h"
+
+static const char proxy_suffix[] = ".proxy.mkv";
+
+static void close_output(AVFormatContext** format_context) {
+    avio_closep(&(*format_context)->pb);
+    avformat_free_context(*format_context);
+}
+
+using unique_output_context =
+    unique_resource<AVFormatContext*, close_output>;
+
+// the path of a local file, or an empty string
+static std::string local_path(const char* filename) {
+    std::string path = filename;
+    if (path.starts_with("file:"))
+        path = path.substr(5);
+    std::error_code error;
+    if (!std::filesystem::is_regular_file(path, error))
+        return "";
+    return path;
+}
+
+std::string proxy_path(const char* filename) {
+    std::string path = local_path(filename);
+    if (path.empty())
+        return path;
+    return path + proxy_suffix;
+}
+
+// reads the content hash and modification time of the source a proxy was
+// made of, returns false if it can't be opened or doesn't have them
+static bool read_source_version(
+    const char* filename, uint64_t& source_hash, int64_t& source_time
+) {
+    unique_av_format_context format_context;
+    if (avformat_open_input(
+        out_ptr(format_context), filename, nullptr, nullptr
+    ) < 0)
+        return false;
+    // keys are not case sensitive, Matroska stores them in upper case
+    AVDictionaryEntry* hash = av_dict_get(
+        format_context->metadata, "source_hash", nullptr, 0
+    );
+    AVDictionaryEntry* time = av_dict_get(
+        format_context->metadata, "source_time", nullptr, 0
+    );
+    if (!hash || !time)
+        return false;
+    source_hash = std::strtoull(hash->value, nullptr, 10);
+    source_time = std::strtoll(time->value, nullptr, 10);
+    return true;
+}
+
+// writes all packets the encoder has ready
+static void write_packets(
+    AVCodecContext* encoder, AVFormatContext* format_context,
+    AVPacket* packet, uint32_t duration
+) {
+    while (true) {
+        int result = avcodec_receive_packet(encoder, packet);
+        if (result == AVERROR(EAGAIN) || result == AVERROR_EOF)
+            return;
+        check(result);
+
+        // every packet is the frame sent last, MJPEG has no delay
+        packet->duration = duration;
+        packet->stream_index = 0;
+        av_packet_rescale_ts(
+            packet, encoder->time_base, format_context->streams[0]->time_base
+        );
+        // takes over the reference of the packet
+        check(av_interleaved_write_frame(format_context, packet));
+    }
+}
+
+// MJPEG only supports 8 bit samples, the subsampling is kept
+static AVPixelFormat encoder_format(pixel_format format) {
+    if (format == planar_yuv(1, 1, 8))
+        return AV_PIX_FMT_YUVJ420P;
+    if (format == planar_yuv(1, 0, 8))
+        return AV_PIX_FMT_YUVJ422P;
+    if (format == planar_yuv(0, 0, 8))
+        return AV_PIX_FMT_YUVJ444P;
+    throw std::runtime_error("Unsupported pixel format");
+}
+
+// rounds samples of more than 8 bits to 8 bits
+static frame reduce_depth(const frame& source) {
+    pixel_format format = planar_yuv(
+        source.format.chroma_shift_x, source.format.chroma_shift_y, 8
+    );
+    frame frame =
+        allocate_frame(format, source.width, source.height, source.time);
+    frame.duration = source.duration;
+    unsigned shift = source.format.bit_depth - 8;
+    for (auto plane = 0u; plane < format.plane_count; plane++) {
+        uint16_t width = format.plane_width(plane, frame.width);
+        uint16_t height = format.plane_height(plane, frame.height);
+        const frame::plane& input = source.planes[plane];
+        const frame::plane& output = frame.planes[plane];
+        for (uint16_t y = 0; y < height; y++) {
+            auto in = reinterpret_cast<const uint16_t*>(
+                input.data + size_t(y) * input.stride
+            );
+            uint8_t* out = output.data + size_t(y) * output.stride;
+            for (uint16_t x = 0; x < width; x++) {
+                unsigned value = (in[x] + (1u << (shift - 1))) >> shift;
+                out[x] = static_cast<uint8_t>(std::min(value, 255u));
+            }
+        }
+    }
+    return frame;
+}
+
+static unique_av_codec_context open_encoder(
+    AVFormatContext* format_context, uint16_t width, uint16_t height,
+    AVPixelFormat pixel_format
+) {
+    AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+    if (!codec)
+        throw std::runtime_error("No codec found");
+    unique_av_codec_context encoder = avcodec_alloc_context3(codec);
+    if (!encoder)
+        throw std::bad_alloc();
+
+    encoder->width = width;
+    encoder->height = height;
+    encoder->pix_fmt = pixel_format;
+    // frame times are in milliseconds
+    encoder->time_base = {1, 1000};
+    // the colors of converted frames
+    encoder->color_range = AVCOL_RANGE_JPEG;
+    encoder->colorspace = AVCOL_SPC_BT709;
+    encoder->color_primaries = AVCOL_PRI_BT709;
+    encoder->color_trc = AVCOL_TRC_BT709;
+    // a fixed quality, good enough for scrubbing
+    encoder->flags |= AV_CODEC_FLAG_QSCALE;
+    encoder->global_quality = FF_QP2LAMBDA * 4;
+    if (format_context->oformat->flags & AVFMT_GLOBALHEADER)
+        encoder->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    check(avcodec_open2(encoder.get(), codec, nullptr));
+    return encoder;
+}
+
+proxy_generator::proxy_generator(const char* filename, unsigned level) :
+    path(proxy_path(filename)), level(level), source(filename)
+{
+    if (!path.empty())
+        worker = std::thread(&proxy_generator::generate, this);
+}
+
+proxy_generator::~proxy_generator() {
+    stopping = true;
+    if (worker.joinable())
+        worker.join();
+}
+
+void proxy_generator::generate() {
+    // like the packet index, edits in place keep the size
+    std::string source_path = local_path(source.c_str());
+    std::error_code error;
+    auto time = std::filesystem::last_write_time(source_path, error);
+    if (error)
+        return;
+    int64_t source_time = time.time_since_epoch().count();
+    uint64_t source_hash;
+    try {
+        source_hash = content_hash(source_path.c_str());
+    } catch (std::runtime_error&) {
+        return;
+    }
+
+    uint64_t proxied_hash;
+    int64_t proxied_time;
+    if (
+        read_source_version(path.c_str(), proxied_hash, proxied_time) &&
+        proxied_hash == source_hash && proxied_time == source_time
+    ) {
+        complete = true;
+        return;
+    }
+
+    std::string part = path + ".part";
+    try {
+        write(part.c_str(), source_hash, source_time);
+    } catch (std::runtime_error&) {
+        // e.g. sources in formats MJPEG doesn't support
+        std::filesystem::remove(part, error);
+        return;
+    }
+    if (stopping) {
+        std::filesystem::remove(part, error);
+        return;
+    }
+    std::filesystem::rename(part, path, error);
+    complete = !error;
+}
+
+void proxy_generator::write(
+    const char* filename, uint64_t source_hash, int64_t source_time
+) {
+    // the source is decoded at full quality and downscaled, lowres decoding
+    // skips frames
+    file video(source.c_str());
+
+    unique_output_context format_context;
+    check(avformat_alloc_output_context2(
+        out_ptr(format_context), nullptr, "matroska", filename
+    ));
+    check(av_dict_set(
+        &format_context->metadata, "source_hash",
+        std::to_string(source_hash).c_str(), 0
+    ));
+    check(av_dict_set(
+        &format_context->metadata, "source_time",
+        std::to_string(source_time).c_str(), 0
+    ));
+
+    unique_av_codec_context encoder;
+    unique_av_frame av_frame = av_frame_alloc();
+    unique_av_packet packet = av_packet_alloc();
+    if (!av_frame || !packet)
+        throw std::bad_alloc();
+
+    video.seek(0);
+    while (!stopping) {
+        frame frame;
+        try {
+            frame = video.get_next_frame();
+        } catch (end_of_file&) {
+            // reached the end of the file, other errors would leave a
+            // truncated proxy, it is removed
+            break;
+        }
+        for (unsigned i = 0; i < level; i++)
+            frame = scale_down(frame);
+        if (frame.format.bit_depth > 8)
+            frame = reduce_depth(frame);
+        AVPixelFormat pixel_format = encoder_format(frame.format);
+
+        // the size is known with the first frame
+        if (!encoder) {
+            encoder = open_encoder(
+                format_context.get(), frame.width, frame.height, pixel_format
+            );
+            AVStream* stream =
+                avformat_new_stream(format_context.get(), nullptr);
+            if (!stream)
+                throw std::bad_alloc();
+            check(avcodec_parameters_from_context(
+                stream->codecpar, encoder.get()
+            ));
+            stream->time_base = encoder->time_base;
+            check(avio_open(&format_context->pb, filename, AVIO_FLAG_WRITE));
+            check(avformat_write_header(format_context.get(), nullptr));
+        }
+
+        // the encoder copies frames which are not reference counted
+        if (pixel_format != encoder->pix_fmt)
+            throw std::runtime_error("Pixel format changed");
+        av_frame->format = pixel_format;
+        av_frame->width = frame.width;
+        av_frame->height = frame.height;
+        av_frame->pts = frame.time;
+        for (auto plane = 0u; plane < frame.format.plane_count; plane++) {
+            av_frame->data[plane] = frame.planes[plane].data;
+            av_frame->linesize[plane] = frame.planes[plane].stride;
+        }
+        check(avcodec_send_frame(encoder.get(), av_frame.get()));
+        write_packets(
+            encoder.get(), format_context.get(), packet.get(),
+            frame.duration
+        );
+    }
+    if (stopping)
+        return;
+    if (!encoder)
+        throw std::runtime_error("No frames");
+
+    check(avcodec_send_frame(encoder.get(), nullptr));
+    write_packets(encoder.get(), format_context.get(), packet.get(), 0);
+    check(av_write_trailer(format_context.get()));
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <atomic>
+#include <thread>
+
+/**
+ * @brief proxy_generator makes an intra-only, low resolution copy of a file
+ * in the background. Any frame of the proxy is decoded from a single small
+ * packet, so it's shown while scrubbing through sources with long GOPs.
+ *
+ * The proxy is MJPEG in Matroska, stored next to the source as
+ * <source>.proxy.mkv. It's written under another name and renamed once
+ * complete, so incomplete proxies are never opened. The content hash and
+ * the modification time of the source are stored in its metadata, proxies
+ * of other versions of the source are generated again.
+ */
+struct proxy_generator {
+    /**
+     * @param filename is the URL of the source, only local files get a
+     * proxy.
+     * @param level is the level of the proxy frames, see frame_key::level.
+     */
+    proxy_generator(const char* filename, unsigned level = 2);
+    ~proxy_generator();
+
+    proxy_generator(const proxy_generator&) = delete;
+    proxy_generator& operator=(const proxy_generator&) = delete;
+
+    /**
+     * @brief ready checks whether the proxy is complete, it may be opened as
+     * a file from then on.
+     */
+    bool ready() const { return complete; }
+
+    // the file name of the proxy, empty for sources which aren't local
+    const std::string path;
+    const unsigned level;
+
+private:
+    void generate();
+    // decodes the source and encodes the proxy into the given file, see
+    // content_hash
+    void write(
+        const char* filename, uint64_t source_hash, int64_t source_time
+    );
+
+    std::string source;
+    std::atomic<bool> complete{false}, stopping{false};
+    std::thread worker;
+};
+
+/**
+ * @brief proxy_path looks up where the proxy of a file is stored.
+ * @param filename is the URL of the source.
+ * @return the file name of the proxy or an empty string if the source is not
+ * a local file.
+ */
+std::string proxy_path(const char* filename);
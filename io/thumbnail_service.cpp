@@ -0,0 +1,99 @@
+#include "thumbnail_service.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+thumbnail_service::thumbnail_service(
+    const char* filename, file* key, uint64_t interval, unsigned level,
+    unsigned thread_count
+) :
+    interval(std::max<uint64_t>(interval, 1)), level(level),
+    filename(filename), pool(thread_count)
+{
+    // files without keyframes can only be decoded from the start
+    std::vector<uint64_t> times = key->keyframes();
+    if (times.empty() || times.front() != 0)
+        times.insert(times.begin(), 0);
+
+    // duration is not known for all containers
+    uint64_t end =
+        key->duration != ~0ull ? key->duration : times.back() + 1;
+    for (uint64_t time = 0; time < end; time += this->interval) {
+        auto after = std::upper_bound(times.begin(), times.end(), time);
+        slots.push_back(*(after - 1));
+    }
+    // GOPs longer than the interval are the thumbnail of several of them
+    keyframes = slots;
+    keyframes.erase(
+        std::unique(keyframes.begin(), keyframes.end()), keyframes.end()
+    );
+
+    size_t decoder_count = std::min<size_t>(
+        pool.thread_count(), keyframes.size()
+    );
+    decoders = decoder_count;
+    for (size_t i = 0; i < decoder_count; i++)
+        pool.submit([this]() { decode_thumbnails(); });
+}
+
+thumbnail_service::~thumbnail_service() {
+    stopping = true;
+    keyframe_decoded.notify_all();
+}
+
+std::shared_ptr<const frame> thumbnail_service::get(uint64_t milliseconds) {
+    if (slots.empty())
+        return nullptr;
+    size_t slot = std::min<uint64_t>(milliseconds / interval, slots.size() - 1);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto thumbnail = thumbnails.find(slots[slot]);
+    if (thumbnail == thumbnails.end())
+        return nullptr;
+    return thumbnail->second;
+}
+
+void thumbnail_service::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    keyframe_decoded.wait(lock, [this]() {
+        return stopping || thumbnails.size() == keyframes.size();
+    });
+}
+
+size_t thumbnail_service::decoded() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return thumbnails.size();
+}
+
+void thumbnail_service::decode_thumbnails() {
+    // exceptions must not leave the task
+    std::unique_ptr<file> video;
+    try {
+        video = std::make_unique<file>(filename.c_str(), level);
+    } catch (std::runtime_error&) {
+        // the other tasks take the thumbnails, the last one to fail marks
+        // them as failed, so wait returns
+        if (--decoders > 0)
+            return;
+    }
+
+    size_t i;
+    while (!stopping && (i = next_keyframe++) < keyframes.size()) {
+        std::shared_ptr<const frame> thumbnail;
+        try {
+            if (video) {
+                thumbnail = std::make_shared<const frame>(
+                    video->get_keyframe(keyframes[i])
+                );
+            }
+        } catch (std::runtime_error&) {
+            // the thumbnail of a broken keyframe stays empty
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            thumbnails[keyframes[i]] = std::move(thumbnail);
+        }
+        keyframe_decoded.notify_all();
+    }
+}
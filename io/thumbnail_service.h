@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <map>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "io.h"
+#include "../utility/thread_pool.h"
+
+/**
+ * @brief thumbnail_service decodes a strip of thumbnails for the timeline as
+ * soon as a file is opened. There is one thumbnail every interval, which is
+ * the keyframe before it, so only keyframes are decoded. Every task of the
+ * thread pool opens a decoder of its own at a reduced level, and they take
+ * the thumbnails in order of time. If none of them can open the file, all
+ * thumbnails stay empty.
+ *
+ * The thumbnails are kept by the service instead of the frame cache, so they
+ * are never evicted. At level 3 a 1080p thumbnail takes up 50 KB, an hour at
+ * one every 10 seconds 18 MB.
+ */
+struct thumbnail_service {
+    /**
+     * @param filename is the file to open in every decoder.
+     * @param key is the file whose keyframes are used, opened already.
+     * @param interval is the time between thumbnails in milliseconds.
+     * @param level is the level of the thumbnails, see frame_key::level.
+     * @param thread_count is the number of decoders.
+     */
+    thumbnail_service(
+        const char* filename, file* key, uint64_t interval = 10000,
+        unsigned level = 3,
+        unsigned thread_count = std::thread::hardware_concurrency()
+    );
+    ~thumbnail_service();
+
+    thumbnail_service(const thumbnail_service&) = delete;
+    thumbnail_service& operator=(const thumbnail_service&) = delete;
+
+    /**
+     * @brief get looks up the thumbnail of the interval the given time is
+     * in.
+     * @param milliseconds is a time in the file.
+     * @return the thumbnail or nullptr if it isn't decoded yet.
+     */
+    std::shared_ptr<const frame> get(uint64_t milliseconds);
+
+    /**
+     * @brief wait returns once all thumbnails are decoded.
+     */
+    void wait();
+
+    // number of intervals, some of them may share one keyframe
+    size_t size() const { return slots.size(); }
+    // number of keyframes decoded so far
+    size_t decoded();
+
+    const uint64_t interval;
+    const unsigned level;
+
+private:
+    void decode_thumbnails();
+
+    std::string filename;
+    // keyframe time of every interval
+    std::vector<uint64_t> slots;
+    // the distinct keyframes of all intervals, in the order they're decoded
+    std::vector<uint64_t> keyframes;
+    std::atomic<size_t> next_keyframe{0};
+    // tasks which opened their decoder or are still opening it
+    std::atomic<size_t> decoders{0};
+    std::atomic<bool> stopping{false};
+
+    std::mutex mutex;
+    std::condition_variable keyframe_decoded;
+    // by keyframe time, frames which failed to decode are nullptr
+    std::map<uint64_t, std::shared_ptr<const frame>> thumbnails;
+
+    // destroyed first, so running tasks finish before the rest
+    thread_pool pool;
+};
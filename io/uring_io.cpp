@@ -0,0 +1,427 @@
+#include "uring_io.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+extern "C" {
+#include <libavformat/avio.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+
+// HAVE_LIBURING is defined by the build when liburing is linked
+#if defined(HAVE_LIBURING) && __has_include(<liburing.h>)
+#define URING_IO
+#endif
+
+#ifdef URING_IO
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <liburing.h>
+#endif
+
+// of all files
+static std::atomic<uint64_t>
+    bytes_read{0}, reads{0}, seeks{0}, submissions{0}, blocks_read{0},
+    hits{0}, waits{0}, misses{0};
+
+#ifdef URING_IO
+
+struct uring_reader {
+    uring_reader(const char* filename);
+    ~uring_reader();
+
+    uring_reader(const uring_reader&) = delete;
+    uring_reader& operator=(const uring_reader&) = delete;
+
+    void prefetch(uint64_t offset, uint64_t length);
+    // returns the number of bytes read or an error code
+    int read(uint64_t offset, uint8_t* buffer, int size);
+
+    uint64_t size;
+
+private:
+    enum struct block_state { empty, pending, ready, failed };
+
+    struct block {
+        uint64_t index = ~0ull;
+        block_state state = block_state::empty;
+        uint32_t length = 0;
+        uint64_t last_used = 0;
+        std::unique_ptr<uint8_t[]> data;
+    };
+
+    // expect mutex to be locked
+    // queues reads of the blocks in [first, last) which aren't in the pool,
+    // returns whether any was queued
+    bool queue(uint64_t first, uint64_t last);
+    void submit();
+    // returns nullptr if the block isn't in the pool
+    block* find(uint64_t index);
+    // returns the least recently used block which isn't being read, nullptr
+    // if all of them are
+    block* evict();
+
+    // runs on its own thread, marks blocks as read
+    void complete();
+
+    static constexpr unsigned queue_depth = 64;
+
+    int descriptor;
+    io_uring ring;
+    // written to wake up the completion thread for stopping
+    int wake;
+    std::mutex mutex;
+    std::condition_variable block_read;
+    std::vector<block> blocks;
+    std::unordered_map<uint64_t, block*> lookup;
+    // incremented on every use of a block
+    uint64_t clock = 0;
+    // entries queued whose completion wasn't seen yet, including those not
+    // submitted to the kernel yet
+    unsigned in_flight = 0;
+    bool stopping = false;
+    std::thread completer;
+};
+
+uring_reader::uring_reader(const char* filename) {
+    descriptor = open(filename, O_RDONLY | O_CLOEXEC);
+    if (descriptor < 0)
+        throw std::runtime_error("Could not open file");
+    struct stat status;
+    if (fstat(descriptor, &status) < 0 || !S_ISREG(status.st_mode)) {
+        close(descriptor);
+        throw std::runtime_error("Not a regular file");
+    }
+    size = status.st_size;
+    // fails e.g. on old kernels or where it's disabled
+    if (io_uring_queue_init(queue_depth, &ring, 0) < 0) {
+        close(descriptor);
+        throw std::runtime_error("Could not set up io_uring");
+    }
+    wake = eventfd(0, EFD_CLOEXEC);
+    if (wake < 0) {
+        io_uring_queue_exit(&ring);
+        close(descriptor);
+        throw std::runtime_error("Could not create an eventfd");
+    }
+    blocks.resize(uring_io::block_count);
+    completer = std::thread(&uring_reader::complete, this);
+}
+
+uring_reader::~uring_reader() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    // the completion thread exits once the reads the kernel took completed,
+    // this doesn't depend on submitting anything to the ring
+    eventfd_write(wake, 1);
+    completer.join();
+    io_uring_queue_exit(&ring);
+    close(wake);
+    close(descriptor);
+}
+
+void uring_reader::prefetch(uint64_t offset, uint64_t length) {
+    if (offset >= size || length == 0)
+        return;
+    // leaves half of the pool to the blocks the demuxers read
+    length = std::min<uint64_t>(
+        length, uring_io::block_count / 2 * uring_io::block_size
+    );
+    uint64_t first = offset / uring_io::block_size;
+    uint64_t last = (offset + length - 1) / uring_io::block_size + 1;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (queue(first, last))
+        submit();
+}
+
+int uring_reader::read(uint64_t offset, uint8_t* buffer, int size) {
+    if (offset >= this->size)
+        return AVERROR_EOF;
+    size = static_cast<int>(std::min<uint64_t>(size, this->size - offset));
+
+    std::unique_lock<std::mutex> lock(mutex);
+    // keeps sequential reads ahead of the demuxer
+    uint64_t first = offset / uring_io::block_size;
+    if (queue(first, first + 1 + uring_io::readahead_blocks))
+        submit();
+
+    int copied = 0;
+    // whether the current block was waited for
+    bool waited = false;
+    while (copied < size) {
+        uint64_t position = offset + copied;
+        uint64_t index = position / uring_io::block_size;
+        size_t block_offset = position % uring_io::block_size;
+        int length = static_cast<int>(std::min<uint64_t>(
+            size - copied, uring_io::block_size - block_offset
+        ));
+
+        // blocks being read aren't evicted
+        block* cached = find(index);
+        if (cached && cached->state == block_state::pending) {
+            if (!waited)
+                waits++;
+            waited = true;
+            // submitting fails if the kernel is short of resources
+            if (io_uring_sq_ready(&ring))
+                submit();
+            block_read.wait_for(lock, std::chrono::milliseconds(10));
+            // once read, other readers may evict the block for another one
+            // while this waits for the lock, so it's looked up again
+            continue;
+        }
+        if (cached && cached->state == block_state::ready && !waited)
+            hits++;
+        waited = false;
+
+        if (!cached || cached->state != block_state::ready) {
+            // all blocks are being read, or reading the block failed
+            if (cached) {
+                lookup.erase(index);
+                cached->index = ~0ull;
+                cached->state = block_state::empty;
+                cached->last_used = 0;
+            }
+            misses++;
+            lock.unlock();
+            ssize_t result =
+                pread(descriptor, buffer + copied, length, position);
+            lock.lock();
+            if (result <= 0)
+                return copied ? copied : AVERROR(EIO);
+            copied += result;
+            continue;
+        }
+
+        std::memcpy(
+            buffer + copied, cached->data.get() + block_offset, length
+        );
+        cached->last_used = ++clock;
+        copied += length;
+    }
+    return copied;
+}
+
+bool uring_reader::queue(uint64_t first, uint64_t last) {
+    last = std::min<uint64_t>(
+        last, (size + uring_io::block_size - 1) / uring_io::block_size
+    );
+    bool queued = false;
+    for (uint64_t index = first; index < last; index++) {
+        // keeps it from being evicted before it's read
+        if (block* cached = find(index)) {
+            cached->last_used = ++clock;
+            continue;
+        }
+        if (in_flight >= queue_depth)
+            break;
+        block* evicted = evict();
+        if (!evicted)
+            break;
+        io_uring_sqe* entry = io_uring_get_sqe(&ring);
+        if (!entry)
+            break;
+
+        if (!evicted->data)
+            evicted->data.reset(new uint8_t[uring_io::block_size]);
+        if (evicted->index != ~0ull)
+            lookup.erase(evicted->index);
+        evicted->index = index;
+        evicted->state = block_state::pending;
+        evicted->length = static_cast<uint32_t>(std::min<uint64_t>(
+            uring_io::block_size, size - index * uring_io::block_size
+        ));
+        evicted->last_used = ++clock;
+        lookup[index] = evicted;
+
+        io_uring_prep_read(
+            entry, descriptor, evicted->data.get(), evicted->length,
+            index * uring_io::block_size
+        );
+        io_uring_sqe_set_data(entry, evicted);
+        in_flight++;
+        queued = true;
+    }
+    return queued;
+}
+
+void uring_reader::submit() {
+    // on failure the entries stay queued and are submitted with the next
+    if (io_uring_submit(&ring) >= 0)
+        submissions++;
+}
+
+uring_reader::block* uring_reader::find(uint64_t index) {
+    auto cached = lookup.find(index);
+    if (cached == lookup.end() || cached->second->index != index)
+        return nullptr;
+    return cached->second;
+}
+
+uring_reader::block* uring_reader::evict() {
+    block* oldest = nullptr;
+    for (auto& block : blocks) {
+        if (block.state == block_state::pending)
+            continue;
+        if (!oldest || block.last_used < oldest->last_used)
+            oldest = &block;
+    }
+    return oldest;
+}
+
+void uring_reader::complete() {
+    while (true) {
+        // the ring is readable while it has completions
+        pollfd events[] = {
+            {.fd = ring.ring_fd, .events = POLLIN},
+            {.fd = wake, .events = POLLIN},
+        };
+        if (poll(events, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        if (events[1].revents & POLLIN) {
+            eventfd_t value;
+            eventfd_read(wake, &value);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            io_uring_cqe* completion;
+            while (io_uring_peek_cqe(&ring, &completion) == 0) {
+                auto completed =
+                    static_cast<block*>(io_uring_cqe_get_data(completion));
+                int length = completion->res;
+                io_uring_cqe_seen(&ring, completion);
+
+                in_flight--;
+                // errors and short reads are read again synchronously
+                bool complete = length == int(completed->length);
+                completed->state =
+                    complete ? block_state::ready : block_state::failed;
+                if (complete)
+                    blocks_read++;
+            }
+            // entries the kernel didn't take yet never are once stopping,
+            // nothing reads into the blocks after the ring is closed
+            if (stopping && in_flight == io_uring_sq_ready(&ring))
+                return;
+        }
+        block_read.notify_all();
+    }
+}
+
+// all uring_io of a file share its reader
+static std::shared_ptr<uring_reader> open_reader(const char* filename) {
+    static std::mutex mutex;
+    static std::map<std::string, std::weak_ptr<uring_reader>> readers;
+
+    std::error_code error;
+    std::string path =
+        std::filesystem::weakly_canonical(filename, error).string();
+    if (error)
+        path = filename;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::erase_if(readers, [](const auto& reader) {
+        return reader.second.expired();
+    });
+    std::shared_ptr<uring_reader> reader = readers[path].lock();
+    if (!reader) {
+        reader = std::make_shared<uring_reader>(filename);
+        readers[path] = reader;
+    }
+    return reader;
+}
+
+#else
+
+struct uring_reader {
+    void prefetch(uint64_t, uint64_t) {}
+    int read(uint64_t, uint8_t*, int) { return AVERROR(ENOSYS); }
+
+    uint64_t size = 0;
+};
+
+static std::shared_ptr<uring_reader> open_reader(const char*) {
+    throw std::runtime_error("io_uring is not supported");
+}
+
+#endif
+
+uring_io::uring_io(const char* filename) : reader(open_reader(filename)) {
+    // the demuxer reads small amounts through this buffer
+    const int buffer_size = 64*1024;
+    auto buffer = static_cast<unsigned char*>(av_malloc(buffer_size));
+    if (!buffer)
+        throw std::bad_alloc();
+    io_context = avio_alloc_context(
+        buffer, buffer_size, 0, this, &uring_io::read, nullptr,
+        &uring_io::seek
+    );
+    if (!io_context) {
+        av_free(buffer);
+        throw std::bad_alloc();
+    }
+}
+
+void uring_io::prefetch(uint64_t offset, uint64_t length) {
+    reader->prefetch(offset, length);
+}
+
+uring_statistics uring_io::statistics() {
+    return {
+        .bytes_read = bytes_read,
+        .reads = reads,
+        .seeks = seeks,
+        .submissions = submissions,
+        .blocks_read = blocks_read,
+        .hits = hits,
+        .waits = waits,
+        .misses = misses,
+    };
+}
+
+int uring_io::read(void* opaque, uint8_t* buffer, int size) {
+    auto& io = *static_cast<uring_io*>(opaque);
+    int result = io.reader->read(io.position, buffer, size);
+    if (result > 0) {
+        io.position += result;
+        bytes_read += result;
+    }
+    reads++;
+    return result;
+}
+
+int64_t uring_io::seek(void* opaque, int64_t offset, int whence) {
+    auto& io = *static_cast<uring_io*>(opaque);
+    int64_t position =
+        seek_position(io.position, io.reader->size, offset, whence);
+    if (position >= 0 && !(whence & AVSEEK_SIZE)) {
+        io.position = position;
+        seeks++;
+    }
+    return position;
+}
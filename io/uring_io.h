@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+
+#include "file_io.h"
+
+struct uring_statistics {
+    uint64_t bytes_read;
+    uint64_t reads; // calls from the demuxer
+    uint64_t seeks;
+    uint64_t submissions; // batches of reads submitted to the kernel
+    uint64_t blocks_read; // by the kernel, in the background
+    // reads from the demuxer, per block touched
+    uint64_t hits; // the block was read already
+    uint64_t waits; // the block was still being read
+    uint64_t misses; // the block was read synchronously
+};
+
+// the blocks of a file, shared by all of its uring_io
+struct uring_reader;
+
+/**
+ * @brief uring_io reads a local file through io_uring, as the AVIOContext of
+ * a demuxer. The file is read in blocks into a pool of buffers, reads of the
+ * demuxer are copies from there. Prefetched ranges are read as one batch of
+ * asynchronous reads, so the demuxer doesn't block once it gets to them,
+ * even on slow network storage.
+ *
+ * While the demuxer reads sequentially, the blocks after the one read are
+ * prefetched as well. The pool is shared by all uring_io of the same file,
+ * so a range prefetched through one of them is read once for all decoders.
+ *
+ * io_uring is only available on Linux, with liburing. Elsewhere the
+ * constructor throws, see open_file_io.
+ */
+struct uring_io : file_io {
+    /**
+     * @param filename is the file name of a local file.
+     */
+    uring_io(const char* filename);
+
+    uring_io(const uring_io&) = delete;
+    uring_io& operator=(const uring_io&) = delete;
+
+    struct AVIOContext* context() const override {
+        return io_context.get();
+    }
+
+    // reads the blocks of the range which aren't in the pool yet
+    void prefetch(uint64_t offset, uint64_t length) override;
+
+    /**
+     * @brief statistics sums up all files read through io_uring so far.
+     */
+    static uring_statistics statistics();
+
+    static constexpr size_t block_size = 1024*1024;
+    // blocks in the pool of a file, allocated when first used
+    static constexpr size_t block_count = 128;
+    // blocks prefetched ahead of sequential reads
+    static constexpr size_t readahead_blocks = 8;
+
+private:
+    static int read(void* opaque, uint8_t* buffer, int size);
+    static int64_t seek(void* opaque, int64_t offset, int whence);
+
+    std::shared_ptr<uring_reader> reader;
+    uint64_t position = 0;
+    unique_av_io_context io_context;
+};
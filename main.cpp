@@ -11,9 +11,17 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "io/io.h"
+#include "io/file_registry.h"
+#include "io/decode_service.h"
+#include "io/thumbnail_service.h"
+#include "io/proxy.h"
+#include "io/mapped_io.h"
+#include "io/uring_io.h"
 #include "ui/ui.h"
 #include "data/frame.h"
 #include "data/frame_cache.h"
+#include "data/spill_file.h"
+#include "data/buffer_pool.h"
 #include "utility/vulkan_resource.h"
 #include "utility/out_ptr.h"
 
@@ -61,8 +69,6 @@ using unique_window = unique_resource<GLFWwindow*, glfw_delete_window>;
 int main() {
     const char* filename = "file:test.mkv";
 
-    file video(filename);
-
     unique_glfw glfw;
 
     unsigned window_width = 1280, window_height = 720;
@@ -245,24 +251,48 @@ int main() {
     std::cout << max_sample_count << std::endl;
 
     ui ui(physical_device, surface.get());
+    // decoders write into memory the GPU copies from
+    set_frame_allocator(ui.staging);
 
-    video.seek(32 * 1000);
+    // every file of the project, only a few decoders are kept open
+    file_registry files;
+    file* video = files.open(filename);
 
     frame_cache cache;
+    // frames evicted in earlier runs are still in there, it holds four times
+    // as much as the memory limit
+    cache.add_spill_file(video, open_spill_file(
+        filename, video->frame_size(), 4 * cache.memory_limit
+    ));
 
-    for (int i = 0; i < 1000; i++) {
-        frame frame = video.get_next_frame();
-        cache.put_frame({&video, frame.time, 0}, std::move(frame));
-    }
+    // scrubbing shows the proxy once it's generated
+    proxy_generator proxy(filename);
+    decode_service decoder(
+        filename, video, cache, std::thread::hardware_concurrency(), 2,
+        &proxy
+    );
+    thumbnail_service thumbnails(filename, video);
 
     while (!glfwWindowShouldClose(window.get())) {
 
         double cursor_x, cursor_y;
         glfwGetCursorPos(window.get(), &cursor_x, &cursor_y);
 
-        auto f = cache.get_frame(
-            { &video, static_cast<uint64_t>(cursor_x * 30 + 32 * 1000), 0 }
-        );
+        auto playhead = static_cast<uint64_t>(cursor_x * 30 + 32 * 1000);
+        decoder.set_playhead(playhead);
+        try {
+            decoder.rethrow_error();
+        } catch (std::runtime_error& e) {
+            // the frames of the broken GOP stay missing
+            std::cerr << "decoding failed: " << e.what() << std::endl;
+        }
+
+        // smaller windows show smaller levels, which take up less memory in
+        // the cache and less time to upload
+        uint32_t level = ui.level_for(video->width, video->height);
+        cache.set_display_level(level);
+
+        auto f = cache.get_frame({ video, playhead, level });
         if (f != nullptr)
             ui.push_frame(*f);
 
@@ -272,13 +302,80 @@ int main() {
         } catch (vulkan_device_lost&) {
             // create a new ui
             {
+                // frames still in its staging pool keep the pool and the
+                // old device until they're dropped
                 ::ui old = std::move(ui); // delete first
             }
             ui = ::ui(physical_device, surface.get());
+            set_frame_allocator(ui.staging);
         }
 
         glfwPollEvents();
     }
 
+    auto statistics = plane_pool().statistics();
+    std::cout <<
+        "plane pool: " << statistics.allocations << " allocations, " <<
+        statistics.reuses << " reuses, " << statistics.allocated_bytes <<
+        " bytes allocated" << std::endl;
+
+    auto cache_statistics = cache.statistics();
+    std::cout <<
+        "frame cache: " << cache_statistics.hits << " hits, " <<
+        cache_statistics.misses << " misses, " <<
+        cache_statistics.compressions << " compressions, " <<
+        cache_statistics.downscales << " downscales, " <<
+        cache_statistics.drops << " drops, " <<
+        cache_statistics.pyramids << " pyramids, " <<
+        cache_statistics.spills << " spills, " <<
+        cache_statistics.restores << " restores" << std::endl;
+
+    auto packet_statistics = decoder.packets->statistics();
+    std::cout <<
+        "packet cache: " << packet_statistics.hits << " hits, " <<
+        packet_statistics.misses << " misses, " <<
+        packet_statistics.evictions << " evictions, " <<
+        packet_statistics.memory_usage << " bytes" << std::endl;
+
+    auto pool_statistics = files.pool->statistics();
+    std::cout <<
+        "decoder pool: " << pool_statistics.decoders << " decoders for " <<
+        files.size() << " files, " << pool_statistics.opens << " opens, " <<
+        pool_statistics.reuses << " reuses, " << pool_statistics.evictions <<
+        " evictions" << std::endl;
+
+    auto mapped_statistics = mapped_io::statistics();
+    std::cout <<
+        "mapped io: " << mapped_statistics.bytes_read << " bytes in " <<
+        mapped_statistics.reads << " reads, " << mapped_statistics.seeks <<
+        " seeks, " << mapped_statistics.advices << " advices, " <<
+        mapped_statistics.minor_faults << " minor and " <<
+        mapped_statistics.major_faults << " major page faults" << std::endl;
+
+    auto ring_statistics = uring_io::statistics();
+    std::cout <<
+        "io_uring: " << ring_statistics.bytes_read << " bytes in " <<
+        ring_statistics.reads << " reads, " << ring_statistics.seeks <<
+        " seeks, " << ring_statistics.blocks_read << " blocks in " <<
+        ring_statistics.submissions << " submissions, " <<
+        ring_statistics.hits << " hits, " << ring_statistics.waits <<
+        " waits, " << ring_statistics.misses << " misses" << std::endl;
+
+    std::cout <<
+        "thumbnails: " << thumbnails.decoded() << " keyframes decoded for " <<
+        thumbnails.size() << " thumbnails" << std::endl;
+
+    if (ui.staging) {
+        auto staging_statistics = ui.staging->statistics();
+        std::cout <<
+            "staging pool: " << staging_statistics.allocations <<
+            " allocations, " << staging_statistics.reuses << " reuses, " <<
+            staging_statistics.failures << " failures, " <<
+            staging_statistics.allocated_bytes << " bytes allocated" <<
+            std::endl;
+    }
+
+    // the pool and its device go before the instance, with the last frame
+    set_frame_allocator(nullptr);
     return 0;
 }
@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <random>
+
+extern "C" {
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixdesc.h>
+}
+
+#include "test.h"
+#include "../io/color_conversion.h"
+#include "../utility/out_ptr.h"
+
+TEST(color_conversion_simd_matches_scalar) {
+    std::mt19937 random(3);
+    pixel_format formats[] = {
+        planar_yuv(1, 1, 8), planar_yuv(1, 0, 8), planar_yuv(0, 0, 8)
+    };
+    for (pixel_format format : formats) {
+        // BT.601 to BT.709 goes through mode::matrix
+        color_conversion conversion(
+            format, AVCOL_SPC_BT470BG, AVCOL_PRI_BT709, AVCOL_TRC_BT709,
+            AVCOL_RANGE_MPEG
+        );
+        EXPECT(conversion.mode == color_conversion::mode::matrix);
+        color_conversion scalar = conversion;
+        scalar.simd = false;
+
+        for (uint16_t width : {1, 15, 16, 17, 129}) {
+            uint16_t height = 37;
+            frame source = allocate_frame(format, width, height);
+            frame copy = allocate_frame(format, width, height);
+            for (unsigned p = 0; p < 3; p++) {
+                size_t size = size_t(source.planes[p].stride) *
+                    format.plane_height(p, height);
+                for (size_t i = 0; i < size; i++)
+                    source.planes[p].data[i] = uint8_t(random());
+                std::memcpy(copy.planes[p].data, source.planes[p].data, size);
+            }
+            frame result = conversion.convert(std::move(source));
+            frame expected = scalar.convert(std::move(copy));
+            for (unsigned p = 0; p < 3; p++) {
+                for (uint32_t y = 0; y < format.plane_height(p, height); y++) {
+                    EXPECT(!std::memcmp(
+                        result.planes[p].data + y * result.planes[p].stride,
+                        expected.planes[p].data + y * expected.planes[p].stride,
+                        format.plane_width(p, width)
+                    ));
+                }
+            }
+        }
+    }
+}
+
+// converts a frame with the colorspace filter, configured like the filter
+// graph decoders fall back to
+static unique_av_frame filter(
+    AVFrame* input, AVColorSpace color_space,
+    AVColorPrimaries color_primaries,
+    AVColorTransferCharacteristic color_transfer_characteristic,
+    AVColorRange color_range
+) {
+    unique_av_filter_graph graph = avfilter_graph_alloc();
+    if (!graph)
+        throw std::bad_alloc();
+    char description[512];
+    std::snprintf(
+        description, sizeof(description),
+        "buffer=video_size=%dx%d:pix_fmt=%d:time_base=1/1000:"
+        "pixel_aspect=1/1,"
+        "colorspace=all=bt709:trc=bt709:format=%s:range=jpeg:"
+        "ispace=%d:iprimaries=%d:itrc=%d:irange=%d,"
+        "buffersink",
+        input->width, input->height, input->format,
+        av_get_pix_fmt_name(AVPixelFormat(input->format)),
+        color_space, color_primaries, color_transfer_characteristic,
+        color_range
+    );
+    unique_av_filter_in_out inputs, outputs;
+    check(avfilter_graph_parse2(
+        graph.get(), description, out_ptr(inputs), out_ptr(outputs)
+    ));
+    check(avfilter_graph_config(graph.get(), nullptr));
+
+    check(av_buffersrc_add_frame(
+        avfilter_graph_get_filter(graph.get(), "Parsed_buffer_0"), input
+    ));
+    unique_av_frame output = av_frame_alloc();
+    if (!output)
+        throw std::bad_alloc();
+    check(av_buffersink_get_frame(
+        avfilter_graph_get_filter(graph.get(), "Parsed_buffersink_2"),
+        output.get()
+    ));
+    return output;
+}
+
+static unsigned sample(const uint8_t* row, uint32_t x, uint8_t sample_size) {
+    if (sample_size == 1)
+        return row[x];
+    return reinterpret_cast<const uint16_t*>(row)[x];
+}
+
+struct filter_case {
+    AVPixelFormat pixel_format;
+    AVColorSpace color_space;
+    AVColorPrimaries color_primaries;
+    AVColorTransferCharacteristic color_transfer_characteristic;
+    AVColorRange color_range;
+    enum color_conversion::mode mode;
+};
+
+TEST(color_conversion_matches_colorspace_filter) {
+    using mode = enum color_conversion::mode;
+    const filter_case cases[] = {
+        {
+            AV_PIX_FMT_YUV420P, AVCOL_SPC_BT709, AVCOL_PRI_BT709,
+            AVCOL_TRC_BT709, AVCOL_RANGE_JPEG, mode::passthrough
+        },
+        {
+            AV_PIX_FMT_YUV420P, AVCOL_SPC_BT709, AVCOL_PRI_BT709,
+            AVCOL_TRC_BT709, AVCOL_RANGE_MPEG, mode::range
+        },
+        {
+            AV_PIX_FMT_YUV422P10, AVCOL_SPC_BT709, AVCOL_PRI_BT709,
+            AVCOL_TRC_BT709, AVCOL_RANGE_MPEG, mode::range
+        },
+        {
+            AV_PIX_FMT_YUV420P, AVCOL_SPC_BT470BG, AVCOL_PRI_BT709,
+            AVCOL_TRC_BT709, AVCOL_RANGE_MPEG, mode::matrix
+        },
+        {
+            AV_PIX_FMT_YUV444P, AVCOL_SPC_SMPTE170M, AVCOL_PRI_BT709,
+            AVCOL_TRC_BT709, AVCOL_RANGE_JPEG, mode::matrix
+        },
+        {
+            AV_PIX_FMT_YUV420P, AVCOL_SPC_BT470BG, AVCOL_PRI_BT470BG,
+            AVCOL_TRC_SMPTE170M, AVCOL_RANGE_MPEG, mode::primaries
+        },
+        {
+            AV_PIX_FMT_YUV420P10, AVCOL_SPC_BT2020_NCL, AVCOL_PRI_BT2020,
+            AVCOL_TRC_BT2020_10, AVCOL_RANGE_MPEG, mode::primaries
+        },
+        {
+            AV_PIX_FMT_YUV444P12, AVCOL_SPC_BT2020_NCL, AVCOL_PRI_BT2020,
+            AVCOL_TRC_BT2020_12, AVCOL_RANGE_MPEG, mode::primaries
+        },
+        {
+            AV_PIX_FMT_YUV422P, AVCOL_SPC_BT709, AVCOL_PRI_BT709,
+            AVCOL_TRC_IEC61966_2_1, AVCOL_RANGE_JPEG, mode::primaries
+        },
+    };
+
+    std::mt19937 random(5);
+    const uint16_t width = 258, height = 146;
+    for (const filter_case& colors : cases) {
+        EXPECT(color_conversion::supported(
+            colors.pixel_format, colors.color_space, colors.color_primaries,
+            colors.color_transfer_characteristic
+        ));
+        pixel_format format;
+        EXPECT(find_pixel_format(colors.pixel_format, format));
+        color_conversion conversion(
+            format, colors.color_space, colors.color_primaries,
+            colors.color_transfer_characteristic, colors.color_range
+        );
+        EXPECT(conversion.mode == colors.mode);
+
+        unique_av_frame input = av_frame_alloc();
+        if (!input)
+            throw std::bad_alloc();
+        input->format = colors.pixel_format;
+        input->width = width;
+        input->height = height;
+        input->pts = 0;
+        check(av_frame_get_buffer(input.get(), 0));
+        frame source = allocate_frame(format, width, height);
+
+        // random samples, every fourth row alternates between the extremes
+        // to cover saturated colors
+        for (unsigned p = 0; p < 3; p++) {
+            for (uint32_t y = 0; y < format.plane_height(p, height); y++) {
+                uint8_t* row = source.planes[p].data +
+                    y * source.planes[p].stride;
+                for (uint32_t x = 0; x < format.plane_width(p, width); x++) {
+                    unsigned value = y % 4 == 0 ?
+                        (x & 1 ? format.maximum() : 0) :
+                        random() % (format.maximum() + 1u);
+                    if (format.sample_size == 1)
+                        row[x] = uint8_t(value);
+                    else
+                        reinterpret_cast<uint16_t*>(row)[x] = uint16_t(value);
+                }
+                std::memcpy(
+                    input->data[p] + y * input->linesize[p], row,
+                    format.plane_width(p, width) * format.sample_size
+                );
+            }
+        }
+
+        unique_av_frame expected = filter(
+            input.get(), colors.color_space, colors.color_primaries,
+            colors.color_transfer_characteristic, colors.color_range
+        );
+        frame result = conversion.convert(std::move(source));
+        EXPECT(expected->format == colors.pixel_format);
+
+        unsigned difference = 0;
+        for (unsigned p = 0; p < 3; p++) {
+            for (uint32_t y = 0; y < format.plane_height(p, height); y++) {
+                const uint8_t* a =
+                    result.planes[p].data + y * result.planes[p].stride;
+                const uint8_t* b =
+                    expected->data[p] + y * expected->linesize[p];
+                for (uint32_t x = 0; x < format.plane_width(p, width); x++) {
+                    difference = std::max<unsigned>(difference, std::abs(
+                        int(sample(a, x, format.sample_size)) -
+                        int(sample(b, x, format.sample_size))
+                    ));
+                }
+            }
+        }
+        EXPECT(difference <= 1);
+    }
+}
@@ -0,0 +1,118 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "../data/frame_cache.h"
+
+// compares the lookups of the frame displayed at a time in the flat
+// frame_timeline of every file with the std::map<frame_key> the cache used
+// before, run it in a release build
+
+static const int file_count = 8;
+static const uint64_t frames_per_file = 20000;
+static const uint32_t frame_duration = 40;
+static const uint32_t levels = 3;
+static const int lookup_count = 4000000;
+
+using frame_map = std::map<frame_key, std::shared_ptr<frame>>;
+
+// the closest cached level at the last time up to the key, preferring
+// larger frames like frame_timeline::get
+static const frame* find_in_map(const frame_map& frames, frame_key key) {
+    auto i = frames.upper_bound({key.file, key.time_stamp, UINT32_MAX});
+    if (i == frames.begin())
+        return nullptr;
+    --i;
+    if (i->first.file != key.file)
+        return nullptr;
+    uint64_t time = i->first.time_stamp;
+    // levels at the time are ordered, walk down to the requested one
+    auto closest = i;
+    while (true) {
+        closest = i;
+        if (i->first.level <= key.level || i == frames.begin())
+            break;
+        --i;
+        if (i->first.file != key.file || i->first.time_stamp != time)
+            break;
+    }
+    if (time + frame_duration <= key.time_stamp)
+        return nullptr;
+    return closest->second.get();
+}
+
+static const frame* find_in_timeline(
+    const std::map<file*, frame_timeline>& timelines, frame_key key
+) {
+    auto timeline = timelines.find(key.file);
+    if (timeline == timelines.end())
+        return nullptr;
+    size_t index = timeline->second.find(key.time_stamp);
+    if (index == size_t(-1))
+        return nullptr;
+    return timeline->second.get(index, key.level).frame.get();
+}
+
+template<typename function>
+static void measure(
+    const char* name, const std::vector<frame_key>& keys, function&& find
+) {
+    auto start = std::chrono::steady_clock::now();
+    size_t found = 0;
+    for (frame_key key : keys)
+        found += find(key) != nullptr;
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::printf(
+        "%-8s %6.1f ns per lookup, %zu found\n", name,
+        elapsed.count() / keys.size(), found
+    );
+}
+
+int main() {
+    // files are only used as keys
+    std::vector<char> files(file_count);
+    auto shared_frame = std::make_shared<frame>();
+    frame_map frames;
+    std::map<file*, frame_timeline> timelines;
+    std::mt19937 random(11);
+    for (char& file_address : files) {
+        file* file = reinterpret_cast<::file*>(&file_address);
+        frame_timeline& timeline = timelines[file];
+        for (uint64_t i = 0; i < frames_per_file; i++) {
+            // about one frame in ten is missing
+            if (random() % 10 == 0)
+                continue;
+            uint64_t time = i * frame_duration;
+            frame_timeline::entry metadata{};
+            metadata.duration = frame_duration;
+            for (uint32_t level = 0; level < levels; level++) {
+                if (random() % 2)
+                    continue;
+                frames.emplace(frame_key{file, time, level}, shared_frame);
+                timeline.insert(
+                    time, level, {shared_frame, nullptr, 0}, metadata
+                );
+            }
+        }
+    }
+
+    std::vector<frame_key> keys(lookup_count);
+    for (frame_key& key : keys) {
+        key.file = reinterpret_cast<file*>(&files[random() % file_count]);
+        key.time_stamp = random() % (frames_per_file * frame_duration);
+        key.level = random() % levels;
+    }
+
+    std::printf("%zu frames in %d files\n", frames.size(), file_count);
+    measure("map", keys, [&](frame_key key) {
+        return find_in_map(frames, key);
+    });
+    measure("timeline", keys, [&](frame_key key) {
+        return find_in_timeline(timelines, key);
+    });
+}
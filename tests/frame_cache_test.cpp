@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "test.h"
+#include "../data/frame_cache.h"
+
+static cached_frame describe(
+    uint32_t level, int64_t playhead_distance, uint64_t age,
+    uint32_t frames_since_keyframe, bool compressed
+) {
+    cached_frame frame{};
+    frame.key.level = level;
+    frame.size = 1000;
+    frame.playhead_distance = playhead_distance;
+    frame.age = age;
+    frame.frames_since_keyframe = frames_since_keyframe;
+    frame.display_level = 1;
+    frame.compressed = compressed;
+    return frame;
+}
+
+TEST(eviction_tiers_are_strict) {
+    playhead_eviction_policy policy;
+    const int64_t other_file = std::numeric_limits<int64_t>::max();
+    // an uncompressed frame at the playhead before a compressed one in
+    // another file, however old
+    EXPECT(
+        policy.score(describe(1, 0, 0, 250, false)) >
+        policy.score(describe(1, other_file, 1000000000, 0, true))
+    );
+    // larger than displayed before everything else, larger first
+    EXPECT(
+        policy.score(describe(0, 0, 0, 250, true)) >
+        policy.score(describe(1, other_file, UINT64_MAX / 2, 0, false))
+    );
+    EXPECT(
+        policy.score(describe(0, 0, 0, 0, true)) >
+        policy.score(describe(1, other_file, 0, 0, false))
+    );
+}
+
+TEST(eviction_within_a_tier) {
+    playhead_eviction_policy policy;
+    // before the playhead counts more than after it
+    EXPECT(
+        policy.score(describe(1, -2000, 0, 0, true)) >
+        policy.score(describe(1, 2000, 0, 0, true))
+    );
+    // other files first
+    EXPECT(
+        policy.score(
+            describe(1, std::numeric_limits<int64_t>::max(), 0, 0, true)
+        ) >
+        policy.score(describe(1, 3600000, 0, 0, true))
+    );
+    EXPECT(
+        policy.score(describe(2, 10000, 0, 0, false)) >
+        policy.score(describe(2, 1000, 0, 0, false))
+    );
+    // frames which weren't looked up for long go first
+    EXPECT(
+        policy.score(describe(1, 1000, 5000, 0, true)) >
+        policy.score(describe(1, 1000, 0, 0, true))
+    );
+    // frames far from their keyframe are kept longer
+    EXPECT(
+        policy.score(describe(1, 1000, 0, 0, true)) >
+        policy.score(describe(1, 1000, 0, 100, true))
+    );
+}
+
+// evicts the frames which weren't looked up for the longest time
+struct lru_eviction_policy : eviction_policy {
+    double score(const cached_frame& frame) const override {
+        return double(frame.age);
+    }
+};
+
+TEST(frames_longer_than_a_bucket) {
+    frame_cache cache;
+    // a still image shown for 3.5 s, then a regular frame
+    frame still = allocate_frame(yuv420p, 2, 2, 0);
+    still.duration = 3500;
+    cache.put_frame({nullptr, 0, 0}, std::move(still));
+    frame next = allocate_frame(yuv420p, 2, 2, 3500);
+    next.duration = 40;
+    cache.put_frame({nullptr, 3500, 0}, std::move(next));
+
+    for (uint64_t time : {0, 999, 1000, 2500, 3499}) {
+        auto found = cache.get_frame({nullptr, time, 0});
+        EXPECT(found && found->time == 0);
+    }
+    auto found = cache.get_frame({nullptr, 3520, 0});
+    EXPECT(found && found->time == 3500);
+    EXPECT(!cache.get_frame({nullptr, 3540, 0}));
+}
+
+// replays scrubbing forward at varying speed, now and then back a little,
+// while a decoder fills the cache ahead of the playhead faster than it
+// moves, and frames which are missed are decoded on the spot
+static uint64_t replay_scrubbing(std::unique_ptr<eviction_policy> policy) {
+    const uint32_t frame_duration = 40;
+    frame_cache cache;
+    cache.policy = std::move(policy);
+    // frames of 1x1 can't be downscaled, evicted ones are dropped
+    cache.compression = false;
+    cache.batch_size = 1;
+    cache.soft_margin = 0;
+    cache.memory_limit = 48 * allocate_frame(yuv420p, 1, 1).size();
+
+    auto put = [&](uint64_t number) {
+        frame frame = allocate_frame(yuv420p, 1, 1, number * frame_duration);
+        frame.duration = frame_duration;
+        cache.put_frame({nullptr, frame.time, 0}, std::move(frame));
+    };
+
+    std::mt19937 random(7);
+    uint64_t playhead = 0, decoded = 0, hits = 0;
+    for (int step = 0; step < 3000; step++) {
+        if (random() % 10 == 0)
+            playhead -= std::min<uint64_t>(playhead, 5 + random() % 26);
+        else
+            playhead += 1 + random() % 3;
+        cache.set_playhead(nullptr, playhead * frame_duration);
+
+        decoded = std::max(decoded, playhead);
+        for (int i = 0; i < 4 && decoded < playhead + 200; i++)
+            put(decoded++);
+
+        if (cache.get_frame({nullptr, playhead * frame_duration, 0}))
+            hits++;
+        else
+            put(playhead);
+    }
+    return hits;
+}
+
+TEST(playhead_eviction_beats_lru_when_scrubbing) {
+    uint64_t lru = replay_scrubbing(std::make_unique<lru_eviction_policy>());
+    uint64_t playhead =
+        replay_scrubbing(std::make_unique<playhead_eviction_policy>());
+    // around 1700 against 1200 hits
+    EXPECT(playhead > lru + lru / 10);
+}
+
+static const uint32_t stress_duration = 40;
+
+// every sample of a plane has the same value, which downscaling and
+// compression keep, so a frame mixing two inserts shows up in any level
+static uint8_t stress_sample(uint64_t time, uint32_t plane) {
+    return uint8_t(time / stress_duration * 31 + plane * 85);
+}
+
+static bool stress_frame_intact(const frame& frame, uint64_t time) {
+    if (frame.time > time || time >= frame.time + frame.duration)
+        return false;
+    // evicted frames are downscaled down to 1x1
+    bool valid_width = false;
+    for (uint32_t level = 0; level < 7; level++)
+        valid_width |= frame.width == 64u >> level;
+    if (!valid_width || frame.height != frame.width)
+        return false;
+    for (auto plane = 0u; plane < frame.format.plane_count; plane++) {
+        uint8_t sample = stress_sample(frame.time, plane);
+        uint16_t width = frame.format.plane_width(plane, frame.width);
+        uint16_t height = frame.format.plane_height(plane, frame.height);
+        for (uint16_t y = 0; y < height; y++) {
+            const uint8_t* row =
+                frame.planes[plane].data + y * frame.planes[plane].stride;
+            for (uint16_t x = 0; x < width; x++) {
+                if (row[x] != sample)
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+// decoders insert overlapping frames while one reader looks them up, and
+// the background thread compresses, downscales and drops them
+TEST(concurrent_inserts_and_lookups) {
+    const uint64_t frame_count = 2000;
+    frame_cache cache;
+    size_t frame_size = allocate_frame(yuv420p, 64, 64).size();
+    cache.memory_limit = 64 * frame_size;
+    cache.soft_margin = 64 * frame_size;
+
+    std::atomic<int> running_decoders = 4;
+    std::vector<std::thread> decoders;
+    for (unsigned seed = 0; seed < 4; seed++) {
+        decoders.emplace_back([&, seed] {
+            // half of the frames overlap with the next decoder
+            std::vector<uint64_t> numbers;
+            for (uint64_t i = 0; i < frame_count / 2; i++)
+                numbers.push_back((seed * frame_count / 4 + i) % frame_count);
+            std::shuffle(numbers.begin(), numbers.end(), std::mt19937(seed));
+            for (uint64_t number : numbers) {
+                uint64_t time = number * stress_duration;
+                frame frame = allocate_frame(yuv420p, 64, 64, time);
+                frame.duration = stress_duration;
+                for (auto plane = 0u; plane < 3; plane++) {
+                    uint16_t width = frame.format.plane_width(plane, 64);
+                    uint16_t height = frame.format.plane_height(plane, 64);
+                    for (uint16_t y = 0; y < height; y++) {
+                        std::fill_n(
+                            frame.planes[plane].data +
+                                y * frame.planes[plane].stride,
+                            width, stress_sample(time, plane)
+                        );
+                    }
+                }
+                cache.put_frame({nullptr, time, 0}, std::move(frame));
+            }
+            running_decoders--;
+        });
+    }
+
+    std::mt19937 random(4);
+    uint64_t lookups = 0, hits = 0;
+    while (running_decoders > 0 || lookups < 10000) {
+        uint64_t time = random() % (frame_count * stress_duration);
+        uint32_t level = random() % 4;
+        cache.set_playhead(nullptr, time);
+        auto frame = cache.get_frame({nullptr, time, level});
+        lookups++;
+        if (frame) {
+            hits++;
+            EXPECT(stress_frame_intact(*frame, time));
+        }
+    }
+    for (auto& decoder : decoders)
+        decoder.join();
+    EXPECT(hits > 0);
+
+    // with everything evicted, nothing may be left accounted for
+    cache.memory_limit = 0;
+    cache.put_frame({nullptr, 0, 0}, allocate_frame(yuv420p, 1, 1));
+    auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (
+        cache.memory_usage > 0 && std::chrono::steady_clock::now() < deadline
+    )
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT(cache.memory_usage == 0);
+}
@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <cstring>
+#include <random>
+
+#include "test.h"
+#include "../data/frame_codec.h"
+
+static void fill(frame& frame, std::mt19937& random) {
+    for (unsigned p = 0; p < frame.format.plane_count; p++) {
+        uint32_t width = frame.format.plane_width(p, frame.width) *
+            frame.format.sample_size;
+        uint32_t height = frame.format.plane_height(p, frame.height);
+        for (uint32_t y = 0; y < height; y++) {
+            uint8_t* row = frame.planes[p].data + y * frame.planes[p].stride;
+            // smooth gradients with noise, so every bit width is used
+            for (uint32_t x = 0; x < width; x++)
+                row[x] = uint8_t(x + y * 3 + p * 50 + random() % 5);
+            if (y % 7 == 0 && width > 0)
+                row[random() % width] = uint8_t(random());
+        }
+    }
+}
+
+static bool same_samples(const frame& a, const frame& b) {
+    if (a.format != b.format || a.width != b.width || a.height != b.height)
+        return false;
+    for (unsigned p = 0; p < a.format.plane_count; p++) {
+        uint32_t width = a.format.plane_width(p, a.width) *
+            a.format.sample_size;
+        for (uint32_t y = 0; y < a.format.plane_height(p, a.height); y++) {
+            if (std::memcmp(
+                a.planes[p].data + y * a.planes[p].stride,
+                b.planes[p].data + y * b.planes[p].stride, width
+            ))
+                return false;
+        }
+    }
+    return true;
+}
+
+TEST(frame_codec_round_trip) {
+    std::mt19937 random(1);
+    pixel_format formats[] = {
+        yuv420p, planar_yuv(1, 0, 10), planar_yuv(0, 0, 16)
+    };
+    uint16_t sizes[][2] = {{1, 1}, {3, 17}, {33, 16}, {640, 360}};
+    for (pixel_format format : formats) {
+        for (auto [width, height] : sizes) {
+            frame source = allocate_frame(format, width, height, 1234);
+            source.duration = 40;
+            fill(source, random);
+            compressed_frame compressed = compress_frame(source);
+            frame result = decompress_frame(compressed);
+            EXPECT(same_samples(source, result));
+            EXPECT(result.time == 1234 && result.duration == 40);
+        }
+    }
+}
+
+TEST(frame_codec_compresses_flat_frames) {
+    frame source = allocate_frame(yuv420p, 256, 256);
+    for (unsigned p = 0; p < 3; p++) {
+        std::memset(
+            source.planes[p].data, 100,
+            source.planes[p].stride * yuv420p.plane_height(p, 256)
+        );
+    }
+    compressed_frame compressed = compress_frame(source);
+    EXPECT(compressed.size() * 10 < source.size());
+    EXPECT(same_samples(source, decompress_frame(compressed)));
+
+    // deeper samples are predicted as a whole, otherwise the low bytes of
+    // rows differing by one step would take up as much as the high ones
+    pixel_format deep = planar_yuv(1, 1, 10);
+    frame deep_source = allocate_frame(deep, 256, 256);
+    for (unsigned p = 0; p < 3; p++) {
+        uint32_t height = deep.plane_height(p, 256);
+        for (uint32_t y = 0; y < height; y++) {
+            auto row = reinterpret_cast<uint16_t*>(
+                deep_source.planes[p].data + y * deep_source.planes[p].stride
+            );
+            std::fill_n(
+                row, deep.plane_width(p, 256), uint16_t(700 + y % 2)
+            );
+        }
+    }
+    compressed = compress_frame(deep_source);
+    EXPECT(compressed.size() * 6 < deep_source.size());
+    EXPECT(same_samples(deep_source, decompress_frame(compressed)));
+}
@@ -0,0 +1,44 @@
+#include <cstdio>
+#include <exception>
+#include <vector>
+
+#include "test.h"
+
+struct registered_test {
+    const char* name;
+    void (*function)();
+};
+
+static std::vector<registered_test>& tests() {
+    static std::vector<registered_test> tests;
+    return tests;
+}
+
+static unsigned failures = 0;
+
+test::test(const char* name, void (*function)()) {
+    tests().push_back({name, function});
+}
+
+void expect_failed(const char* file, int line, const char* condition) {
+    std::printf("%s:%d: expected %s\n", file, line, condition);
+    failures++;
+}
+
+int main() {
+    unsigned failed_tests = 0;
+    for (auto& test : tests()) {
+        unsigned previous = failures;
+        try {
+            test.function();
+        } catch (std::exception& e) {
+            std::printf("%s threw: %s\n", test.name, e.what());
+            failures++;
+        }
+        bool passed = failures == previous;
+        std::printf("%s %s\n", passed ? "passed" : "FAILED", test.name);
+        failed_tests += !passed;
+    }
+    std::printf("%zu tests, %u failed\n", tests().size(), failed_tests);
+    return failed_tests == 0 ? 0 : 1;
+}
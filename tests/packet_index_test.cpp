@@ -0,0 +1,56 @@
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+
+#include "test.h"
+#include "../io/packet_index.h"
+#include "../utility/mapped_file.h"
+
+static int64_t modification_time(const std::string& filename) {
+    return std::filesystem::last_write_time(filename)
+        .time_since_epoch().count();
+}
+
+static void write(const std::string& filename, uint8_t first) {
+    FILE* file = std::fopen(filename.c_str(), "wb");
+    for (int i = 0; i < 4096; i++)
+        std::fputc(i == 0 ? first : i & 255, file);
+    std::fclose(file);
+}
+
+TEST(packet_index_rejects_stale_files) {
+    auto directory = std::filesystem::temp_directory_path();
+    std::string media = (directory / "packet_index_test.bin").string();
+    std::string index = media + ".index";
+    write(media, 0);
+
+    std::vector<packet_entry> entries;
+    for (int i = 0; i < 10; i++)
+        entries.push_back({i * 10, i * 10, i * 100, 100, i % 5 == 0});
+    uint64_t hash = content_hash(media.c_str());
+    int64_t time = modification_time(media);
+    EXPECT(packet_index(std::move(entries)).save(index.c_str(), hash, time));
+
+    packet_index loaded;
+    EXPECT(loaded.load(index.c_str(), hash, time));
+    EXPECT(loaded.size() == 10 && loaded.keyframes.size() == 2);
+    EXPECT(loaded.keyframe_before(35) == 0 && loaded.find(35) == 3);
+
+    // edited in place, the size stays the same, the time is moved so it
+    // differs on file systems with coarse time stamps too
+    auto written = std::filesystem::last_write_time(media);
+    write(media, 1);
+    std::filesystem::last_write_time(media, written + std::chrono::seconds(2));
+    uint64_t edited_hash = content_hash(media.c_str());
+    int64_t edited_time = modification_time(media);
+    EXPECT(edited_hash != hash && edited_time != time);
+    packet_index stale;
+    EXPECT(!stale.load(index.c_str(), edited_hash, edited_time));
+    EXPECT(!stale.load(index.c_str(), hash, edited_time));
+    EXPECT(!stale.load(index.c_str(), edited_hash, time));
+    EXPECT(stale.size() == 0);
+
+    std::filesystem::remove(media);
+    std::filesystem::remove(index);
+}
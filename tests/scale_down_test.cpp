@@ -0,0 +1,55 @@
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "test.h"
+#include "../data/scale_down.h"
+
+// the dispatched version picks the best instruction set of the CPU, which
+// has to round like the scalar one
+template<typename sample>
+static void compare_with_scalar(uint16_t width, uint16_t height) {
+    std::mt19937 random(width * 65536 + height);
+    uint32_t stride = (width + 7) * sizeof(sample);
+    std::vector<uint8_t> source(stride * height);
+    for (auto& byte : source)
+        byte = uint8_t(random());
+    uint16_t result_width = (width + 1) / 2, result_height = (height + 1) / 2;
+    uint32_t result_stride = result_width * sizeof(sample);
+    std::vector<uint8_t> expected(result_stride * result_height);
+    std::vector<uint8_t> result(expected.size());
+
+    scale_down_scalar(
+        reinterpret_cast<const sample*>(source.data()), stride,
+        reinterpret_cast<sample*>(expected.data()), result_stride,
+        width, height
+    );
+    scale_down(
+        reinterpret_cast<const sample*>(source.data()), stride,
+        reinterpret_cast<sample*>(result.data()), result_stride,
+        width, height
+    );
+    EXPECT(expected == result);
+}
+
+TEST(scale_down_matches_scalar) {
+    // covers the tails of every vector width
+    uint16_t widths[] = {1, 2, 15, 16, 31, 32, 63, 64, 65, 127, 128, 1921};
+    for (uint16_t width : widths) {
+        for (uint16_t height : {1, 2, 5}) {
+            compare_with_scalar<uint8_t>(width, height);
+            compare_with_scalar<uint16_t>(width, height);
+        }
+    }
+}
+
+TEST(scale_down_scalar_averages) {
+    uint8_t source[] = {
+        0, 4, 255,
+        2, 5, 255,
+    };
+    uint8_t result[2];
+    scale_down_scalar(source, 3, result, 2, 3, 2);
+    EXPECT(result[0] == 2);
+    EXPECT(result[1] == 255);
+}
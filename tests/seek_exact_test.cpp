@@ -0,0 +1,175 @@
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+#include "test.h"
+#include "../io/io.h"
+#include "../data/frame_cache.h"
+#include "../utility/out_ptr.h"
+
+static const int frame_count = 30;
+static const int frame_duration = 40; // in milliseconds
+
+static void close_output(AVFormatContext** format_context) {
+    avio_closep(&(*format_context)->pb);
+    avformat_free_context(*format_context);
+}
+
+using unique_output_context =
+    unique_resource<AVFormatContext*, close_output>;
+
+// writes all packets the encoder has ready
+static void write_packets(
+    AVCodecContext* encoder, AVFormatContext* format_context,
+    AVPacket* packet
+) {
+    while (true) {
+        int result = avcodec_receive_packet(encoder, packet);
+        if (result == AVERROR(EAGAIN) || result == AVERROR_EOF)
+            return;
+        check(result);
+        packet->duration = frame_duration;
+        packet->stream_index = 0;
+        av_packet_rescale_ts(
+            packet, encoder->time_base, format_context->streams[0]->time_base
+        );
+        check(av_interleaved_write_frame(format_context, packet));
+    }
+}
+
+// MPEG-4 with B-frames, the decoder holds back the last frames until it's
+// drained
+static void write_video(const char* filename) {
+    unique_output_context format_context;
+    check(avformat_alloc_output_context2(
+        out_ptr(format_context), nullptr, "matroska", filename
+    ));
+    AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_MPEG4);
+    if (!codec)
+        throw std::runtime_error("No codec found");
+    unique_av_codec_context encoder = avcodec_alloc_context3(codec);
+    if (!encoder)
+        throw std::bad_alloc();
+    encoder->width = 64;
+    encoder->height = 48;
+    encoder->pix_fmt = AV_PIX_FMT_YUV420P;
+    encoder->time_base = {1, 1000};
+    encoder->gop_size = 12;
+    encoder->max_b_frames = 2;
+    if (format_context->oformat->flags & AVFMT_GLOBALHEADER)
+        encoder->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    check(avcodec_open2(encoder.get(), codec, nullptr));
+
+    AVStream* stream = avformat_new_stream(format_context.get(), nullptr);
+    if (!stream)
+        throw std::bad_alloc();
+    check(avcodec_parameters_from_context(stream->codecpar, encoder.get()));
+    stream->time_base = encoder->time_base;
+    check(avio_open(&format_context->pb, filename, AVIO_FLAG_WRITE));
+    check(avformat_write_header(format_context.get(), nullptr));
+
+    unique_av_frame av_frame = av_frame_alloc();
+    unique_av_packet packet = av_packet_alloc();
+    if (!av_frame || !packet)
+        throw std::bad_alloc();
+    av_frame->format = AV_PIX_FMT_YUV420P;
+    av_frame->width = encoder->width;
+    av_frame->height = encoder->height;
+    check(av_frame_get_buffer(av_frame.get(), 0));
+    for (int i = 0; i < frame_count; i++) {
+        // the encoder may still reference the previous frame
+        check(av_frame_make_writable(av_frame.get()));
+        for (int plane = 0; plane < 3; plane++) {
+            int height = plane == 0 ? av_frame->height : av_frame->height / 2;
+            int width = plane == 0 ? av_frame->width : av_frame->width / 2;
+            for (int y = 0; y < height; y++) {
+                std::memset(
+                    av_frame->data[plane] + y * av_frame->linesize[plane],
+                    plane == 0 ? 16 + i * 7 : 128, width
+                );
+            }
+        }
+        av_frame->pts = i * frame_duration;
+        check(avcodec_send_frame(encoder.get(), av_frame.get()));
+        write_packets(encoder.get(), format_context.get(), packet.get());
+    }
+    check(avcodec_send_frame(encoder.get(), nullptr));
+    write_packets(encoder.get(), format_context.get(), packet.get());
+    check(av_write_trailer(format_context.get()));
+}
+
+TEST(seek_exact_reaches_the_last_frame) {
+    auto directory = std::filesystem::temp_directory_path();
+    std::string filename = (directory / "seek_exact_test.mkv").string();
+    write_video(filename.c_str());
+
+    {
+        // cached frames are keyed by the file, so it outlives the cache
+        file video(filename.c_str());
+        frame_cache cache;
+
+        for (int i = frame_count - 3; i < frame_count; i++) {
+            uint64_t time = i * frame_duration;
+            auto frame = video.seek_exact(time, cache);
+            EXPECT(frame && frame->time == time);
+            EXPECT(cache.get_frame({&video, time, 0}) != nullptr);
+        }
+
+        // every frame comes out of the decoder before the end
+        video.seek(0);
+        uint64_t decoded = 0;
+        try {
+            while (true) {
+                uint64_t time = video.get_next_frame().time;
+                EXPECT(time == decoded++ * frame_duration);
+            }
+        } catch (end_of_file&) {
+        }
+        EXPECT(decoded == frame_count);
+    }
+
+    std::filesystem::remove(filename);
+    std::filesystem::remove(filename + ".index");
+}
+
+TEST(seek_exact_shows_the_frame_before_the_time) {
+    auto directory = std::filesystem::temp_directory_path();
+    std::string filename = (directory / "seek_exact_between.mkv").string();
+    write_video(filename.c_str());
+
+    {
+        file video(filename.c_str());
+        frame_cache cache;
+
+        // between two frames, after seeking
+        uint64_t time = 5 * frame_duration;
+        auto frame = video.seek_exact(time + 10, cache);
+        EXPECT(frame && frame->time == time);
+
+        // between two frames, the decoder stopped at the earlier one
+        time = 6 * frame_duration;
+        frame = video.seek_exact(time + 10, cache);
+        EXPECT(frame && frame->time == time);
+
+        // after the last frame, the decoder stopped at it
+        time = (frame_count - 1) * frame_duration;
+        frame = video.seek_exact(time, cache);
+        EXPECT(frame && frame->time == time);
+        frame = video.seek_exact(time + 10, cache);
+        EXPECT(frame && frame->time == time);
+
+        // long after the last frame, after seeking
+        video.seek(0);
+        frame = video.seek_exact(time + 10000, cache);
+        EXPECT(frame && frame->time == time);
+    }
+
+    std::filesystem::remove(filename);
+    std::filesystem::remove(filename + ".index");
+}
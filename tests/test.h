@@ -0,0 +1,25 @@
+#pragma once
+
+/**
+ * @brief test registers a function with the test runner in main.cpp, use it
+ * through TEST.
+ */
+struct test {
+    test(const char* name, void (*function)());
+};
+
+/**
+ * @brief expect_failed reports a failed EXPECT, the test keeps running.
+ */
+void expect_failed(const char* file, int line, const char* condition);
+
+#define TEST(name) \
+    static void name(); \
+    static test name##_registration(#name, name); \
+    static void name()
+
+#define EXPECT(condition) \
+    do { \
+        if (!(condition)) \
+            expect_failed(__FILE__, __LINE__, #condition); \
+    } while (false)
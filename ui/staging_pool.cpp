@@ -0,0 +1,198 @@
+#include "staging_pool.h"
+
+#include <iterator>
+#include <new>
+#include <vector>
+
+extern "C" {
+#include <libavutil/buffer.h>
+}
+
+#include "ui.h"
+#include "../utility/out_ptr.h"
+
+// copies from the buffers are the only use
+static const VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+staging_pool::allocation::allocation(
+    VkDevice device, uint32_t memory_type, size_t size
+) :
+    device(device), size(size)
+{
+    try {
+        VkBufferCreateInfo create_info = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = size,
+            .usage = usage,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        };
+        check(vkCreateBuffer(device, &create_info, nullptr, &buffer));
+
+        VkMemoryRequirements memory_requirements;
+        vkGetBufferMemoryRequirements(device, buffer, &memory_requirements);
+        VkMemoryAllocateInfo allocate_info = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .allocationSize = memory_requirements.size,
+            .memoryTypeIndex = memory_type,
+        };
+        check(vkAllocateMemory(device, &allocate_info, nullptr, &memory));
+        check(vkBindBufferMemory(device, buffer, memory, 0));
+
+        // mappings are aligned to at least 64 bytes, like frames
+        check(vkMapMemory(
+            device, memory, 0, size, 0, reinterpret_cast<void**>(&data)
+        ));
+    } catch (...) {
+        // the destructor isn't called
+        vkDestroyBuffer(device, buffer, nullptr);
+        vkFreeMemory(device, memory, nullptr);
+        throw;
+    }
+}
+
+staging_pool::allocation::~allocation() {
+    // freeing the memory unmaps it
+    vkDestroyBuffer(device, buffer, nullptr);
+    vkFreeMemory(device, memory, nullptr);
+}
+
+staging_pool::staging_pool(ui& ui, uint32_t memory_type, size_t capacity) :
+    capacity(capacity), device(ui.device), memory_type(memory_type)
+{}
+
+staging_pool::~staging_pool() = default;
+
+uint32_t staging_pool::find_memory_type(ui& ui) {
+    // all buffers with the same usage support the same memory types
+    unique_buffer buffer;
+    VkBufferCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = granularity,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    check(vkCreateBuffer(
+        ui.device.get(), &create_info, nullptr, out_ptr(buffer)
+    ));
+    VkMemoryRequirements memory_requirements;
+    vkGetBufferMemoryRequirements(
+        ui.device.get(), buffer.get(), &memory_requirements
+    );
+
+    VkMemoryPropertyFlags properties =
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+        VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    for (uint32_t i = 0; i < ui.memory_properties.memoryTypeCount; i++) {
+        if (
+            (memory_requirements.memoryTypeBits & (1 << i)) &&
+            (
+                ui.memory_properties.memoryTypes[i].propertyFlags &
+                properties
+            ) == properties
+        ) {
+            return i;
+        }
+    }
+    return -1u;
+}
+
+unique_av_buffer staging_pool::allocate(size_t size) {
+    // frames of the same size share buffers
+    size = (size + granularity - 1) / granularity * granularity;
+
+    allocation* allocated = nullptr;
+    // freed after unlocking
+    std::vector<std::unique_ptr<allocation>> freed;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto reused = unused.find(size);
+        if (reused != unused.end()) {
+            allocated = reused->second;
+            unused.erase(reused);
+            counters.unused_bytes -= size;
+            counters.reuses++;
+        } else {
+            // unused buffers of other sizes make room, largest first
+            while (
+                counters.allocated_bytes + size > capacity && !unused.empty()
+            ) {
+                auto largest = std::prev(unused.end());
+                auto entry = allocations.find(largest->second->data);
+                counters.allocated_bytes -= largest->first;
+                counters.unused_bytes -= largest->first;
+                freed.push_back(std::move(entry->second));
+                allocations.erase(entry);
+                unused.erase(largest);
+            }
+            if (counters.allocated_bytes + size > capacity) {
+                counters.failures++;
+                return nullptr;
+            }
+            // reserved while the memory is allocated
+            counters.allocated_bytes += size;
+        }
+    }
+    freed.clear();
+
+    if (!allocated) {
+        std::unique_ptr<allocation> created;
+        try {
+            created = std::make_unique<allocation>(
+                device.get(), memory_type, size
+            );
+        } catch (std::exception&) {
+            // e.g. the device is out of memory
+            std::lock_guard<std::mutex> lock(mutex);
+            counters.allocated_bytes -= size;
+            counters.failures++;
+            return nullptr;
+        }
+        allocated = created.get();
+        std::lock_guard<std::mutex> lock(mutex);
+        allocations.emplace(allocated->data, std::move(created));
+        counters.allocations++;
+    }
+
+    // released by the buffer
+    allocated->pool = shared_from_this();
+    unique_av_buffer buffer = av_buffer_create(
+        allocated->data, static_cast<int>(size), release, allocated, 0
+    );
+    if (!buffer) {
+        release(allocated, allocated->data);
+        throw std::bad_alloc();
+    }
+    return buffer;
+}
+
+void staging_pool::release(void* opaque, uint8_t*) {
+    auto released = static_cast<allocation*>(opaque);
+    // the last buffer destroys the pool once it's unlocked
+    std::shared_ptr<staging_pool> pool = std::move(released->pool);
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->unused.emplace(released->size, released);
+    pool->counters.unused_bytes += released->size;
+}
+
+bool staging_pool::find(
+    const uint8_t* data, VkBuffer& buffer, VkDeviceSize& offset
+) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // the allocation starting last before the address
+    auto found = allocations.upper_bound(data);
+    if (found == allocations.begin())
+        return false;
+    found--;
+    const allocation& candidate = *found->second;
+    if (data >= candidate.data + candidate.size)
+        return false;
+    buffer = candidate.buffer;
+    offset = data - candidate.data;
+    return true;
+}
+
+staging_pool_statistics staging_pool::statistics() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "../utility/vulkan_resource.h"
+#include "../data/frame.h"
+
+struct ui;
+
+struct staging_pool_statistics {
+    uint64_t allocations; // buffers allocated from the device
+    uint64_t reuses; // buffers handed out again after being released
+    // requests which didn't fit, the decoders used memory of their own
+    uint64_t failures;
+    size_t allocated_bytes; // in use and unused
+    size_t unused_bytes;
+};
+
+/**
+ * @brief staging_pool hands out reference counted buffers in mapped, host
+ * visible memory, for decoders to write their frames into, see
+ * set_frame_allocator. ui::push_frame has the GPU copy frames in there into
+ * the video images, instead of copying their samples on the CPU. It keeps a
+ * reference to the buffers of a frame until the fence of the copy signalled,
+ * so they only return to the pool once the GPU is done with them.
+ *
+ * Every buffer has memory of its own, released ones are kept for buffers of
+ * the same size. Once capacity bytes are allocated, unused buffers of other
+ * sizes are freed to make room, and if there are none allocate fails. It may
+ * be used from any thread. It has to be created with std::make_shared, the
+ * buffers handed out keep the pool and the device alive, even after the ui
+ * is gone.
+ */
+struct staging_pool :
+    frame_allocator, std::enable_shared_from_this<staging_pool>
+{
+    /**
+     * @param memory_type is the index of the memory type to allocate from,
+     * see find_memory_type.
+     * @param capacity is the most memory allocated at once, in bytes.
+     */
+    staging_pool(
+        ui& ui, uint32_t memory_type, size_t capacity = 512 * 1024 * 1024
+    );
+    ~staging_pool() override;
+
+    staging_pool(const staging_pool&) = delete;
+    staging_pool& operator=(const staging_pool&) = delete;
+
+    /**
+     * @brief find_memory_type looks up a memory type for the buffers which is
+     * host visible, coherent and cached. Decoders read their reference frames
+     * back, which is slow from uncached memory.
+     * @return the index of the memory type, or -1u if there is none.
+     */
+    static uint32_t find_memory_type(ui& ui);
+
+    unique_av_buffer allocate(size_t size) override;
+
+    /**
+     * @brief find looks up the buffer which memory at the given address
+     * belongs to.
+     * @param buffer receives the Vulkan buffer.
+     * @param offset receives the offset of the address in it.
+     * @return false if the address isn't in a buffer of the pool.
+     */
+    bool find(const uint8_t* data, VkBuffer& buffer, VkDeviceSize& offset);
+
+    staging_pool_statistics statistics();
+
+    // sizes are rounded up to multiples of this
+    static constexpr size_t granularity = 64 * 1024;
+
+    const size_t capacity;
+
+private:
+    // freed with the device of the pool instead of current_device, the last
+    // reference to a frame may be dropped after the device was replaced
+    struct allocation {
+        allocation(VkDevice device, uint32_t memory_type, size_t size);
+        ~allocation();
+
+        allocation(const allocation&) = delete;
+        allocation& operator=(const allocation&) = delete;
+
+        VkDevice device;
+        // set while the buffer is handed out
+        std::shared_ptr<staging_pool> pool;
+        size_t size;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        uint8_t* data = nullptr;
+    };
+
+    static void release(void* opaque, uint8_t* data);
+
+    // destroyed after the allocations
+    shared_device device;
+    uint32_t memory_type;
+
+    std::mutex mutex;
+    // by the address of their memory
+    std::map<const uint8_t*, std::unique_ptr<allocation>> allocations;
+    // released allocations by size
+    std::multimap<size_t, allocation*> unused;
+    staging_pool_statistics counters{};
+};
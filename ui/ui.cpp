@@ -1,6 +1,12 @@
 #include "ui.h"
 
 #include <vector>
+#include <cstring>
+#include <algorithm>
+
+extern "C" {
+#include <libavutil/buffer.h>
+}
 
 #include "../utility/out_ptr.h"
 
@@ -22,13 +28,33 @@ std::vector<uint8_t> read_file(const char* name) {
     return content;
 }
 
-dynamic_image::dynamic_image(ui &ui, unsigned size) {
+static uint32_t find_host_memory_type(ui& ui, uint32_t memory_type_bits) {
+    VkMemoryPropertyFlags properties =
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    for (uint32_t i = 0; i < ui.memory_properties.memoryTypeCount; i++) {
+        if (
+            (memory_type_bits & (1 << i)) &&
+            (
+                ui.memory_properties.memoryTypes[i].propertyFlags &
+                properties
+            ) == properties
+        ) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+dynamic_image::dynamic_image(
+    ui &ui, unsigned width, unsigned height, VkFormat format
+) : width(width), height(height), format(format) {
     {
-        unsigned width = size, height = size;
         VkImageCreateInfo create_info = {
             .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
             .imageType = VK_IMAGE_TYPE_2D,
-            .format = VK_FORMAT_R8_UNORM,
+            .format = format,
             .extent = {
                 .width = width,
                 .height = height,
@@ -51,28 +77,12 @@ dynamic_image::dynamic_image(ui &ui, unsigned size) {
             ui.device.get(), image.get(), &memory_requirements
         );
 
-        uint32_t memory_type = 0;
-        VkMemoryPropertyFlags properties =
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
-
-        for (uint32_t i = 0; i < ui.memory_properties.memoryTypeCount; i++) {
-            if (
-                (memory_requirements.memoryTypeBits & (1 << i)) &&
-                (
-                    ui.memory_properties.memoryTypes[i].propertyFlags &
-                    properties
-                ) == properties
-            ) {
-                memory_type = i;
-                break;
-            }
-        }
-
         VkMemoryAllocateInfo allocate_info = {
             .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
             .allocationSize = memory_requirements.size,
-            .memoryTypeIndex = memory_type,
+            .memoryTypeIndex = find_host_memory_type(
+                ui, memory_requirements.memoryTypeBits
+            ),
         };
         check(vkAllocateMemory(
             ui.device.get(), &allocate_info, nullptr,
@@ -84,9 +94,20 @@ dynamic_image::dynamic_image(ui &ui, unsigned size) {
         ));
 
         check(vkMapMemory(
-            ui.device.get(), device_memory.get(), 0, width * height, 0,
-            reinterpret_cast<void**>(&buffer)
+            ui.device.get(), device_memory.get(), 0, memory_requirements.size,
+            0, reinterpret_cast<void**>(&buffer)
         ));
+
+        // linear images may have padding at the end of rows
+        VkImageSubresource subresource = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        };
+        VkSubresourceLayout layout;
+        vkGetImageSubresourceLayout(
+            ui.device.get(), image.get(), &subresource, &layout
+        );
+        buffer += layout.offset;
+        row_pitch = static_cast<uint32_t>(layout.rowPitch);
     }
 
     {
@@ -154,7 +175,7 @@ dynamic_image::dynamic_image(ui &ui, unsigned size) {
             .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
             .image = image.get(),
             .viewType = VK_IMAGE_VIEW_TYPE_2D,
-            .format = VK_FORMAT_R8_UNORM,
+            .format = format,
             .subresourceRange = {
                 .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
                 .baseMipLevel = 0,
@@ -170,9 +191,66 @@ dynamic_image::dynamic_image(ui &ui, unsigned size) {
 
 }
 
+host_buffer::host_buffer(
+    ui& ui, VkDeviceSize size, VkBufferUsageFlags usage
+) {
+    VkBufferCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    check(vkCreateBuffer(
+        ui.device.get(), &create_info, nullptr, out_ptr(buffer)
+    ));
+
+    VkMemoryRequirements memory_requirements;
+    vkGetBufferMemoryRequirements(
+        ui.device.get(), buffer.get(), &memory_requirements
+    );
+    VkMemoryAllocateInfo allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = memory_requirements.size,
+        .memoryTypeIndex = find_host_memory_type(
+            ui, memory_requirements.memoryTypeBits
+        ),
+    };
+    check(vkAllocateMemory(
+        ui.device.get(), &allocate_info, nullptr, out_ptr(device_memory)
+    ));
+
+    check(vkBindBufferMemory(
+        ui.device.get(), buffer.get(), device_memory.get(), 0
+    ));
+    check(vkMapMemory(
+        ui.device.get(), device_memory.get(), 0, size, 0, &data
+    ));
+}
+
+upload::upload(ui& ui) {
+    {
+        VkFenceCreateInfo create_info = {
+            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+            .flags = VK_FENCE_CREATE_SIGNALED_BIT,
+        };
+        check(vkCreateFence(
+            ui.device.get(), &create_info, nullptr, out_ptr(fence)
+        ));
+    }
+
+    VkCommandBufferAllocateInfo allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = ui.command_pool.get(),
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+    check(vkAllocateCommandBuffers(
+        ui.device.get(), &allocate_info, &command_buffer
+    ));
+}
+
 void create_shader(
-    unique_device& device, const char* name,
-    unique_shader_module& module
+    VkDevice device, const char* name, unique_shader_module& module
 ) {
     auto code = read_file(name);
     VkShaderModuleCreateInfo create_info = {
@@ -182,7 +260,7 @@ void create_shader(
     };
 
     check(vkCreateShaderModule(
-        device.get(), &create_info, nullptr, out_ptr(module)
+        device, &create_info, nullptr, out_ptr(module)
     ));
 }
 
@@ -483,9 +561,11 @@ ui::ui(
             .pEnabledFeatures = &device_features
         };
 
+        unique_device created;
         check(vkCreateDevice(
-            physical_device, &create_info, nullptr, out_ptr(device)
+            physical_device, &create_info, nullptr, out_ptr(created)
         ));
+        device = std::move(created);
     }
     current_device = device.get();
 
@@ -530,8 +610,10 @@ ui::ui(
     }
 
     {
+        // the command buffers of uploads are recorded for every frame
         VkCommandPoolCreateInfo create_info{
             .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
             .queueFamilyIndex = graphics_queue_family,
         };
         check(vkCreateCommandPool(
@@ -541,19 +623,44 @@ ui::ui(
 
     unique_shader_module video_vertex, video_fragment;
     create_shader(
-        device, "ui/video_vertex.glsl.spv", video_vertex
+        device.get(), "ui/video_vertex.glsl.spv", video_vertex
     );
     create_shader(
-        device, "ui/video_fragment.glsl.spv", video_fragment
+        device.get(), "ui/video_fragment.glsl.spv", video_fragment
     );
 
     vkGetPhysicalDeviceMemoryProperties(
         physical_device, &memory_properties
     );
 
-    video_y = dynamic_image(*this, 1024);
-    video_cb = dynamic_image(*this, 512);
-    video_cr = dynamic_image(*this, 512);
+    {
+        // R16_UNORM is optional for linear images
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(
+            physical_device, VK_FORMAT_R16_UNORM, &properties
+        );
+        VkFormatFeatureFlags features =
+            VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+            VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        sample_16_bit =
+            (properties.linearTilingFeatures & features) == features;
+    }
+
+    {
+        uint32_t memory_type = staging_pool::find_memory_type(*this);
+        if (memory_type != -1u)
+            staging = std::make_shared<staging_pool>(*this, memory_type);
+        for (auto& upload : uploads)
+            upload = ::upload(*this);
+    }
+
+    video_parameters = host_buffer(
+        *this, sizeof(::video_parameters),
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
+    );
+    *static_cast<::video_parameters*>(video_parameters.data) = {
+        {0, 0}, {0, 0}, 1, 128 / 255.0f
+    };
 
     {
         auto descriptor_set_layout_binding = {
@@ -572,6 +679,12 @@ ui::ui(
                 .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
                 .descriptorCount = 1,
                 .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+            }, {
+                .binding = 3,
+                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                .descriptorCount = 1,
+                .stageFlags =
+                    VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
             },
         };
         VkDescriptorSetLayoutCreateInfo create_info = {
@@ -587,15 +700,20 @@ ui::ui(
     }
 
     {
-        VkDescriptorPoolSize pool_size = {
-            .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-            .descriptorCount = 1,
+        auto pool_sizes = {
+            VkDescriptorPoolSize{
+                .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                .descriptorCount = 3,
+            }, {
+                .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                .descriptorCount = 1,
+            },
         };
         VkDescriptorPoolCreateInfo create_info = {
             .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
             .maxSets = 1,
-            .poolSizeCount = 1,
-            .pPoolSizes = &pool_size,
+            .poolSizeCount = static_cast<uint32_t>(pool_sizes.size()),
+            .pPoolSizes = pool_sizes.begin(),
         };
         check(vkCreateDescriptorPool(
             device.get(), &create_info, nullptr, out_ptr(descriptor_pool))
@@ -631,36 +749,30 @@ ui::ui(
     }
 
     {
-        auto descriptor_buffer_info = {
-            VkDescriptorImageInfo{
-                .sampler = video_sampler.get(),
-                .imageView = video_y.image_view.get(),
-                .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
-            }, {
-                .sampler = video_sampler.get(),
-                .imageView = video_cb.image_view.get(),
-                .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
-            }, {
-                .sampler = video_sampler.get(),
-                .imageView = video_cr.image_view.get(),
-                .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
-            },
+        VkDescriptorBufferInfo parameters_buffer_info = {
+            .buffer = video_parameters.buffer.get(),
+            .offset = 0,
+            .range = sizeof(::video_parameters),
         };
-        VkWriteDescriptorSet write_descriptor_set = {
-            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet = descriptor_set,
-            .dstBinding = 0,
-            .dstArrayElement = 0,
-            .descriptorCount =
-                static_cast<uint32_t>(descriptor_buffer_info.size()),
-            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-            .pImageInfo = descriptor_buffer_info.begin(),
+        auto write_descriptor_sets = {
+            VkWriteDescriptorSet{
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = descriptor_set,
+                .dstBinding = 3,
+                .dstArrayElement = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                .pBufferInfo = &parameters_buffer_info,
+            },
         };
         vkUpdateDescriptorSets(
-            device.get(), 1, &write_descriptor_set, 0, nullptr
+            device.get(), static_cast<uint32_t>(write_descriptor_sets.size()),
+            write_descriptor_sets.begin(), 0, nullptr
         );
     }
 
+    create_video_images(VK_FORMAT_R8_UNORM);
+
     {
         VkPipelineLayoutCreateInfo create_info = {
             .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
@@ -816,37 +928,262 @@ ui::ui(
     view = ::view(*this);
 }
 
+void ui::create_video_images(VkFormat format) {
+    // chroma images are as large as luma, for 4:4:4
+    const unsigned size = 1024;
+    video_y = dynamic_image(*this, size, size, format);
+    video_cb = dynamic_image(*this, size, size, format);
+    video_cr = dynamic_image(*this, size, size, format);
+
+    auto descriptor_buffer_info = {
+        VkDescriptorImageInfo{
+            .sampler = video_sampler.get(),
+            .imageView = video_y.image_view.get(),
+            .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+        }, {
+            .sampler = video_sampler.get(),
+            .imageView = video_cb.image_view.get(),
+            .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+        }, {
+            .sampler = video_sampler.get(),
+            .imageView = video_cr.image_view.get(),
+            .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+        },
+    };
+    VkWriteDescriptorSet write_descriptor_set = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = descriptor_set,
+        .dstBinding = 0,
+        .dstArrayElement = 0,
+        .descriptorCount =
+            static_cast<uint32_t>(descriptor_buffer_info.size()),
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo = descriptor_buffer_info.begin(),
+    };
+    vkUpdateDescriptorSets(device.get(), 1, &write_descriptor_set, 0, nullptr);
+}
+
 void ui::push_frame(const frame &f) {
-    uint8_t* source_row = f.pixels.y.get();
-    uint8_t* destination_row = video_y.buffer;
-    for (auto y = 0u; y < f.height; y++) {
-        std::move(
-            source_row, source_row + f.width,
-            destination_row
-        );
-        source_row += f.width;
-        destination_row += 1024; // TODO
-    }
-    source_row = f.pixels.cb.get();
-    destination_row = video_cb.buffer;
-    for (auto y = 0u; y < f.height / 2; y++) {
-        std::move(
-            source_row, source_row + f.width / 2,
-            destination_row
-        );
-        source_row += f.width / 2;
-        destination_row += 512; // TODO
-    }
-    source_row = f.pixels.cr.get();
-    destination_row = video_cr.buffer;
-    for (auto y = 0u; y < f.height / 2; y++) {
-        std::move(
-            source_row, source_row + f.width / 2,
-            destination_row
+    // 16 bit images are kept for all frames from then on, so switching
+    // between sources of different depths doesn't create them every time
+    bool deep = f.format.sample_size == 2 && sample_16_bit;
+    if (deep && video_y.format != VK_FORMAT_R16_UNORM) {
+        // the images may still be read by the GPU
+        check(vkDeviceWaitIdle(device.get()));
+        create_video_images(VK_FORMAT_R16_UNORM);
+        // updating the descriptor set invalidates the command buffers using
+        // it, they are recorded again with the view
+        view = {};
+        view = ::view(*this);
+    }
+    unsigned image_sample_size =
+        video_y.format == VK_FORMAT_R16_UNORM ? 2 : 1;
+
+    // frames larger than the images are cropped
+    uint16_t frame_width = std::min<uint32_t>(f.width, video_y.width);
+    uint16_t frame_height = std::min<uint32_t>(f.height, video_y.height);
+    // the GPU can't change the size of samples
+    if (
+        f.format.sample_size != image_sample_size ||
+        !upload_frame(f, frame_width, frame_height)
+    )
+        copy_frame(f, frame_width, frame_height);
+
+    // images return the samples divided by their maximum, 255 or 65535
+    bool reduced = f.format.sample_size > image_sample_size;
+    float maximum = reduced ? 255 : f.format.maximum();
+    float neutral = reduced ? 128 : 1 << (f.format.bit_depth - 1);
+    float image_maximum = image_sample_size == 2 ? 65535 : 255;
+    // smaller levels cover less of the images, subsampled chroma even less
+    float scale[2] = {
+        float(frame_width) / video_y.width,
+        float(frame_height) / video_y.height
+    };
+    *static_cast<::video_parameters*>(video_parameters.data) = {
+        {scale[0], scale[1]},
+        {
+            scale[0] / (1 << f.format.chroma_shift_x),
+            scale[1] / (1 << f.format.chroma_shift_y)
+        },
+        image_maximum / maximum,
+        neutral / maximum,
+    };
+}
+
+bool ui::upload_frame(const frame& f, uint16_t width, uint16_t height) {
+    if (!staging)
+        return false;
+    VkBuffer buffers[3];
+    VkDeviceSize offsets[3];
+    for (auto plane = 0u; plane < f.format.plane_count; plane++) {
+        const uint8_t* data = f.planes[plane].data;
+        if (!staging->find(data, buffers[plane], offsets[plane]))
+            return false;
+        // copies start at multiples of 4 bytes
+        if (offsets[plane] % 4)
+            return false;
+    }
+
+    // the frame of the upload's last copy is released once the GPU is done
+    // with it
+    upload& upload = uploads[next_upload];
+    next_upload = (next_upload + 1) % upload_count;
+    check(vkWaitForFences(
+        device.get(), 1, &upload.fence.get(), VK_TRUE, ~0ul
+    ));
+    for (auto i = 0u; i < std::size(upload.buffers); i++) {
+        upload.buffers[i] =
+            f.buffers[i] ? av_buffer_ref(f.buffers[i].get()) : nullptr;
+        if (f.buffers[i] && !upload.buffers[i])
+            throw std::bad_alloc();
+    }
+
+    VkCommandBuffer command_buffer = upload.command_buffer;
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    check(vkBeginCommandBuffer(command_buffer, &begin_info));
+
+    // the copies wait for the draws still reading the images
+    vkCmdPipelineBarrier(
+        command_buffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr
+    );
+
+    dynamic_image* images[] = { &video_y, &video_cb, &video_cr };
+    for (auto plane = 0u; plane < f.format.plane_count; plane++) {
+        VkBufferImageCopy region = {
+            .bufferOffset = offsets[plane],
+            // in samples
+            .bufferRowLength = f.planes[plane].stride / f.format.sample_size,
+            .bufferImageHeight = 0,
+            .imageSubresource = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = 0,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+            .imageOffset = {0, 0, 0},
+            .imageExtent = {
+                .width = f.format.plane_width(plane, width),
+                .height = f.format.plane_height(plane, height),
+                .depth = 1,
+            },
+        };
+        vkCmdCopyBufferToImage(
+            command_buffer, buffers[plane], images[plane]->image.get(),
+            VK_IMAGE_LAYOUT_GENERAL, 1, &region
         );
-        source_row += f.width / 2;
-        destination_row += 512; // TODO
     }
+
+    // and the following draws for the copies
+    VkMemoryBarrier memory_barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+    };
+    vkCmdPipelineBarrier(
+        command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &memory_barrier, 0,
+        nullptr, 0, nullptr
+    );
+
+    check(vkEndCommandBuffer(command_buffer));
+
+    // writes of the decoders are visible to the GPU once submitted
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &command_buffer,
+    };
+    check(vkResetFences(device.get(), 1, &upload.fence.get()));
+    check(vkQueueSubmit(
+        graphics_queue, 1, &submit_info, upload.fence.get()
+    ));
+    return true;
+}
+
+void ui::copy_frame(
+    const frame& f, uint16_t frame_width, uint16_t frame_height
+) {
+    // copies of the GPU which are still pending would overwrite the frame
+    VkFence fences[upload_count];
+    for (auto i = 0u; i < upload_count; i++)
+        fences[i] = uploads[i].fence.get();
+    check(vkWaitForFences(
+        device.get(), upload_count, fences, VK_TRUE, ~0ul
+    ));
+    // the frames of all uploads can go back to the staging pool
+    for (auto& upload : uploads) {
+        for (auto& buffer : upload.buffers)
+            buffer = nullptr;
+    }
+
+    dynamic_image* images[] = { &video_y, &video_cb, &video_cr };
+    unsigned image_sample_size =
+        video_y.format == VK_FORMAT_R16_UNORM ? 2 : 1;
+    for (auto plane = 0u; plane < f.format.plane_count; plane++) {
+        const frame::plane& source = f.planes[plane];
+        dynamic_image& destination = *images[plane];
+        uint32_t width = f.format.plane_width(plane, frame_width);
+        uint32_t height = f.format.plane_height(plane, frame_height);
+
+        if (f.format.sample_size != image_sample_size) {
+            // samples are reduced to 8 bits or widened to 16 bits
+            unsigned shift = f.format.bit_depth - 8;
+            for (auto y = 0u; y < height; y++) {
+                uint8_t* source_row = source.data + size_t(y) * source.stride;
+                uint8_t* destination_row =
+                    destination.buffer + size_t(y) * destination.row_pitch;
+                if (image_sample_size == 1) {
+                    auto in = reinterpret_cast<const uint16_t*>(source_row);
+                    for (auto x = 0u; x < width; x++)
+                        destination_row[x] = in[x] >> shift;
+                } else {
+                    auto out = reinterpret_cast<uint16_t*>(destination_row);
+                    for (auto x = 0u; x < width; x++)
+                        out[x] = source_row[x];
+                }
+            }
+            continue;
+        }
+
+        uint32_t bytes = width * f.format.sample_size;
+        if (source.stride == destination.row_pitch) {
+            // same layout, copy the whole plane at once
+            std::memcpy(
+                destination.buffer, source.data,
+                source.stride * (height - 1) + bytes
+            );
+            continue;
+        }
+
+        uint8_t* source_row = source.data;
+        uint8_t* destination_row = destination.buffer;
+        for (auto y = 0u; y < height; y++) {
+            std::memcpy(destination_row, source_row, bytes);
+            source_row += source.stride;
+            destination_row += destination.row_pitch;
+        }
+    }
+
+}
+
+uint32_t ui::level_for(uint16_t width, uint16_t height) const {
+    // the frame is stretched over the whole window
+    double shown_width = view.extent.width * zoom;
+    double shown_height = view.extent.height * zoom;
+    uint32_t level = 0;
+    // every level halves both dimensions, stop before either gets smaller
+    // than shown
+    while (
+        level + 1 < 16 &&
+        (width >> (level + 1)) >= shown_width &&
+        (height >> (level + 1)) >= shown_height
+    )
+        level++;
+    return level;
 }
 
 void ui::render() {
@@ -4,6 +4,7 @@
 
 #include "../utility/vulkan_resource.h"
 #include "../data/frame.h"
+#include "staging_pool.h"
 
 struct image;
 struct view;
@@ -40,31 +41,111 @@ struct view {
 
 struct dynamic_image {
     dynamic_image() = default;
-    dynamic_image(ui& ui, unsigned size);
+    dynamic_image(ui& ui, unsigned width, unsigned height, VkFormat format);
 
     unique_device_memory device_memory;
     unique_image image;
     unique_image_view image_view;
     uint8_t* buffer;
+    uint32_t row_pitch;
+    uint32_t width, height;
+    VkFormat format;
+};
+
+/**
+ * @brief host_buffer is a buffer in memory the host writes to directly.
+ */
+struct host_buffer {
+    host_buffer() = default;
+    host_buffer(ui& ui, VkDeviceSize size, VkBufferUsageFlags usage);
+
+    unique_device_memory device_memory;
+    unique_buffer buffer;
+    void* data;
+};
+
+/**
+ * @brief upload is a copy of a frame from the staging pool into the video
+ * images, done by the GPU.
+ */
+struct upload {
+    upload() = default;
+    upload(ui& ui);
+
+    // the buffers of the frame, kept until the fence signalled, so the pool
+    // doesn't hand them out again while the GPU reads them
+    unique_av_buffer buffers[3];
+    unique_fence fence;
+    VkCommandBuffer command_buffer;
+};
+
+// layout of the uniform buffer of the video shaders
+struct video_parameters {
+    float scale[2]; // part of the images covered by the frame
+    float chroma_scale[2]; // the same for the chroma images
+    // maps the sampled values to [0, 1], for samples of fewer than 16 bits in
+    // 16 bit images
+    float sample_scale;
+    float chroma_offset; // the scaled value of neutral chroma
 };
 
 struct ui {
     ui() = default;
     ui(VkPhysicalDevice physical_device, VkSurfaceKHR surface);
 
+    /**
+     * @brief push_frame copies a frame into the images shown. They fit any
+     * subsampling, and are created again as 16 bit images for the first
+     * frame of more than 8 bits. Frames in the staging pool are copied by
+     * the GPU, others by the CPU.
+     */
     void push_frame(const frame& f);
     void render();
 
+    /**
+     * @brief level_for works out the frame_key::level which has enough
+     * detail to show a frame of the given size in the window.
+     * @param width is the width of the frame at level 0.
+     * @param height is the height of the frame at level 0.
+     * @return the level, 0 if the frame is shown at full size or larger.
+     */
+    uint32_t level_for(uint16_t width, uint16_t height) const;
+
     VkPhysicalDevice physical_device;
     VkSurfaceKHR surface;
 
-    unique_device device;
+    // shared with the staging pool, its buffers may outlive the ui
+    shared_device device;
     VkQueue graphics_queue, present_queue;
     unique_command_pool command_pool;
 
+    // decoders write their frames into it, nullptr if the device has no
+    // memory the host reads fast
+    std::shared_ptr<staging_pool> staging;
+    // used in turns, the frames of the oldest one are released when it's
+    // used again
+    static constexpr unsigned upload_count = 2;
+    upload uploads[upload_count];
+    unsigned next_upload = 0;
+
+    // (re)creates the video images in the given format and binds them to
+    // the descriptor set
+    void create_video_images(VkFormat format);
+
     dynamic_image video_y;
     dynamic_image video_cb;
     dynamic_image video_cr;
+    // whether 16 bit images can be sampled, otherwise samples of more than 8
+    // bits are reduced to 8 bits while copying
+    bool sample_16_bit = false;
+    // copies a frame in the staging pool into the images on the GPU,
+    // cropped to the given size, returns false for frames which aren't
+    bool upload_frame(const frame& f, uint16_t width, uint16_t height);
+    // the same on the CPU, for all other frames
+    void copy_frame(
+        const frame& f, uint16_t frame_width, uint16_t frame_height
+    );
+    host_buffer video_parameters;
 
     unique_sampler video_sampler;
 
@@ -80,6 +161,8 @@ struct ui {
     unique_semaphore swapchain_image_ready_semaphore;
 
     view view;
+    // 1 fits the frame to the window, larger values zoom in
+    float zoom = 1;
 
     uint32_t graphics_queue_family = -1u, present_queue_family = -1u;
     VkSurfaceFormatKHR surface_format;
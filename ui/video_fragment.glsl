@@ -2,6 +2,7 @@
 #pragma shader_stage(fragment)
 
 layout(location = 0) in vec2 vertex_source;
+layout(location = 1) in vec2 vertex_chroma_source;
 
 layout(location = 0) out vec4 fragment_color;
 
@@ -9,11 +10,22 @@ layout(binding = 0) uniform sampler2D source_texture_y;
 layout(binding = 1) uniform sampler2D source_texture_cb;
 layout(binding = 2) uniform sampler2D source_texture_cr;
 
+// see video_parameters in ui.h
+layout(binding = 3) uniform video_parameters {
+    vec2 scale;
+    vec2 chroma_scale;
+    // R16_UNORM images hold samples of fewer bits unscaled
+    float sample_scale;
+    float chroma_offset;
+};
+
 void main() {
     vec3 color = vec3(
-        texture(source_texture_y, vertex_source).r,
-        texture(source_texture_cb, vertex_source).r - 0.5,
-        texture(source_texture_cr, vertex_source).r - 0.5
+        texture(source_texture_y, vertex_source).r * sample_scale,
+        texture(source_texture_cb, vertex_chroma_source).r * sample_scale -
+            chroma_offset,
+        texture(source_texture_cr, vertex_chroma_source).r * sample_scale -
+            chroma_offset
     ) * mat3(
         1.0, 0.0, 1.5748,
         1.0, -0.1873, -0.4681,
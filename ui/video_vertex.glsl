@@ -2,6 +2,15 @@
 #pragma shader_stage(vertex)
 
 layout(location = 0) out vec2 vertex_source;
+layout(location = 1) out vec2 vertex_chroma_source;
+
+// see video_parameters in ui.h
+layout(binding = 3) uniform video_parameters {
+    vec2 scale;
+    vec2 chroma_scale;
+    float sample_scale;
+    float chroma_offset;
+};
 
 vec2 positions[6] = vec2[](
     vec2(0.0, 0.0),
@@ -17,5 +26,6 @@ void main() {
         positions[gl_VertexIndex] * 2.0 - 1.0,
         0.0, 1.0
     );
-    vertex_source = positions[gl_VertexIndex] * vec2(720, 480) / vec2(1024);
+    vertex_source = positions[gl_VertexIndex] * scale;
+    vertex_chroma_source = positions[gl_VertexIndex] * chroma_scale;
 }
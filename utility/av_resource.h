@@ -8,6 +8,11 @@ extern "C" {
 #include <libavutil/avutil.h>
 }
 
+// AVERROR_EOF, the demuxer or decoder has no more output
+struct end_of_file : public std::runtime_error {
+    end_of_file() : std::runtime_error("No more output") {}
+};
+
 // TODO: find a better place for check?
 inline int check(int code) {
     if (code >= 0)
@@ -15,7 +20,7 @@ inline int check(int code) {
     if (code == AVERROR(EAGAIN)) {
         throw std::runtime_error("Output is not available, send new input");
     } else if (code == AVERROR_EOF) {
-        throw std::runtime_error("No more output");
+        throw end_of_file();
     } else if (code == AVERROR(EINVAL)) {
         throw std::runtime_error("Not opened");
     } else if (code == AVERROR_INPUT_CHANGED) {
@@ -27,16 +32,20 @@ inline int check(int code) {
 extern "C" {
 void avformat_close_input(struct AVFormatContext**);
 void avcodec_free_context(struct AVCodecContext**);
+void avcodec_parameters_free(struct AVCodecParameters**);
 void av_frame_free(struct AVFrame**);
 void av_packet_free(struct AVPacket**);
 void avfilter_inout_free(struct AVFilterInOut**);
 void avfilter_graph_free(struct AVFilterGraph**);
+void av_buffer_unref(struct AVBufferRef**);
 }
 
 using unique_av_format_context =
     unique_resource<struct AVFormatContext*, avformat_close_input>;
 using unique_av_codec_context =
     unique_resource<AVCodecContext*, avcodec_free_context>;
+using unique_av_codec_parameters =
+    unique_resource<AVCodecParameters*, avcodec_parameters_free>;
 using unique_av_frame =
     unique_resource<AVFrame*, av_frame_free>;
 using unique_av_packet =
@@ -45,3 +54,5 @@ using unique_av_filter_in_out =
     unique_resource<AVFilterInOut*, avfilter_inout_free>;
 using unique_av_filter_graph =
     unique_resource<AVFilterGraph*, avfilter_graph_free>;
+using unique_av_buffer =
+    unique_resource<AVBufferRef*, av_buffer_unref>;
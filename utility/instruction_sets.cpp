@@ -0,0 +1,39 @@
+#include "instruction_sets.h"
+
+#if defined(INSTRUCTION_SETS_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+instruction_sets detect_instruction_sets() {
+#ifndef INSTRUCTION_SETS_X86
+    return {false, false, false};
+#elif defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    int highest = info[0];
+    __cpuid(info, 1);
+    bool os_saves_avx =
+        (info[2] & (1 << 27)) && // OSXSAVE
+        (_xgetbv(0) & 0x6) == 0x6;
+    bool os_saves_avx512 = os_saves_avx && (_xgetbv(0) & 0xe6) == 0xe6;
+    bool sse2 = info[3] & (1 << 26);
+    bool avx2 = false, avx512 = false;
+    if (highest >= 7) {
+        __cpuidex(info, 7, 0);
+        avx2 = os_saves_avx && (info[1] & (1 << 5));
+        avx512 =
+            os_saves_avx512 &&
+            (info[1] & (1 << 16)) && // AVX512F
+            (info[1] & (1 << 30)); // AVX512BW
+    }
+    return {sse2, avx2, avx512};
+#else
+    __builtin_cpu_init();
+    bool sse2 = __builtin_cpu_supports("sse2");
+    bool avx2 = __builtin_cpu_supports("avx2");
+    bool avx512 =
+        __builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512bw");
+    return {sse2, avx2, avx512};
+#endif
+}
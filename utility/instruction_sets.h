@@ -0,0 +1,29 @@
+#pragma once
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#define INSTRUCTION_SETS_X86
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+// MSVC allows intrinsics of all instruction sets in any function
+#define TARGET(instruction_set)
+#else
+#define TARGET(instruction_set) __attribute__((target(instruction_set)))
+#endif
+
+/**
+ * @brief instruction_sets lists the x86 extensions kernels are written for
+ * which the CPU and the operating system support, all false on other
+ * architectures.
+ */
+struct instruction_sets {
+    bool sse2, avx2, avx512;
+};
+
+/**
+ * @brief detect_instruction_sets queries the CPU, it is cheap enough to
+ * call once when a kernel is selected.
+ */
+instruction_sets detect_instruction_sets();
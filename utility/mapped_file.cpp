@@ -0,0 +1,228 @@
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+static void map(
+    const char* filename, bool writable, size_t& size, void*& file_handle,
+    void*& mapping_handle, uint8_t*& data
+) {
+    file_handle = CreateFileA(
+        filename, writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+        FILE_SHARE_READ | (writable ? 0 : FILE_SHARE_WRITE), nullptr,
+        writable ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr
+    );
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        file_handle = nullptr;
+        throw std::runtime_error("Could not open file");
+    }
+    if (!writable) {
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file_handle, &file_size))
+            throw std::runtime_error("Could not get file size");
+        size = file_size.QuadPart;
+    }
+    if (size == 0)
+        return; // empty files can't be mapped
+
+    mapping_handle = CreateFileMappingA(
+        file_handle, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY,
+        static_cast<DWORD>(uint64_t(size) >> 32), static_cast<DWORD>(size),
+        nullptr
+    );
+    if (!mapping_handle)
+        throw std::runtime_error("Could not map file");
+    data = static_cast<uint8_t*>(MapViewOfFile(
+        mapping_handle, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size
+    ));
+    if (!data)
+        throw std::runtime_error("Could not map file");
+}
+
+mapped_file::mapped_file(const char* filename) {
+    try {
+        map(filename, false, size, file_handle, mapping_handle, data);
+    } catch (...) {
+        close();
+        throw;
+    }
+}
+
+mapped_file::mapped_file(const char* filename, size_t size) : size(size) {
+    try {
+        map(filename, true, this->size, file_handle, mapping_handle, data);
+    } catch (...) {
+        close();
+        throw;
+    }
+}
+
+void mapped_file::close() {
+    if (data)
+        UnmapViewOfFile(data);
+    if (mapping_handle)
+        CloseHandle(mapping_handle);
+    if (file_handle)
+        CloseHandle(file_handle);
+    data = nullptr;
+    mapping_handle = file_handle = nullptr;
+    size = 0;
+}
+
+mapped_file::mapped_file(mapped_file&& o) :
+    data(std::exchange(o.data, nullptr)), size(std::exchange(o.size, 0)),
+    file_handle(std::exchange(o.file_handle, nullptr)),
+    mapping_handle(std::exchange(o.mapping_handle, nullptr)) {}
+
+mapped_file& mapped_file::operator=(mapped_file&& o) {
+    close();
+    data = std::exchange(o.data, nullptr);
+    size = std::exchange(o.size, 0);
+    file_handle = std::exchange(o.file_handle, nullptr);
+    mapping_handle = std::exchange(o.mapping_handle, nullptr);
+    return *this;
+}
+
+void mapped_file::advise(size_t offset, size_t length, advice advice) const {
+    if (!data || offset >= size)
+        return;
+    // only reading ahead is supported
+    if (advice != advice::will_need)
+        return;
+    WIN32_MEMORY_RANGE_ENTRY range{
+        data + offset, std::min(length, size - offset)
+    };
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+#else
+
+static void map(
+    const char* filename, bool writable, size_t& size, int& file_descriptor,
+    uint8_t*& data
+) {
+    file_descriptor = open(
+        filename, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644
+    );
+    if (file_descriptor < 0)
+        throw std::runtime_error("Could not open file");
+    if (writable) {
+        if (ftruncate(file_descriptor, size) != 0)
+            throw std::runtime_error("Could not resize file");
+    } else {
+        struct stat status;
+        if (fstat(file_descriptor, &status) != 0)
+            throw std::runtime_error("Could not get file size");
+        size = status.st_size;
+    }
+    if (size == 0)
+        return; // empty files can't be mapped
+
+    void* mapping = mmap(
+        nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+        MAP_SHARED, file_descriptor, 0
+    );
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("Could not map file");
+    data = static_cast<uint8_t*>(mapping);
+}
+
+mapped_file::mapped_file(const char* filename) {
+    try {
+        map(filename, false, size, file_descriptor, data);
+    } catch (...) {
+        close();
+        throw;
+    }
+}
+
+mapped_file::mapped_file(const char* filename, size_t size) : size(size) {
+    try {
+        map(filename, true, this->size, file_descriptor, data);
+    } catch (...) {
+        close();
+        throw;
+    }
+}
+
+void mapped_file::close() {
+    if (data)
+        munmap(data, size);
+    if (file_descriptor >= 0)
+        ::close(file_descriptor);
+    data = nullptr;
+    file_descriptor = -1;
+    size = 0;
+}
+
+mapped_file::mapped_file(mapped_file&& o) :
+    data(std::exchange(o.data, nullptr)), size(std::exchange(o.size, 0)),
+    file_descriptor(std::exchange(o.file_descriptor, -1)) {}
+
+mapped_file& mapped_file::operator=(mapped_file&& o) {
+    close();
+    data = std::exchange(o.data, nullptr);
+    size = std::exchange(o.size, 0);
+    file_descriptor = std::exchange(o.file_descriptor, -1);
+    return *this;
+}
+
+void mapped_file::advise(size_t offset, size_t length, advice advice) const {
+    if (!data || offset >= size)
+        return;
+    length = std::min(length, size - offset);
+    // madvise takes whole pages
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t begin = offset / page_size * page_size;
+    static const int advices[] = {
+        MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED,
+    };
+    madvise(
+        data + begin, offset + length - begin,
+        advices[static_cast<int>(advice)]
+    );
+}
+
+#endif
+
+mapped_file::~mapped_file() {
+    close();
+}
+
+// 64 bit FNV-1a
+static uint64_t hash(const uint8_t* data, size_t size, uint64_t hash) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+uint64_t content_hash(const char* filename) {
+    const size_t sample_size = 1024*1024;
+    mapped_file file(filename);
+    uint64_t size = file.size;
+    uint64_t result = ::hash(
+        reinterpret_cast<const uint8_t*>(&size), sizeof(size),
+        0xcbf29ce484222325ull
+    );
+    size_t head = std::min<size_t>(file.size, sample_size);
+    result = ::hash(file.data, head, result);
+    // the tail doesn't overlap the head
+    size_t tail = std::min(file.size - head, sample_size);
+    return ::hash(file.data + file.size - tail, tail, result);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief mapped_file maps a whole file into memory.
+ */
+struct mapped_file {
+    mapped_file() = default;
+    /**
+     * @brief opens an existing file for reading.
+     */
+    mapped_file(const char* filename);
+    /**
+     * @brief opens or creates a file for reading and writing and resizes it
+     * to the given size.
+     */
+    mapped_file(const char* filename, size_t size);
+    mapped_file(const mapped_file&) = delete;
+    mapped_file(mapped_file&& o);
+    ~mapped_file();
+
+    mapped_file& operator=(const mapped_file&) = delete;
+    mapped_file& operator=(mapped_file&& o);
+
+    operator bool() const {
+        return data != nullptr;
+    }
+
+    // how a range of the mapping is going to be read
+    enum struct advice {
+        normal,
+        sequential, // read ahead aggressively, drop pages behind
+        random, // don't read ahead
+        will_need, // read it in now
+    };
+
+    /**
+     * @brief advise tells the OS how a range of the mapping is going to be
+     * read, so it reads ahead accordingly. The range is extended to whole
+     * pages. Advice the OS doesn't support is ignored.
+     * @param offset is the start of the range in bytes.
+     * @param length is the size of the range in bytes.
+     */
+    void advise(size_t offset, size_t length, advice advice) const;
+
+    uint8_t* data = nullptr;
+    size_t size = 0;
+
+private:
+    void close();
+
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#else
+    int file_descriptor = -1;
+#endif
+};
+
+/**
+ * @brief content_hash hashes the size and the first and last megabyte of a
+ * file, which tells edited media files apart without reading all of them.
+ * @throws std::runtime_error if the file can't be read.
+ */
+uint64_t content_hash(const char* filename);
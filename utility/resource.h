@@ -22,17 +22,17 @@ struct unique_resource {
         o.value = Null;
         return *this;
     }
-    auto operator*() {
+    auto operator*() const {
         return *value;
     }
-    T operator->() {
+    T operator->() const {
         return value;
     }
     operator bool() const {
         return value != Null;
     }
 
-    const T& get() {
+    const T& get() const {
         return value;
     };
 
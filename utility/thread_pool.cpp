@@ -0,0 +1,90 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+
+thread_pool::thread_pool(unsigned thread_count) {
+    // hardware_concurrency may return 0 if unknown
+    thread_count = std::max(thread_count, 1u);
+    for (auto i = 0u; i < thread_count; i++)
+        threads.emplace_back(&thread_pool::work, this);
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    task_added.notify_all();
+    for (auto& thread : threads)
+        thread.join();
+}
+
+void thread_pool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    task_added.notify_one();
+}
+
+void thread_pool::work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        task_added.wait(lock, [this]() {
+            return stopping || !tasks.empty();
+        });
+        if (tasks.empty())
+            return; // stopping
+        auto task = std::move(tasks.front());
+        tasks.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
+
+struct parallel_for_job {
+    std::function<void(size_t)> function;
+    size_t count;
+    std::atomic<size_t> next{0}, done{0};
+    std::mutex mutex;
+    std::condition_variable finished;
+
+    void run() {
+        size_t i;
+        while ((i = next.fetch_add(1)) < count) {
+            function(i);
+            if (done.fetch_add(1) + 1 == count) {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished.notify_all();
+            }
+        }
+    }
+};
+
+void thread_pool::parallel_for(
+    size_t count, const std::function<void(size_t)>& function
+) {
+    if (count == 0)
+        return;
+
+    // helpers may start after the job is done, so they share ownership
+    auto job = std::make_shared<parallel_for_job>();
+    job->function = function;
+    job->count = count;
+
+    size_t helpers = std::min<size_t>(count - 1, threads.size());
+    for (size_t i = 0; i < helpers; i++)
+        submit([job]() { job->run(); });
+
+    job->run();
+
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->finished.wait(lock, [&]() { return job->done == job->count; });
+}
+
+thread_pool& shared_thread_pool() {
+    static thread_pool pool;
+    return pool;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief thread_pool runs tasks on a fixed number of threads.
+ */
+struct thread_pool {
+    thread_pool(unsigned thread_count = std::thread::hardware_concurrency());
+    ~thread_pool();
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    /**
+     * @brief submit queues a task to run on one of the threads.
+     */
+    void submit(std::function<void()> task);
+
+    /**
+     * @brief parallel_for calls function for every index in [0, count) and
+     * returns once all calls are done. The calling thread takes part, so it
+     * may be called from tasks of the pool.
+     */
+    void parallel_for(
+        size_t count, const std::function<void(size_t)>& function
+    );
+
+    unsigned thread_count() const {
+        return static_cast<unsigned>(threads.size());
+    }
+
+private:
+    void work();
+
+    std::mutex mutex;
+    std::condition_variable task_added;
+    std::deque<std::function<void()>> tasks;
+    bool stopping = false;
+
+    std::vector<std::thread> threads;
+};
+
+/**
+ * @brief shared_thread_pool is used for work that is split up within a single
+ * frame or file, e.g. converting slices.
+ */
+thread_pool& shared_thread_pool();
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <stdexcept>
 
 #include <vulkan/vulkan.h>
@@ -61,7 +62,12 @@ inline void vulkan_wait_and_delete_fence(VkFence* fence) {
     VkResult result = vkWaitForFences(current_device, 1, fence, VK_TRUE, ~0ul);
     // fence needs to be cleaned up regardless of whether waiting succeeded
     vkDestroyFence(current_device, *fence, nullptr);
-    if (result != VK_SUCCESS && result != VK_TIMEOUT)
+    // nothing is left to wait for on a lost device, the ui is destroyed
+    // after losing it
+    if (
+        result != VK_SUCCESS && result != VK_TIMEOUT &&
+        result != VK_ERROR_DEVICE_LOST
+    )
         check(result);
 }
 
@@ -81,6 +87,29 @@ typedef unique_resource<VkInstance, vulkan_delete_instance, VK_NULL_HANDLE>
 typedef unique_resource<VkDevice, vulkan_delete_device, VK_NULL_HANDLE>
     unique_device;
 
+/**
+ * @brief shared_device is a unique_device destroyed with its last copy. The
+ * ui shares its device with memory it hands out, so the device outlives the
+ * ui until that memory is freed.
+ */
+struct shared_device {
+    shared_device() = default;
+    shared_device(unique_device device) :
+        device(std::make_shared<unique_device>(std::move(device)))
+    {}
+
+    operator bool() const {
+        return device && *device;
+    }
+
+    VkDevice get() const {
+        return device ? device->get() : VK_NULL_HANDLE;
+    }
+
+private:
+    std::shared_ptr<unique_device> device;
+};
+
 typedef unique_resource<VkSurfaceKHR, vulkan_delete_surface, VK_NULL_HANDLE>
     unique_surface;
 